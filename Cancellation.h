@@ -0,0 +1,87 @@
+// Cancellation.h
+//
+// CancellationToken, the stop signal a caller hands to asynchronous work, and
+// how it reaches the loops that honour it. Whoever runs work on behalf of a
+// token makes it current for that thread with a CancellationScope; the A*
+// search and the annealers then poll cancellationRequested() every so many
+// steps. With no token current a check
+// is one thread_local load, so synchronous callers pay next to nothing.
+
+#ifndef CANCELLATION_INCLUDED
+#define CANCELLATION_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <memory>
+
+  // Stop signal shared between a caller and work it started. Copies share one
+  // flag, so the caller keeps a copy and passes another along. After cancel(), or
+  // once the deadline passes, the work stops at its next check and reports
+  // CANCELLED. A token nobody cancels and with no deadline never fires.
+class CancellationToken
+{
+public:
+    CancellationToken()
+     : m_state(std::make_shared<State>())
+    {}
+    void cancel()
+    {
+        m_state->cancelled.store(true, std::memory_order_relaxed);
+    }
+    void setDeadline(std::chrono::steady_clock::time_point deadline)
+    {
+        m_state->deadline.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+    }
+    void cancelAfter(std::chrono::milliseconds timeout)
+    {
+        setDeadline(std::chrono::steady_clock::now() + timeout);
+    }
+    bool cancelled() const
+    {
+        if (m_state->cancelled.load(std::memory_order_relaxed))
+            return true;
+        std::chrono::steady_clock::rep deadline = m_state->deadline.load(std::memory_order_relaxed);
+        return deadline != NO_DEADLINE && std::chrono::steady_clock::now().time_since_epoch().count() >= deadline;
+    }
+private:
+    static constexpr std::chrono::steady_clock::rep NO_DEADLINE = std::numeric_limits<std::chrono::steady_clock::rep>::max();
+    struct State
+    {
+        std::atomic<bool> cancelled{false};
+        std::atomic<std::chrono::steady_clock::rep> deadline{NO_DEADLINE};
+    };
+    std::shared_ptr<State> m_state;
+};
+
+  // the token the current thread's work answers to, if any
+inline thread_local const CancellationToken* activeCancellation = nullptr;
+
+  // Makes token current for this thread until the end of the scope.
+class CancellationScope
+{
+public:
+    CancellationScope(const CancellationToken* token)
+     : m_parent(activeCancellation)
+    {
+        activeCancellation = token;
+    }
+    ~CancellationScope()
+    {
+        activeCancellation = m_parent;
+    }
+    CancellationScope(const CancellationScope&) = delete;
+    CancellationScope& operator=(const CancellationScope&) = delete;
+private:
+    const CancellationToken* m_parent;
+};
+
+inline bool cancellationRequested()
+{
+    return activeCancellation != nullptr && activeCancellation->cancelled();
+}
+
+  // loops poll once every this many steps, which keeps the clock reads for deadlines rare
+const unsigned CANCEL_CHECK_INTERVAL = 256;
+
+#endif // CANCELLATION_INCLUDED
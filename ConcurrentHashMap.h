@@ -0,0 +1,404 @@
+// ConcurrentHashMap.h
+//
+// Thread-safe sibling of ExpandableHashMap for state shared between threads
+// that is read far more often than it is written, such as the road distances
+// the optimizer's annealer and its prefetch thread both fill in. It has the
+// same associate/remove interface and uses the same hasher() functions; find
+// copies the value out, since the map may free it once the reader has left.
+//
+// Keys are spread over SHARDS shards, each with its own bucket array and its own
+// writer lock, so writers only wait for writers of the same shard. Readers take
+// no lock: a bucket is a chain of immutable links published with a single
+// atomic store, and a key's value is a pointer swapped atomically, so find
+// either sees an insert whole or not at all.
+//
+// Resizing is incremental. When a shard passes the load factor its writer
+// hangs a bucket array twice the size off the current one, and from then on
+// every write to the shard links new keys into the new array and moves
+// MIGRATE_BUCKETS of the old buckets across, so no write pays for more than a
+// few buckets. Until the last bucket has moved, readers look in both arrays.
+//
+// Memory a reader might still be looking at (a replaced or removed value, a
+// removed key, an old bucket array) is reclaimed by epochs. A reader registers
+// with its shard's current epoch for the length of one lookup; a writer puts
+// what it unlinks in the bag for the current epoch. Once no reader is left in
+// the epoch before, the writer frees that epoch's bag and moves the epoch on,
+// so at most two epochs' garbage is ever held.
+
+#ifndef CONCURRENTHASHMAP_INCLUDED
+#define CONCURRENTHASHMAP_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Instrumentation.h"
+
+template<typename KeyType, typename ValueType>
+class ConcurrentHashMap
+{
+public:
+    ConcurrentHashMap(double maximumLoadFactor = 0.5);
+    ~ConcurrentHashMap();
+    // Back to empty, freeing everything. Unlike every other function here, this
+    // must not run while another thread is using the map.
+    void reset();
+    int size() const; // number of associations; only a snapshot while writers are running
+    // Associates key with value, replacing any value it had, as
+    // ExpandableHashMap::associate does.
+    void associate(const KeyType& key, const ValueType& value);
+    // If key has a value, returns a copy and sets inserted to false. Otherwise
+    // associates key with value, sets inserted to true and returns value.
+    // This is one step under the shard's lock, so when several threads race to
+    // fill in the same key exactly one of them inserts and all get the same value.
+    ValueType findOrAssociate(const KeyType& key, const ValueType& value, bool& inserted);
+    // If an association exists with the given key, removes it and returns true;
+    // otherwise returns false and leaves the hashmap unchanged.
+    bool remove(const KeyType& key);
+    // If key has a value, copies it into value and returns true; otherwise
+    // returns false. Takes no lock and never waits.
+    bool find(const KeyType& key, ValueType& value) const;
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+private:
+    static const int SHARDS = 16;
+    static const int MIGRATE_BUCKETS = 16; //old buckets each write moves while a shard is resizing
+    struct Node{
+        KeyType m_key;
+        std::atomic<const ValueType*> m_value; //nullptr once removed
+        int m_slot; //index in its shard's nodes
+        Node(const KeyType& key, int slot)
+         : m_key(key), m_value(nullptr), m_slot(slot)
+        {}
+    };
+    struct Link{ //one step of a bucket's chain; never changed once published
+        Node* node;
+        Link* next;
+    };
+    struct Table{
+        int length;
+        std::unique_ptr<std::atomic<Link*>[]> buckets;
+        std::deque<Link> links; //owns every link in buckets
+        std::atomic<Table*> next; //the array this one is being moved into, if any
+        Table(int n)
+         : length(n), buckets(new std::atomic<Link*>[n]), next(nullptr)
+        {
+            for (int i = 0; i < n; i++)
+                buckets[i].store(nullptr, std::memory_order_relaxed);
+        }
+    };
+    struct Retired{ //what a writer unlinked during one epoch
+        std::vector<std::unique_ptr<Table>> tables;
+        std::vector<std::unique_ptr<Node>> nodes;
+        std::vector<std::unique_ptr<const ValueType>> values;
+        bool empty() const { return tables.empty() && nodes.empty() && values.empty(); }
+        void clear() { tables.clear(); nodes.clear(); values.clear(); }
+    };
+    struct alignas(64) Shard{ //aligned so writers on neighbouring shards don't share a cache line
+        std::mutex lock;
+        std::atomic<Table*> table; //where readers start; while resizing, its next is the new array
+        std::atomic<unsigned> epoch;
+        std::atomic<int> active[2]; //readers registered with an even and an odd epoch
+        int linked; //nodes in the newest array's chains, removed ones included
+        int migrated; //old buckets already moved, while resizing
+        std::vector<Node*> nodes; //every node linked in the newest array, each freed by the shard
+        std::vector<Node*> dropped; //removed nodes left out of the new array, while resizing
+        Retired retired[2]; //by parity of the epoch they were unlinked in
+    };
+    double loadFactor;
+    std::atomic<int> m_size;
+    Shard m_shards[SHARDS];
+
+      // Registers a reader with its shard's epoch for the guard's lifetime. The
+      // epoch is read again after registering; if it moved on meanwhile the
+      // writer may not have seen the registration, so the reader tries again.
+    class ReadGuard{
+    public:
+        ReadGuard(Shard& shard) : m_shard(shard)
+        {
+            for (;;){
+                unsigned e = shard.epoch.load();
+                m_parity = e & 1;
+                shard.active[m_parity].fetch_add(1);
+                if (shard.epoch.load() == e)
+                    break;
+                shard.active[m_parity].fetch_sub(1, std::memory_order_release);
+            }
+        }
+        ~ReadGuard() { m_shard.active[m_parity].fetch_sub(1, std::memory_order_release); }
+    private:
+        Shard& m_shard;
+        unsigned m_parity;
+    };
+
+    void clearShard(Shard& shard);
+    void freeShard(Shard& shard);
+    Node* findNode(const Table* table, const KeyType& key, unsigned int hashed) const;
+    Node* locate(Shard& shard, const KeyType& key, unsigned int hashed) const;
+    Node* insert(Shard& shard, const KeyType& key, unsigned int hashed);
+    void link(Table* table, Node* node, unsigned int hashed);
+    void migrate(Shard& shard);
+    void retire(Shard& shard, const ValueType* value);
+    void reclaim(Shard& shard);
+    unsigned int getHash(const KeyType& key) const {
+        unsigned int hasher(const KeyType& k); // prototype
+        return hasher(key);
+    }
+    Shard& shardFor(unsigned int hashed) const {
+        return const_cast<Shard&>(m_shards[(hashed >> 8) % SHARDS]);
+    }
+};
+
+template <typename KeyType, typename ValueType> ConcurrentHashMap<KeyType, ValueType>::ConcurrentHashMap(double maximumLoadFactor)
+ : m_size(0)
+{
+    loadFactor = maximumLoadFactor;
+    if (loadFactor <= 0)
+        loadFactor = 0.5;
+    for (Shard& shard : m_shards){
+        shard.table.store(nullptr, std::memory_order_relaxed);
+        shard.epoch.store(0, std::memory_order_relaxed);
+        shard.active[0].store(0, std::memory_order_relaxed);
+        shard.active[1].store(0, std::memory_order_relaxed);
+        clearShard(shard);
+    }
+}
+
+template <typename KeyType, typename ValueType> ConcurrentHashMap<KeyType, ValueType>::~ConcurrentHashMap()
+{
+    for (Shard& shard : m_shards)
+        freeShard(shard);
+}
+
+template <typename KeyType, typename ValueType> void ConcurrentHashMap<KeyType, ValueType>::reset()
+{
+    for (Shard& shard : m_shards)
+        clearShard(shard);
+    m_size.store(0, std::memory_order_relaxed);
+}
+
+template <typename KeyType, typename ValueType> void ConcurrentHashMap<KeyType, ValueType>::clearShard(Shard& shard)
+{
+    freeShard(shard);
+    shard.table.store(new Table(8), std::memory_order_release); //create new array of size 8 to replace deleted one
+    shard.linked = 0;
+    shard.migrated = 0;
+}
+
+template <typename KeyType, typename ValueType> void ConcurrentHashMap<KeyType, ValueType>::freeShard(Shard& shard)
+{
+    for (Node* node : shard.nodes){
+        delete node->m_value.load(std::memory_order_relaxed);
+        delete node;
+    }
+    shard.nodes.clear();
+    for (Node* node : shard.dropped)
+        delete node;
+    shard.dropped.clear();
+    shard.retired[0].clear();
+    shard.retired[1].clear();
+    Table* table = shard.table.load(std::memory_order_relaxed);
+    if (table != nullptr){
+        delete table->next.load(std::memory_order_relaxed);
+        delete table;
+    }
+    shard.table.store(nullptr, std::memory_order_relaxed);
+}
+
+template <typename KeyType, typename ValueType> int ConcurrentHashMap<KeyType, ValueType>::size() const
+{
+    return m_size.load(std::memory_order_relaxed);
+}
+
+template <typename KeyType, typename ValueType> void ConcurrentHashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value)
+{
+    unsigned int hashed = getHash(key);
+    Shard& shard = shardFor(hashed);
+    std::lock_guard<std::mutex> lk(shard.lock);
+    Node* node = locate(shard, key, hashed);
+    if (node == nullptr) //case for a key this shard has no node for
+        node = insert(shard, key, hashed);
+    const ValueType* old = node->m_value.exchange(new ValueType(value), std::memory_order_acq_rel);
+    if (old == nullptr)
+        m_size.fetch_add(1, std::memory_order_relaxed);
+    else retire(shard, old);
+    migrate(shard);
+    reclaim(shard);
+}
+
+template <typename KeyType, typename ValueType> ValueType ConcurrentHashMap<KeyType, ValueType>::findOrAssociate(const KeyType& key, const ValueType& value, bool& inserted)
+{
+    ValueType found;
+    inserted = false;
+    if (find(key, found)) //most calls find it, so try without the lock first
+        return found;
+    unsigned int hashed = getHash(key);
+    Shard& shard = shardFor(hashed);
+    std::lock_guard<std::mutex> lk(shard.lock);
+    Node* node = locate(shard, key, hashed);
+    const ValueType* current = node == nullptr ? nullptr : node->m_value.load(std::memory_order_relaxed);
+    if (current != nullptr) //case for another thread getting there first
+        return *current;
+    if (node == nullptr)
+        node = insert(shard, key, hashed);
+    node->m_value.store(new ValueType(value), std::memory_order_release);
+    m_size.fetch_add(1, std::memory_order_relaxed);
+    inserted = true;
+    migrate(shard);
+    reclaim(shard);
+    return value;
+}
+
+template <typename KeyType, typename ValueType> bool ConcurrentHashMap<KeyType, ValueType>::remove(const KeyType& key)
+{
+    unsigned int hashed = getHash(key);
+    Shard& shard = shardFor(hashed);
+    std::lock_guard<std::mutex> lk(shard.lock);
+    Node* node = locate(shard, key, hashed);
+    const ValueType* old = node == nullptr ? nullptr : node->m_value.exchange(nullptr, std::memory_order_acq_rel);
+    if (old == nullptr)
+        return false;
+    m_size.fetch_sub(1, std::memory_order_relaxed);
+    retire(shard, old); //the node stays linked, empty, until the shard next resizes
+    migrate(shard);
+    reclaim(shard);
+    return true;
+}
+
+template <typename KeyType, typename ValueType> bool ConcurrentHashMap<KeyType, ValueType>::find(const KeyType& key, ValueType& value) const
+{
+    GOOBER_COUNT(hashLookups);
+    unsigned int hashed = getHash(key);
+    Shard& shard = shardFor(hashed);
+    ReadGuard guard(shard);
+    //a key is in the old array, the new one or both while a resize is under way; the first live value wins
+    for (const Table* t = shard.table.load(std::memory_order_acquire); t != nullptr; t = t->next.load(std::memory_order_acquire)){
+        const Node* node = findNode(t, key, hashed);
+        const ValueType* found = node == nullptr ? nullptr : node->m_value.load(std::memory_order_acquire);
+        if (found != nullptr){
+            value = *found;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename KeyType, typename ValueType> typename ConcurrentHashMap<KeyType, ValueType>::Node* ConcurrentHashMap<KeyType, ValueType>::findNode(const Table* table, const KeyType& key, unsigned int hashed) const
+{
+    const Link* p = table->buckets[hashed % table->length].load(std::memory_order_acquire);
+    while (p != nullptr){ //until the end of the chain
+        if (p->node->m_key == key) //case for a key matching the key we are looking for
+            return p->node;
+        p = p->next;
+    }
+    return nullptr;
+}
+
+  // The node for key, the shard's lock held, or nullptr. While resizing, a
+  // bucket already moved is only looked up in the new array: the old one may
+  // still link a removed node that the move dropped.
+template <typename KeyType, typename ValueType> typename ConcurrentHashMap<KeyType, ValueType>::Node* ConcurrentHashMap<KeyType, ValueType>::locate(Shard& shard, const KeyType& key, unsigned int hashed) const
+{
+    Table* table = shard.table.load(std::memory_order_relaxed);
+    Table* next = table->next.load(std::memory_order_relaxed);
+    Node* node = nullptr;
+    if (next == nullptr || (int)(hashed % table->length) >= shard.migrated)
+        node = findNode(table, key, hashed);
+    if (node == nullptr && next != nullptr)
+        node = findNode(next, key, hashed);
+    return node;
+}
+
+  // Makes a node for key, with no value yet, in the newest array, starting a
+  // resize first if that would take the shard past the load factor.
+template <typename KeyType, typename ValueType> typename ConcurrentHashMap<KeyType, ValueType>::Node* ConcurrentHashMap<KeyType, ValueType>::insert(Shard& shard, const KeyType& key, unsigned int hashed)
+{
+    Table* table = shard.table.load(std::memory_order_relaxed);
+    Table* next = table->next.load(std::memory_order_relaxed);
+    if (next == nullptr && (double)(shard.linked + 1)/table->length > loadFactor){
+        //make new array with double the size; the old one's buckets move across over the next few writes
+        GOOBER_COUNT(rehashes);
+        next = new Table(table->length * 2);
+        table->next.store(next, std::memory_order_release);
+        shard.linked = 0;
+        shard.migrated = 0;
+    }
+    Node* node = new Node(key, (int)shard.nodes.size());
+    shard.nodes.push_back(node);
+    link(next != nullptr ? next : table, node, hashed);
+    shard.linked++;
+    return node;
+}
+
+  // Puts node at the head of its bucket in table, the shard's lock held. The link
+  // is filled in before the store that publishes it, so a reader never sees it half made.
+template <typename KeyType, typename ValueType> void ConcurrentHashMap<KeyType, ValueType>::link(Table* table, Node* node, unsigned int hashed)
+{
+    std::atomic<Link*>& bucket = table->buckets[hashed % table->length];
+    table->links.push_back(Link{node, bucket.load(std::memory_order_relaxed)});
+    bucket.store(&table->links.back(), std::memory_order_release);
+}
+
+  // Moves the next MIGRATE_BUCKETS old buckets into the new array, dropping
+  // removed keys, and once the last has moved makes the new array the shard's.
+  // The old array keeps its chains, so a reader part way along one is unharmed.
+template <typename KeyType, typename ValueType> void ConcurrentHashMap<KeyType, ValueType>::migrate(Shard& shard)
+{
+    Table* table = shard.table.load(std::memory_order_relaxed);
+    Table* next = table->next.load(std::memory_order_relaxed);
+    if (next == nullptr) //case for no resize under way
+        return;
+    unsigned e = shard.epoch.load(std::memory_order_relaxed);
+    int end = std::min(table->length, shard.migrated + MIGRATE_BUCKETS);
+    for (; shard.migrated < end; shard.migrated++){
+        for (const Link* p = table->buckets[shard.migrated].load(std::memory_order_relaxed); p != nullptr; p = p->next){
+            Node* node = p->node;
+            if (node->m_value.load(std::memory_order_relaxed) != nullptr){
+                link(next, node, getHash(node->m_key));
+                shard.linked++;
+                continue;
+            }
+            //case for a removed key, dropped here; the old array links it until that goes too
+            Node* last = shard.nodes.back();
+            last->m_slot = node->m_slot;
+            shard.nodes[node->m_slot] = last;
+            shard.nodes.pop_back();
+            shard.dropped.push_back(node);
+        }
+    }
+    if (shard.migrated == table->length){
+        shard.table.store(next, std::memory_order_release);
+        Retired& retired = shard.retired[e & 1];
+        retired.tables.emplace_back(table);
+        for (Node* node : shard.dropped)
+            retired.nodes.emplace_back(node);
+        shard.dropped.clear();
+        shard.migrated = 0;
+    }
+}
+
+template <typename KeyType, typename ValueType> void ConcurrentHashMap<KeyType, ValueType>::retire(Shard& shard, const ValueType* value)
+{
+    shard.retired[shard.epoch.load(std::memory_order_relaxed) & 1].values.emplace_back(value);
+}
+
+  // Frees what was unlinked in the epoch before the current one, once no reader
+  // registered with that epoch is left, and moves the epoch on. A reader that
+  // registers with the current epoch or later started after those things were
+  // unlinked, so it can't reach them.
+template <typename KeyType, typename ValueType> void ConcurrentHashMap<KeyType, ValueType>::reclaim(Shard& shard)
+{
+    unsigned e = shard.epoch.load(std::memory_order_relaxed);
+    Retired& before = shard.retired[(e + 1) & 1];
+    if (before.empty() && shard.retired[e & 1].empty())
+        return;
+    if (shard.active[(e + 1) & 1].load() != 0) //case for a reader still in the epoch before
+        return;
+    before.clear();
+    shard.epoch.store(e + 1);
+}
+
+#endif // CONCURRENTHASHMAP_INCLUDED
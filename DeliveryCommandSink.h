@@ -0,0 +1,54 @@
+// DeliveryCommandSink.h
+//
+// Streaming output for DeliveryPlanner: instead of collecting a vector of
+// DeliveryCommands, a plan hands each command to a sink as it is generated.
+// The writers that turn a stream into text, JSON or binary are in
+// DeliveryCommandWriters.h.
+
+#ifndef DELIVERYCOMMANDSINK_INCLUDED
+#define DELIVERYCOMMANDSINK_INCLUDED
+
+#include "provided.h"
+#include <vector>
+
+  // Directions a planned command can carry. The first eight are compass headings
+  // for Proceed commands, the last two are for Turn commands.
+enum CommandDirection
+{
+    DIR_EAST, DIR_NORTHEAST, DIR_NORTH, DIR_NORTHWEST,
+    DIR_WEST, DIR_SOUTHWEST, DIR_SOUTH, DIR_SOUTHEAST,
+    DIR_LEFT, DIR_RIGHT
+};
+
+  // the word DeliveryCommand::description() uses for dir, e.g. "northeast"
+const char* directionText(CommandDirection dir);
+
+  // A DeliveryCommand as the planner produces it: a street is an index into
+  // StreetMap::graph().streetNames and an item is an index into the deliveries
+  // handed to the planner, so making one copies no strings.
+struct CompactCommand
+{
+    enum Kind { PROCEED, TURN, DELIVER };
+    Kind             kind;
+    CommandDirection direction;  // unused for DELIVER
+    int              street;     // -1 for DELIVER
+    int              delivery;   // -1 unless DELIVER
+    double           distance;   // miles, PROCEED only
+};
+
+  // Receives a plan's commands one at a time, as they are generated.
+class DeliveryCommandSink
+{
+public:
+    virtual ~DeliveryCommandSink() {}
+      // called before the first command with what its ids refer to
+    virtual void beginPlan(const StreetMap*, const std::vector<DeliveryRequest>&) {}
+    virtual void consume(const CompactCommand& command) = 0;
+      // called with each leg's route, as edge ids of StreetMap::graph() starting at
+      // node fromNode, before that leg's commands
+    virtual void consumeLeg(int, const std::vector<int>&) {}
+      // called once the plan is finished or has failed part way
+    virtual void endPlan(DeliveryResult, double) {}
+};
+
+#endif // DELIVERYCOMMANDSINK_INCLUDED
@@ -0,0 +1,288 @@
+#include "provided.h"
+#include "DeliveryCommandWriters.h"
+#include "StreetGraph.h"
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+using namespace std;
+
+namespace {
+
+  // a writer hands its buffer to the stream once it grows past this many bytes
+const size_t FLUSH_BYTES = 64 * 1024;
+
+const char* const DIRECTION_TEXT[] = {
+    "east", "northeast", "north", "northwest",
+    "west", "southwest", "south", "southeast",
+    "left", "right"
+};
+
+const char* resultText(DeliveryResult result)
+{
+    switch (result)
+    {
+      case DELIVERY_SUCCESS: return "DELIVERY_SUCCESS";
+      case NO_ROUTE:         return "NO_ROUTE";
+      case BAD_COORD:        return "BAD_COORD";
+      case CANCELLED:        return "CANCELLED";
+    }
+    return "";
+}
+
+void flushBuffer(ostream& out, string& buffer)
+{
+    if (!buffer.empty())
+        out.write(buffer.data(), buffer.size());
+    buffer.clear(); //keeps its capacity for the next plan
+}
+
+void appendMiles(string& buffer, double miles, const char* format)
+{
+    char text[32];
+    int n = snprintf(text, sizeof(text), format, miles);
+    buffer.append(text, n);
+}
+
+void appendJsonString(string& buffer, const string& s)
+{
+    buffer += '"';
+    for (char c : s){
+        switch (c)
+        {
+          case '"':  buffer += "\\\""; break;
+          case '\\': buffer += "\\\\"; break;
+          case '\n': buffer += "\\n"; break;
+          case '\r': buffer += "\\r"; break;
+          case '\t': buffer += "\\t"; break;
+          default:
+            if ((unsigned char)c < 0x20){ //other control characters aren't allowed raw in JSON
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+                buffer += escaped;
+            }
+            else buffer += c;
+        }
+    }
+    buffer += '"';
+}
+
+template <typename T> void appendRaw(string& buffer, const T& v)
+{
+    buffer.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+}  // namespace
+
+const char* directionText(CommandDirection dir)
+{
+    return DIRECTION_TEXT[dir];
+}
+
+//******************** TextCommandWriter **************************************
+
+TextCommandWriter::TextCommandWriter(ostream& out)
+ : m_out(out), m_sm(nullptr), m_deliveries(nullptr)
+{
+}
+
+TextCommandWriter::~TextCommandWriter()
+{
+    flushBuffer(m_out, m_buffer);
+}
+
+void TextCommandWriter::beginPlan(const StreetMap* sm, const vector<DeliveryRequest>& deliveries)
+{
+    m_sm = sm;
+    m_deliveries = &deliveries;
+}
+
+  // Each line is exactly what DeliveryCommand::description() gives for the command.
+void TextCommandWriter::consume(const CompactCommand& command)
+{
+    switch (command.kind)
+    {
+      case CompactCommand::PROCEED:
+        m_buffer += "Proceed ";
+        m_buffer += directionText(command.direction);
+        m_buffer += " on ";
+        m_buffer += m_sm->graph().streetNames[command.street];
+        m_buffer += " for ";
+        appendMiles(m_buffer, command.distance, "%.2f");
+        m_buffer += " miles\n";
+        break;
+      case CompactCommand::TURN:
+        m_buffer += "Turn ";
+        m_buffer += directionText(command.direction);
+        m_buffer += " on ";
+        m_buffer += m_sm->graph().streetNames[command.street];
+        m_buffer += '\n';
+        break;
+      case CompactCommand::DELIVER:
+        m_buffer += "DELIVER ";
+        m_buffer += (*m_deliveries)[command.delivery].item;
+        m_buffer += '\n';
+        break;
+    }
+    if (m_buffer.size() >= FLUSH_BYTES)
+        flushBuffer(m_out, m_buffer);
+}
+
+void TextCommandWriter::endPlan(DeliveryResult, double)
+{
+    flushBuffer(m_out, m_buffer);
+}
+
+//******************** JsonCommandWriter **************************************
+
+// Each plan is one line:
+//   {"commands":[{"type":"proceed","direction":"north","street":"Broxton Avenue","miles":0.12},
+//                {"type":"turn","direction":"left","street":"Weyburn Avenue"},
+//                {"type":"deliver","item":"Sardines","delivery":0}, ...],
+//    "result":"DELIVERY_SUCCESS","miles":1.98}
+// where "delivery" is the item's index in the deliveries passed to the planner.
+
+JsonCommandWriter::JsonCommandWriter(ostream& out)
+ : m_out(out), m_sm(nullptr), m_deliveries(nullptr), m_first(true)
+{
+}
+
+JsonCommandWriter::~JsonCommandWriter()
+{
+    flushBuffer(m_out, m_buffer);
+}
+
+void JsonCommandWriter::beginPlan(const StreetMap* sm, const vector<DeliveryRequest>& deliveries)
+{
+    m_sm = sm;
+    m_deliveries = &deliveries;
+    m_first = true;
+    m_buffer += "{\"commands\":[";
+}
+
+void JsonCommandWriter::consume(const CompactCommand& command)
+{
+    if (!m_first)
+        m_buffer += ',';
+    m_first = false;
+    switch (command.kind)
+    {
+      case CompactCommand::PROCEED:
+        m_buffer += "{\"type\":\"proceed\",\"direction\":\"";
+        m_buffer += directionText(command.direction);
+        m_buffer += "\",\"street\":";
+        appendJsonString(m_buffer, m_sm->graph().streetNames[command.street]);
+        m_buffer += ",\"miles\":";
+        appendMiles(m_buffer, command.distance, "%.6f");
+        m_buffer += '}';
+        break;
+      case CompactCommand::TURN:
+        m_buffer += "{\"type\":\"turn\",\"direction\":\"";
+        m_buffer += directionText(command.direction);
+        m_buffer += "\",\"street\":";
+        appendJsonString(m_buffer, m_sm->graph().streetNames[command.street]);
+        m_buffer += '}';
+        break;
+      case CompactCommand::DELIVER:
+        m_buffer += "{\"type\":\"deliver\",\"item\":";
+        appendJsonString(m_buffer, (*m_deliveries)[command.delivery].item);
+        m_buffer += ",\"delivery\":";
+        m_buffer += to_string(command.delivery);
+        m_buffer += '}';
+        break;
+    }
+    if (m_buffer.size() >= FLUSH_BYTES)
+        flushBuffer(m_out, m_buffer);
+}
+
+void JsonCommandWriter::endPlan(DeliveryResult result, double totalDistanceTravelled)
+{
+    m_buffer += "],\"result\":\"";
+    m_buffer += resultText(result);
+    m_buffer += "\",\"miles\":";
+    appendMiles(m_buffer, totalDistanceTravelled, "%.6f");
+    m_buffer += "}\n";
+    flushBuffer(m_out, m_buffer);
+}
+
+//******************** BinaryCommandWriter ************************************
+
+// Stream layout (native byte order), one block per plan:
+//   "GCS1"
+//   records, each starting with a one-byte tag:
+//     'S' street id (uint32), name length (uint32), name bytes
+//           -- sent the first time a plan uses the street, before the command that does
+//     'P' direction (uint8), street id (uint32), miles (double)
+//     'T' direction (uint8), street id (uint32)
+//     'D' delivery index (uint32), item length (uint32), item bytes
+//     'E' result (uint8), total miles (double)   -- ends the plan
+// Directions and results are the values of CommandDirection and DeliveryResult.
+
+namespace {
+
+const char COMMANDS_MAGIC[4] = { 'G', 'C', 'S', '1' };
+
+void appendBytes(string& buffer, const string& s)
+{
+    appendRaw(buffer, (uint32_t)s.size());
+    buffer.append(s);
+}
+
+}  // namespace
+
+BinaryCommandWriter::BinaryCommandWriter(ostream& out)
+ : m_out(out), m_sm(nullptr), m_deliveries(nullptr)
+{
+}
+
+BinaryCommandWriter::~BinaryCommandWriter()
+{
+    flushBuffer(m_out, m_buffer);
+}
+
+void BinaryCommandWriter::beginPlan(const StreetMap* sm, const vector<DeliveryRequest>& deliveries)
+{
+    m_sm = sm;
+    m_deliveries = &deliveries;
+    m_streetSent.assign(sm->graph().streetNames.size(), false);
+    m_buffer.append(COMMANDS_MAGIC, 4);
+}
+
+void BinaryCommandWriter::consume(const CompactCommand& command)
+{
+    if (command.kind != CompactCommand::DELIVER && !m_streetSent[command.street]){ //case for a street this plan hasn't named yet
+        m_buffer += 'S';
+        appendRaw(m_buffer, (uint32_t)command.street);
+        appendBytes(m_buffer, m_sm->graph().streetNames[command.street]);
+        m_streetSent[command.street] = true;
+    }
+    switch (command.kind)
+    {
+      case CompactCommand::PROCEED:
+        m_buffer += 'P';
+        appendRaw(m_buffer, (uint8_t)command.direction);
+        appendRaw(m_buffer, (uint32_t)command.street);
+        appendRaw(m_buffer, command.distance);
+        break;
+      case CompactCommand::TURN:
+        m_buffer += 'T';
+        appendRaw(m_buffer, (uint8_t)command.direction);
+        appendRaw(m_buffer, (uint32_t)command.street);
+        break;
+      case CompactCommand::DELIVER:
+        m_buffer += 'D';
+        appendRaw(m_buffer, (uint32_t)command.delivery);
+        appendBytes(m_buffer, (*m_deliveries)[command.delivery].item);
+        break;
+    }
+    if (m_buffer.size() >= FLUSH_BYTES)
+        flushBuffer(m_out, m_buffer);
+}
+
+void BinaryCommandWriter::endPlan(DeliveryResult result, double totalDistanceTravelled)
+{
+    m_buffer += 'E';
+    appendRaw(m_buffer, (uint8_t)result);
+    appendRaw(m_buffer, totalDistanceTravelled);
+    flushBuffer(m_out, m_buffer);
+}
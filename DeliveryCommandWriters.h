@@ -0,0 +1,65 @@
+// DeliveryCommandWriters.h
+//
+// DeliveryCommandSinks that serialize a plan to a stream.
+
+#ifndef DELIVERYCOMMANDWRITERS_INCLUDED
+#define DELIVERYCOMMANDWRITERS_INCLUDED
+
+#include "DeliveryCommandSink.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+  // The writers format into a buffer they keep between plans and hand it to the
+  // stream in large blocks, at the latest when a plan ends.
+  //   TextCommandWriter    one description() line per command
+  //   JsonCommandWriter    one JSON object per plan, on its own line
+  //   BinaryCommandWriter  tagged records; see DeliveryCommandWriters.cpp
+class TextCommandWriter : public DeliveryCommandSink
+{
+public:
+    TextCommandWriter(std::ostream& out);
+    ~TextCommandWriter();
+    void beginPlan(const StreetMap* sm, const std::vector<DeliveryRequest>& deliveries);
+    void consume(const CompactCommand& command);
+    void endPlan(DeliveryResult result, double totalDistanceTravelled);
+private:
+    std::ostream& m_out;
+    std::string m_buffer;
+    const StreetMap* m_sm;
+    const std::vector<DeliveryRequest>* m_deliveries;
+};
+
+class JsonCommandWriter : public DeliveryCommandSink
+{
+public:
+    JsonCommandWriter(std::ostream& out);
+    ~JsonCommandWriter();
+    void beginPlan(const StreetMap* sm, const std::vector<DeliveryRequest>& deliveries);
+    void consume(const CompactCommand& command);
+    void endPlan(DeliveryResult result, double totalDistanceTravelled);
+private:
+    std::ostream& m_out;
+    std::string m_buffer;
+    const StreetMap* m_sm;
+    const std::vector<DeliveryRequest>* m_deliveries;
+    bool m_first;
+};
+
+class BinaryCommandWriter : public DeliveryCommandSink
+{
+public:
+    BinaryCommandWriter(std::ostream& out);
+    ~BinaryCommandWriter();
+    void beginPlan(const StreetMap* sm, const std::vector<DeliveryRequest>& deliveries);
+    void consume(const CompactCommand& command);
+    void endPlan(DeliveryResult result, double totalDistanceTravelled);
+private:
+    std::ostream& m_out;
+    std::string m_buffer;
+    const StreetMap* m_sm;
+    const std::vector<DeliveryRequest>* m_deliveries;
+    std::vector<bool> m_streetSent;  // street ids already defined in this plan
+};
+
+#endif // DELIVERYCOMMANDWRITERS_INCLUDED
@@ -1,47 +1,298 @@
 #include "provided.h"
+#include "StreetGraph.h"
+#include "Instrumentation.h"
+#include "Cancellation.h"
+#include "ConcurrentHashMap.h"
+#include "WeightOverlay.h"
+#include "DistanceOracle.h"
 #include <vector>
 #include <cmath>
 #include <random>
+#include <queue>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <limits>
 using namespace std;
 
+struct LegKey //(from point, to point) pair the optimizer's road distances are kept under
+{
+    int from;
+    int to;
+};
+
+inline bool operator==(const LegKey& lhs, const LegKey& rhs)
+{
+    return lhs.from == rhs.from && lhs.to == rhs.to;
+}
+
+unsigned int hasher(const LegKey& k)
+{
+    //mix the two points so (a,b) and (b,a) land in different buckets
+    unsigned long long h = (unsigned long long)(unsigned int)k.from * 0x9E3779B97F4A7C15ULL;
+    h ^= (unsigned long long)(unsigned int)k.to + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+namespace {
+
+const double UNREACHABLE_MILES = 1e6; //stands in for a pair with no route, so tours through one still compare
+const unsigned ROAD_CANCEL_CHECK_INTERVAL = 16; //road annealing steps can each search, so they check more often
+const int PREFETCH_NEIGHBOURS = 8; //moves that survive the crow bound mostly join a point to one of its nearest few
+const int MOVE_SEARCHES_PER_POINT = 1; //searches the road annealer may run for its moves, per tour point
+
+  // Road distances between the depot (point 0) and the stops (points 1..n),
+  // searched for on demand and remembered. A lookup that misses runs one
+  // Dijkstra from the pair's start until the target is settled, keeping every
+  // other point settled on the way. Meanwhile a background thread works ahead
+  // of the annealer, from each point to the next one on the tour and to its
+  // nearest few by crow distance, which are the pairs the crow bound lets
+  // through; the far pairs are only searched if a move asks for them. A search
+  // always finds the same distance however far it runs, so the results never
+  // depend on which thread got there first. A cancelled search keeps nothing.
+  // The distances live in a ConcurrentHashMap the two threads share, so only
+  // the pairs searched for take memory, not all (n+1) x (n+1). Given a
+  // DistanceOracle, every distance comes from it instead and nothing is searched.
+class RoadDistances
+{
+public:
+    RoadDistances(const StreetGraph& g, const EdgeWeights& weights, const vector<int>& nodes, const DistanceOracle* oracle);
+    ~RoadDistances();
+    double bound(int a, int b) const{ //road distance if known, otherwise crow distance, which is never more
+        double d = 0;
+        return known(a, b, d) ? d : distanceEarthMiles(m_g.coords[m_nodes[a]], m_g.coords[m_nodes[b]]);
+    }
+      // sets d to the road distance, searching if need be; false, leaving d alone, if the search was cancelled
+    bool exact(int a, int b, double& d){
+        if (known(a, b, d))
+            return true;
+        GOOBER_COUNT(roadDistanceSearches);
+        return search(a, vector<int>(1, b)) && known(a, b, d);
+    }
+      // one search from from that settles targets and from's nearest neighbours; false if cancelled
+    bool searchAhead(int from, const vector<int>& targets);
+    void prefetch(const vector<int>& tour); //searchAhead to each point's successor, in tour order, on a background thread
+    bool known(int a, int b, double& d) const{
+        if (m_component[a] != m_component[b]){ //case for points in different parts of the map, which have no route
+            d = UNREACHABLE_MILES;
+            return true;
+        }
+        if (m_oracle != nullptr){
+            d = m_oracle->nodeDistance(m_nodes[a], m_nodes[b]);
+            if (d < 0)
+                d = UNREACHABLE_MILES;
+            return true;
+        }
+        return m_memo.find(LegKey{a, b}, d);
+    }
+private:
+    const StreetGraph& m_g;
+    const EdgeWeights& m_weights;
+    vector<int> m_nodes;                 //point -> node id
+    vector<pair<int, int>> m_pointsAt;   //(node id, point), sorted, to find the points at a settled node
+    vector<int> m_component;              //point -> connected part of the map it lies in
+    int m_points;
+    ConcurrentHashMap<LegKey, double> m_memo; //(from point, to point) -> road distance, once searched for
+    atomic<bool> m_stop;
+    thread m_prefetcher;
+    const DistanceOracle* m_oracle;      //answers every distance when set
+    bool search(int from, const vector<int>& targets); //false if cancelled
+};
+
+RoadDistances::RoadDistances(const StreetGraph& g, const EdgeWeights& weights, const vector<int>& nodes, const DistanceOracle* oracle)
+ : m_g(g), m_weights(weights), m_nodes(nodes), m_points((int)nodes.size()), m_stop(false), m_oracle(oracle)
+{
+    for (int p = 0; p < m_points; p++)
+        m_pointsAt.push_back(make_pair(nodes[p], p));
+    sort(m_pointsAt.begin(), m_pointsAt.end());
+    //label the parts of the map the points lie in, so a pair in different parts is known to have no
+    //route without a search exhausting one of them; closures only ever split parts further
+    vector<int> label(g.nodeCount(), -1);
+    vector<int> stack;
+    m_component.assign(m_points, -1);
+    for (int p = 0; p < m_points; p++){
+        if (label[nodes[p]] < 0){
+            label[nodes[p]] = p;
+            stack.push_back(nodes[p]);
+            while (!stack.empty()){
+                int u = stack.back();
+                stack.pop_back();
+                for (int e = g.firstEdge[u]; e < g.firstEdge[u + 1]; e++)
+                    if (label[g.edgeTarget[e]] < 0){
+                        label[g.edgeTarget[e]] = p;
+                        stack.push_back(g.edgeTarget[e]);
+                    }
+            }
+        }
+        m_component[p] = label[nodes[p]];
+    }
+}
+
+RoadDistances::~RoadDistances()
+{
+    m_stop = true;
+    if (m_prefetcher.joinable())
+        m_prefetcher.join();
+}
+
+bool RoadDistances::searchAhead(int from, const vector<int>& targets)
+{
+    const NodeCoord& at = m_g.coords[m_nodes[from]];
+    vector<pair<double, int>> nearest;
+    for (int p = 0; p < m_points; p++)
+        if (p != from && find(targets.begin(), targets.end(), p) == targets.end())
+            nearest.push_back(make_pair(distanceEarthMiles(at, m_g.coords[m_nodes[p]]), p));
+    int count = min((int)nearest.size(), PREFETCH_NEIGHBOURS);
+    partial_sort(nearest.begin(), nearest.begin() + count, nearest.end());
+    vector<int> ahead = targets;
+    for (int i = 0; i < count; i++)
+        ahead.push_back(nearest[i].second);
+    return search(from, ahead);
+}
+
+void RoadDistances::prefetch(const vector<int>& tour)
+{
+    m_prefetcher = thread([this, tour]() {
+        for (int k = 0; k + 1 < (int)tour.size() && !m_stop; k++)
+            searchAhead(tour[k], vector<int>(1, tour[k + 1]));
+    });
+}
+
+  // Dijkstra from point from until every target is settled. A node has its
+  // final distance once it is taken off the queue, so every point found on the
+  // way is recorded, not just the targets. A search with no single goal finds
+  // far more of them than A* toward one would. What it found is only recorded
+  // once it ends without being cancelled.
+bool RoadDistances::search(int from, const vector<int>& targets)
+{
+    struct SearchSpace{ //per-node state for one thread's searches, reused between them
+        vector<double> dist;
+        vector<unsigned> reached;
+        vector<unsigned> settled;
+        unsigned stamp = 0;
+        vector<pair<int, double>> found; //(point, distance) settled so far
+        vector<int> pending;              //targets not settled yet
+    };
+    thread_local SearchSpace space;
+    if ((int)space.reached.size() != m_g.nodeCount() || ++space.stamp == 0){
+        space.dist.assign(m_g.nodeCount(), 0);
+        space.reached.assign(m_g.nodeCount(), 0);
+        space.settled.assign(m_g.nodeCount(), 0);
+        space.stamp = 1;
+    }
+    double d = 0;
+    space.pending.clear();
+    for (int t : targets)
+        if (!known(from, t, d))
+            space.pending.push_back(t);
+    if (space.pending.empty())
+        return true;
+    space.found.clear();
+    typedef pair<double, int> Entry; //(distance, node)
+    priority_queue<Entry, vector<Entry>, greater<Entry>> open;
+    space.dist[m_nodes[from]] = 0;
+    space.reached[m_nodes[from]] = space.stamp;
+    open.push(Entry(0, m_nodes[from]));
+    unsigned untilCancelCheck = CANCEL_CHECK_INTERVAL;
+    while (!open.empty() && !space.pending.empty() && !m_stop){ //m_stop: the annealer is done with us
+        int u = open.top().second;
+        open.pop();
+        if (space.settled[u] == space.stamp) //stale entry for a node already settled closer
+            continue;
+        space.settled[u] = space.stamp;
+        if (--untilCancelCheck == 0){
+            if (cancellationRequested())
+                return false;
+            untilCancelCheck = CANCEL_CHECK_INTERVAL;
+        }
+        for (auto p = lower_bound(m_pointsAt.begin(), m_pointsAt.end(), make_pair(u, -1)); p != m_pointsAt.end() && p->first == u; p++){
+            space.found.push_back(make_pair(p->second, space.dist[u]));
+            auto target = find(space.pending.begin(), space.pending.end(), p->second);
+            if (target != space.pending.end()) //case for a target being settled
+                space.pending.erase(target);
+        }
+        for (int e = m_g.firstEdge[u]; e < m_g.firstEdge[u + 1]; e++){
+            if (m_weights.closed(e))
+                continue;
+            int v = m_g.edgeTarget[e];
+            double nextDist = space.dist[u] + m_weights.weight(m_g, e);
+            if (space.reached[v] != space.stamp || nextDist < space.dist[v]){
+                space.reached[v] = space.stamp;
+                space.dist[v] = nextDist;
+                open.push(Entry(nextDist, v));
+            }
+        }
+    }
+    bool inserted = false;
+    for (const pair<int, double>& f : space.found) //another thread may have found some first, with the same distance
+        m_memo.findOrAssociate(LegKey{from, f.first}, f.second, inserted);
+    for (int p = 0; p < m_points && open.empty(); p++) //searched everything reachable, so the rest have no route
+        if (!known(from, p, d))
+            m_memo.associate(LegKey{from, p}, UNREACHABLE_MILES);
+    return true;
+}
+
+}  // namespace
+
 class DeliveryOptimizerImpl
 {
 public:
-    DeliveryOptimizerImpl(const StreetMap* sm);
+    DeliveryOptimizerImpl(const StreetMap* sm, OptimizerMetric metric, const WeightOverlay* overlay, const DistanceOracle* oracle);
     ~DeliveryOptimizerImpl();
-    void optimizeDeliveryOrder( //function to optimize delivery order
+    void optimizeDeliveryOrder( //function to optimize delivery order, given as indexes into deliveries
         const GeoCoord& depot,
-        vector<DeliveryRequest>& deliveries,
+        const vector<DeliveryRequest>& deliveries,
+        vector<int>& order,
         double& oldCrowDistance,
         double& newCrowDistance) const;
 private:
     const StreetMap* m_sm;
+    OptimizerMetric m_metric;
+    const WeightOverlay* m_overlay;
+    const DistanceOracle* m_oracle;
+    void crowOrder( //simulated annealing on crow distance
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        vector<int>& order,
+        double& oldCrowDistance,
+        double& newCrowDistance) const;
+    bool refineByRoad( //improves a crow-optimized order on road distance; false if a stop isn't on the map
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        vector<int>& order,
+        double& oldRoadDistance,
+        double& newRoadDistance) const;
     double acceptProbability(double energy, double newEnergy, double temp) const{ //returns probability used for annealing method
         if (newEnergy < energy)
             return 1.0;
         return exp((energy-newEnergy)/temp);
     }
     double calcCrowDistance(const GeoCoord& depot,
-                            vector<DeliveryRequest> deliveries) const{ //calculates crow distance to make all deliveries
+                            const vector<DeliveryRequest>& deliveries,
+                            const vector<int>& order) const{ //calculates crow distance to make all deliveries
         double dist = 0;
-        GeoCoord past = depot;
-        for (int i = 0; i < deliveries.size(); i++){
-            dist += distanceEarthMiles(past, deliveries[i].location);
-            past = deliveries[i].location;
+        const GeoCoord* past = &depot;
+        for (int i = 0; i < order.size(); i++){
+            dist += distanceEarthMiles(*past, deliveries[order[i]].location);
+            past = &deliveries[order[i]].location;
         }
         return dist;
     }
-    void swapDels(int ind1, int ind2, vector<DeliveryRequest>& deliveries) const{ //swaps to deliveries to help optimize order
-        DeliveryRequest temp = deliveries[ind2];
-        deliveries[ind2] = deliveries[ind1];
-        deliveries[ind1] = temp;
+    void swapDels(int ind1, int ind2, vector<int>& order) const{ //swaps to deliveries to help optimize order
+        int temp = order[ind2];
+        order[ind2] = order[ind1];
+        order[ind1] = temp;
     }
     
 };
 
-DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm)
+DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm, OptimizerMetric metric, const WeightOverlay* overlay, const DistanceOracle* oracle)
 {
     m_sm = sm;
+    m_metric = metric;
+    m_overlay = overlay;
+    m_oracle = oracle;
 }
 
 DeliveryOptimizerImpl::~DeliveryOptimizerImpl()
@@ -50,37 +301,246 @@ DeliveryOptimizerImpl::~DeliveryOptimizerImpl()
 
 void DeliveryOptimizerImpl::optimizeDeliveryOrder(
     const GeoCoord& depot,
-    vector<DeliveryRequest>& deliveries,
+    const vector<DeliveryRequest>& deliveries,
+    vector<int>& order,
     double& oldCrowDistance,
     double& newCrowDistance) const
 {
-    oldCrowDistance = calcCrowDistance(depot, deliveries);
-    double temp = 10000;
+    GOOBER_LATENCY(optimizeLatencyHistogram());
+    crowOrder(depot, deliveries, order, oldCrowDistance, newCrowDistance);
+    if (m_metric == ROAD_METRIC){
+        double oldRoad = 0;
+        double newRoad = 0;
+        if (refineByRoad(depot, deliveries, order, oldRoad, newRoad)){ //otherwise a stop isn't on the map, so leave it to the planner to report, or the work was cancelled
+            oldCrowDistance = oldRoad;
+            newCrowDistance = newRoad;
+        }
+    }
+}
+
+void DeliveryOptimizerImpl::crowOrder(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<int>& order,
+    double& oldCrowDistance,
+    double& newCrowDistance) const
+{
+    //the annealer shuffles indexes rather than DeliveryRequests so a swap never copies item strings
+    order.resize(deliveries.size());
+    for (int i = 0; i < order.size(); i++)
+        order[i] = i;
+    oldCrowDistance = calcCrowDistance(depot, deliveries, order);
+    if (deliveries.size() < 2){ //case for nothing to reorder
+        newCrowDistance = oldCrowDistance;
+        return;
+    }
+    //temperatures are relative to the average leg, so a swap's chance of being taken doesn't depend on how big the map is;
+    //the range is the old 10000 down to 1, which keeps the number of iterations the same
+    double temp = oldCrowDistance / (deliveries.size() + 1) * 0.1;
+    const double finalTemp = temp / 10000;
     double coolingRate = .003;
-    vector<DeliveryRequest> currentSolution = deliveries; //vector of changing possible solutions
-    vector<DeliveryRequest> bestSolution = deliveries; //vector containing best solution
+    vector<int> currentSolution = order; //the state the walk is in
+    double currentDist = oldCrowDistance;
+    vector<int> bestSolution = order; //the shortest order seen so far, which the walk may since have left
+    double bestDist = oldCrowDistance;
     int randInd1 = 0;
     int randInd2 = 0;
-    while (temp > 1){ //until temp reaches 1 loop will continue to try to optimize
-        randInd1 = rand() % deliveries.size();
-        randInd2 = rand() % deliveries.size();
-        swapDels(randInd1, randInd2, currentSolution);
-        double curDist = calcCrowDistance(depot, currentSolution);
-        double bestDist = calcCrowDistance(depot, bestSolution);
-        if (curDist < bestDist){ //case for a more optimal solution if we swap
-            bestSolution = currentSolution;
+    //engine is local to the call so planners running on different threads never share random state
+    mt19937 rng(deliveries.size());
+    uniform_int_distribution<int> pickInd(0, (int)deliveries.size()-1);
+    uniform_real_distribution<double> pickProb(0.0, 1.0);
+    unsigned untilCancelCheck = CANCEL_CHECK_INTERVAL;
+    while (temp > finalTemp && temp > 0){ //loop continues to try to optimize until the walk has cooled off
+        if (--untilCancelCheck == 0){
+            if (cancellationRequested())
+                break; //the best order so far is still a whole order
+            untilCancelCheck = CANCEL_CHECK_INTERVAL;
         }
-        else {
-            double prob = (rand()%100)/100;
-            if (prob < acceptProbability(bestDist, curDist, temp)){ //case for a high chance of finding a more optimal solution if we swap
+        GOOBER_COUNT(optimizerIterations);
+        randInd1 = pickInd(rng);
+        randInd2 = pickInd(rng);
+        swapDels(randInd1, randInd2, currentSolution);
+        double curDist = calcCrowDistance(depot, deliveries, currentSolution);
+        double prob = pickProb(rng);
+        if (prob < acceptProbability(currentDist, curDist, temp)){ //case for a shorter order, or a longer one taken by chance to get out of a local minimum
+            currentDist = curDist;
+            GOOBER_COUNT(optimizerAcceptances);
+            if (curDist < bestDist){ //case for the shortest order yet
                 bestSolution = currentSolution;
+                bestDist = curDist;
             }
-            else swapDels(randInd1, randInd2, currentSolution); // case where swapping does no good
         }
-        temp *= 1-coolingRate; //decreasing temp so it eventually reaches 1
+        else swapDels(randInd1, randInd2, currentSolution); // case where swapping does no good
+        temp *= 1-coolingRate; //decreasing temp so it eventually reaches finalTemp
     }
-    deliveries = bestSolution;
-    newCrowDistance = calcCrowDistance(depot, deliveries);
+    if (calcCrowDistance(depot, deliveries, bestSolution) < oldCrowDistance) //never hand back an order longer than the one passed in
+        order = bestSolution;
+    newCrowDistance = calcCrowDistance(depot, deliveries, order);
+}
+
+  // A second annealing pass over the whole tour's road distance, starting from
+  // the crow order. Temperatures are relative to that tour's length. Each move
+  // swaps two stops and changes at most four legs. The legs it removes are in
+  // the current tour, so their distances are already known. For the legs it
+  // adds, crow distance gives a lower bound. The acceptance threshold is drawn
+  // first, so a move whose bound already misses it is turned down without any
+  // road search. Everything else is decided on exact distances, which gives the
+  // same answers as if every distance had been known from the start.
+bool DeliveryOptimizerImpl::refineByRoad(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<int>& order,
+    double& oldRoadDistance,
+    double& newRoadDistance) const
+{
+    const int n = (int)deliveries.size();
+    vector<int> nodes(n + 1);
+    nodes[0] = m_sm->nodeId(depot);
+    for (int i = 0; i < n; i++)
+        nodes[i + 1] = m_sm->nodeId(deliveries[i].location);
+    for (int node : nodes)
+        if (node < 0)
+            return false;
+    static const EdgeWeights baseWeights;
+    shared_ptr<const EdgeWeights> overlayWeights;
+    if (m_overlay != nullptr)
+        overlayWeights = m_overlay->weights();
+    const EdgeWeights& weights = overlayWeights ? *overlayWeights : baseWeights;
+    //the oracle only knows plain map lengths, so any overlay change means searching instead
+    bool useOracle = m_oracle != nullptr && m_oracle->ready() && weights.isBase();
+    RoadDistances road(m_sm->graph(), weights, nodes, useOracle ? m_oracle : nullptr);
+
+    //tour as points: depot, the stops in order, depot again; leg k runs from tour[k-1] to tour[k]
+    vector<int> tour(n + 2, 0);
+    for (int k = 0; k < n; k++)
+        tour[k + 1] = order[k] + 1;
+    //one search from each point settles its successors in both orders and its nearest few, which is
+    //nearly every distance the annealer asks about. On a single core they run up front, since a
+    //prefetcher would only compete with the annealer
+    if (useOracle)
+        ; //case for every distance being a lookup already
+    else if (thread::hardware_concurrency() > 1)
+        road.prefetch(tour); //in tour order, the legs asked about first
+    else {
+        for (int k = 0; k <= n; k++){
+            vector<int> next(1, tour[k + 1]);
+            next.push_back(tour[k] == n ? 0 : tour[k] + 1); //the successor in the order given
+            if (!road.searchAhead(tour[k], next))
+                return false;
+        }
+    }
+    //each of these is false if a search was cancelled, which leaves distances unknown, so the crow order is kept
+    auto tourLength = [&](const vector<int>& t, double& dist) {
+        dist = 0;
+        for (int k = 1; k < (int)t.size(); k++){
+            double leg = 0;
+            if (!road.exact(t[k - 1], t[k], leg))
+                return false;
+            dist += leg;
+        }
+        return true;
+    };
+    int legs[4];
+    auto legsLength = [&](int legCount, double& dist) {
+        dist = 0;
+        for (int l = 0; l < legCount; l++){
+            double leg = 0;
+            if (!road.exact(tour[legs[l] - 1], tour[legs[l]], leg))
+                return false;
+            dist += leg;
+        }
+        return true;
+    };
+    vector<int> given(n + 2, 0); //the order deliveries were passed in
+    for (int k = 0; k < n; k++)
+        given[k + 1] = k + 1;
+    double current = 0;
+    if (!tourLength(given, oldRoadDistance) || !tourLength(tour, current))
+        return false;
+    vector<int> best = tour;
+    double bestDist = current;
+    double crowLength = 0; //sets the temperature scale; unlike road distances it has no stand-ins for missing routes
+    for (int k = 1; k < (int)tour.size(); k++)
+        crowLength += distanceEarthMiles(m_sm->graph().coords[nodes[tour[k - 1]]], m_sm->graph().coords[nodes[tour[k]]]);
+    if (n >= 2 && crowLength > 0){
+        double temp = crowLength / (n + 1) * 0.1;
+        const double finalTemp = temp * 0.001;
+        const double coolingRate = .003;
+        mt19937 rng(n + 1);
+        uniform_int_distribution<int> pickInd(1, n);
+        uniform_real_distribution<double> pickProb(0.0, 1.0);
+        unsigned untilCancelCheck = ROAD_CANCEL_CHECK_INTERVAL;
+        int searchesLeft = useOracle ? numeric_limits<int>::max() : MOVE_SEARCHES_PER_POINT * (n + 1);
+        while (temp > finalTemp){
+            if (--untilCancelCheck == 0){
+                if (cancellationRequested()) //a search cut short leaves distances unknown, so keep the crow order
+                    return false;
+                untilCancelCheck = ROAD_CANCEL_CHECK_INTERVAL;
+            }
+            GOOBER_COUNT(optimizerIterations);
+            int i = pickInd(rng);
+            int j = pickInd(rng);
+            double threshold = -temp * log(1 - pickProb(rng)); //accept when the tour grows by less than this
+            temp *= 1-coolingRate;
+            if (i == j)
+                continue;
+            if (i > j)
+                swap(i, j);
+            int legCount = 0; //legs into and out of positions i and j, each once
+            legs[legCount++] = i;
+            legs[legCount++] = i + 1;
+            if (j != i + 1)
+                legs[legCount++] = j;
+            legs[legCount++] = j + 1;
+            double removed = 0;
+            if (!legsLength(legCount, removed))
+                return false;
+            swap(tour[i], tour[j]);
+            double addedBound = 0;
+            for (int l = 0; l < legCount; l++)
+                addedBound += road.bound(tour[legs[l] - 1], tour[legs[l]]);
+            if (addedBound - removed >= threshold){ //case for the move failing even at its most optimistic
+                GOOBER_COUNT(roadBoundRejections);
+                swap(tour[i], tour[j]);
+                continue;
+            }
+            int unknown = 0; //legs a search would have to find
+            double d = 0;
+            for (int l = 0; l < legCount; l++)
+                unknown += !road.known(tour[legs[l] - 1], tour[legs[l]], d);
+            if (unknown > searchesLeft){ //case for the move needing more searches than are left, so it isn't tried
+                swap(tour[i], tour[j]);
+                continue;
+            }
+            searchesLeft -= unknown;
+            double added = 0;
+            if (!legsLength(legCount, added))
+                return false;
+            if (added - removed >= threshold){ //case for the move failing on real distances
+                swap(tour[i], tour[j]);
+                continue;
+            }
+            GOOBER_COUNT(optimizerAcceptances);
+            current += added - removed;
+            if (current < bestDist){
+                best = tour;
+                bestDist = current;
+            }
+        }
+        if (!tourLength(best, bestDist)) //the running total may have drifted in the last bits
+            return false;
+    }
+    if (bestDist < oldRoadDistance){ //never hand back an order longer than the one passed in
+        for (int k = 0; k < n; k++)
+            order[k] = best[k + 1] - 1;
+        newRoadDistance = bestDist;
+    }
+    else {
+        for (int k = 0; k < n; k++)
+            order[k] = k;
+        newRoadDistance = oldRoadDistance;
+    }
+    return true;
 }
 
 //******************** DeliveryOptimizer functions ****************************
@@ -88,9 +548,23 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
 // These functions simply delegate to DeliveryOptimizerImpl's functions.
 // You probably don't want to change any of this code.
 
-DeliveryOptimizer::DeliveryOptimizer(const StreetMap* sm)
+namespace {
+
+void applyOrder(vector<DeliveryRequest>& deliveries, const vector<int>& order)
 {
-    m_impl = new DeliveryOptimizerImpl(sm);
+    vector<DeliveryRequest> reordered;
+    reordered.reserve(order.size());
+    for (int i : order)
+        reordered.push_back(std::move(deliveries[i]));
+    deliveries = std::move(reordered);
+}
+
+}  // namespace
+
+DeliveryOptimizer::DeliveryOptimizer(const StreetMap* sm, OptimizerMetric metric, const WeightOverlay* overlay,
+                                     const DistanceOracle* oracle)
+{
+    m_impl = new DeliveryOptimizerImpl(sm, metric, overlay, oracle);
 }
 
 DeliveryOptimizer::~DeliveryOptimizer()
@@ -104,5 +578,40 @@ void DeliveryOptimizer::optimizeDeliveryOrder(
         double& oldCrowDistance,
         double& newCrowDistance) const
 {
-    return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance);
+#ifdef GOOBER_INSTRUMENT
+    QueryStats stats;
+    optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance, stats);
+#else
+    vector<int> order;
+    m_impl->optimizeDeliveryOrder(depot, deliveries, order, oldCrowDistance, newCrowDistance);
+    applyOrder(deliveries, order);
+#endif
+}
+
+void DeliveryOptimizer::optimizeDeliveryOrder(
+        const GeoCoord& depot,
+        vector<DeliveryRequest>& deliveries,
+        double& oldCrowDistance,
+        double& newCrowDistance,
+        QueryStats& stats) const
+{
+    stats = QueryStats();
+    QueryStatsScope scope(&stats);
+    vector<int> order;
+    m_impl->optimizeDeliveryOrder(depot, deliveries, order, oldCrowDistance, newCrowDistance);
+    applyOrder(deliveries, order);
+#ifdef GOOBER_INSTRUMENT
+    if (scope.outermost())
+        recordQueryTotals(stats);
+#endif
+}
+
+void DeliveryOptimizer::optimizeDeliveryOrder(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        vector<int>& order,
+        double& oldCrowDistance,
+        double& newCrowDistance) const
+{
+    m_impl->optimizeDeliveryOrder(depot, deliveries, order, oldCrowDistance, newCrowDistance);
 }
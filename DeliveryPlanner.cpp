@@ -1,51 +1,178 @@
 #include "provided.h"
+#include "StreetGraph.h"
+#include "Instrumentation.h"
+#include "Cancellation.h"
+#include "WeightOverlay.h"
+#include "RouteCache.h"
+#include "DeliveryCommandSink.h"
+#include "PlanExecutor.h"
+#include "IncrementalPlan.h"
 #include <vector>
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <functional>
 using namespace std;
 
+namespace {
+
+const int MAX_INSERT_GAPS = 3;   //gaps an insert routes, best estimate first, before it gives up with NO_ROUTE
+const int MAX_REPAIR_LEGS = 4;   //legs a local repair may re-route; a wider window is left alone
+
+  // Sink behind the vector<DeliveryCommand> API: turns each compact command back
+  // into a DeliveryCommand and appends it.
+class CommandVectorSink : public DeliveryCommandSink
+{
+public:
+    CommandVectorSink(vector<DeliveryCommand>& commands)
+     : m_commands(commands), m_sm(nullptr), m_deliveries(nullptr)
+    {}
+    void beginPlan(const StreetMap* sm, const vector<DeliveryRequest>& deliveries)
+    {
+        m_sm = sm;
+        m_deliveries = &deliveries;
+    }
+    void consume(const CompactCommand& command)
+    {
+        DeliveryCommand dc;
+        switch (command.kind)
+        {
+          case CompactCommand::PROCEED:
+            dc.initAsProceedCommand(directionText(command.direction), m_sm->graph().streetNames[command.street], command.distance);
+            break;
+          case CompactCommand::TURN:
+            dc.initAsTurnCommand(directionText(command.direction), m_sm->graph().streetNames[command.street]);
+            break;
+          case CompactCommand::DELIVER:
+            dc.initAsDeliverCommand((*m_deliveries)[command.delivery].item);
+            break;
+        }
+        m_commands.push_back(dc);
+    }
+private:
+    vector<DeliveryCommand>& m_commands;
+    const StreetMap* m_sm;
+    const vector<DeliveryRequest>* m_deliveries;
+};
+
+  // same as angleOfLine, but for an edge of the graph
+double edgeAngle(const StreetGraph& g, int e)
+{
+    const NodeCoord& s = g.coords[g.edgeSource[e]];
+    const NodeCoord& t = g.coords[g.edgeTarget[e]];
+    double result = rad2deg(atan2(t.latitude - s.latitude, t.longitude - s.longitude));
+    if (result < 0)
+        result += 360;
+    return result;
+}
+
+  // same as angleBetween2Lines, but for two edges of the graph
+double angleBetweenEdges(const StreetGraph& g, int e1, int e2)
+{
+    const NodeCoord& s1 = g.coords[g.edgeSource[e1]];
+    const NodeCoord& t1 = g.coords[g.edgeTarget[e1]];
+    const NodeCoord& s2 = g.coords[g.edgeSource[e2]];
+    const NodeCoord& t2 = g.coords[g.edgeTarget[e2]];
+    double angle1 = atan2(t1.latitude - s1.latitude, t1.longitude - s1.longitude);
+    double angle2 = atan2(t2.latitude - s2.latitude, t2.longitude - s2.longitude);
+    double result = rad2deg(angle2 - angle1);
+    if (result < 0)
+        result += 360;
+    return result;
+}
+
+  // what one asynchronous plan carries from its optimize task to its route task
+struct AsyncPlan
+{
+    promise<PlanOutcome> done;
+    GeoCoord depot;
+    vector<DeliveryRequest> deliveries;
+    vector<int> order;
+    CancellationToken token;
+    DeliveryCommandSink* sink;
+    PlanOutcome outcome;
+};
+
+}  // namespace
+
 class DeliveryPlannerImpl
 {
 public:
-    DeliveryPlannerImpl(const StreetMap* sm);
+    DeliveryPlannerImpl(const StreetMap* sm, RouteCache* cache, const WeightOverlay* overlay, OptimizerMetric metric,
+                        const DistanceOracle* oracle);
     ~DeliveryPlannerImpl();
     DeliveryResult generateDeliveryPlan( //function to generate delivery plan
         const GeoCoord& depot,
         const vector<DeliveryRequest>& deliveries,
-        vector<DeliveryCommand>& commands,
+        DeliveryCommandSink& sink,
+        double& totalDistanceTravelled) const;
+    DeliveryResult generateDeliveryPlanInOrder( //same, but making the deliveries in the order given
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        DeliveryCommandSink& sink,
         double& totalDistanceTravelled) const;
+    future<PlanOutcome> generateDeliveryPlanAsync( //same as generateDeliveryPlan, as two tasks on executor
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        PlanExecutor& executor,
+        CancellationToken token,
+        DeliveryCommandSink* sink) const;
+    void legCommands( //streams the commands for driving route, then delivering deliveries[delivery] unless it's -1
+        const vector<int>& route,
+        int delivery,
+        DeliveryCommandSink& sink) const;
 private:
     const StreetMap* m_sm;
-    string direction(double angle) const{ //function returns what direction to travel based on angle
+    RouteCache* m_cache;
+    const WeightOverlay* m_overlay;
+    OptimizerMetric m_metric;
+    const DistanceOracle* m_oracle;  // for the ROAD_METRIC optimizer's distances
+    DeliveryResult planLegs( //routes depot -> deliveries[order[0]] -> ... -> depot, streaming commands to sink
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        const vector<int>& order,
+        DeliveryCommandSink& sink,
+        double& totalDistanceTravelled) const;
+    void routeAsync(AsyncPlan& plan) const; //second task of an asynchronous plan
+    CommandDirection direction(double angle) const{ //function returns what direction to travel based on angle
         if (22.5 < angle && angle <= 67.5) {
-            return "northeast";
+            return DIR_NORTHEAST;
         }
         else if (67.5 < angle && angle <= 112.5) {
-            return "north";
+            return DIR_NORTH;
         }
         else if (112.5 < angle && angle <= 157.5) {
-            return "northwest";
+            return DIR_NORTHWEST;
         }
         else if (157.5 < angle && angle <= 202.5) {
-            return "west";
+            return DIR_WEST;
         }
         else if (202.5 < angle && angle <= 247.5) {
-            return "southwest";
+            return DIR_SOUTHWEST;
         }
         else if (247.5 < angle && angle <= 292.5) {
-            return "south";
+            return DIR_SOUTH;
         }
         else if (292.5 < angle && angle <= 337.5) {
-            return "southeast";
+            return DIR_SOUTHEAST;
         }
         else {
-            return "east";
+            return DIR_EAST;
         }
     }
 
 };
 
-DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm)
+DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm, RouteCache* cache, const WeightOverlay* overlay, OptimizerMetric metric,
+                                         const DistanceOracle* oracle)
 {
     m_sm = sm;
+    m_cache = cache;
+    m_overlay = overlay;
+    m_metric = metric;
+    m_oracle = oracle;
 }
 
 DeliveryPlannerImpl::~DeliveryPlannerImpl()
@@ -55,86 +182,477 @@ DeliveryPlannerImpl::~DeliveryPlannerImpl()
 DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
     const GeoCoord& depot,
     const vector<DeliveryRequest>& deliveries,
-    vector<DeliveryCommand>& commands,
+    DeliveryCommandSink& sink,
     double& totalDistanceTravelled) const
 {
-    //call delivery optimizer to optimize order of deliveries vector for efficiency
-    DeliveryOptimizer dO(m_sm);
-    vector<DeliveryRequest> newDeliveries(deliveries);
+    GOOBER_LATENCY(planLatencyHistogram());
+    //call delivery optimizer to optimize order of deliveries for efficiency; it hands back indexes so nothing is copied
+    DeliveryOptimizer dO(m_sm, m_metric, m_overlay, m_oracle);
+    vector<int> order;
     double l = 0;
     double k = 0;
-    dO.optimizeDeliveryOrder(depot, newDeliveries, l, k);
-    GeoCoord start = depot;
-    list<StreetSegment>::iterator p; // using iterator 
-    for (int i = 0; i <= newDeliveries.size(); i++){ //for all deliveries that need to be made +1 because we need to head back to the depot at the end
-        PointToPointRouter router(m_sm);
-        list<StreetSegment> route;
+    {
+        GOOBER_PHASE(optimizeMillis);
+        dO.optimizeDeliveryOrder(depot, deliveries, order, l, k);
+    }
+    return planLegs(depot, deliveries, order, sink, totalDistanceTravelled);
+}
+
+DeliveryResult DeliveryPlannerImpl::generateDeliveryPlanInOrder(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    DeliveryCommandSink& sink,
+    double& totalDistanceTravelled) const
+{
+    vector<int> order(deliveries.size());
+    for (int i = 0; i < order.size(); i++)
+        order[i] = i;
+    return planLegs(depot, deliveries, order, sink, totalDistanceTravelled);
+}
+
+future<PlanOutcome> DeliveryPlannerImpl::generateDeliveryPlanAsync(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    PlanExecutor& executor,
+    CancellationToken token,
+    DeliveryCommandSink* sink) const
+{
+    //the tasks outlive this call, so they share one copy of everything they need
+    shared_ptr<AsyncPlan> plan = make_shared<AsyncPlan>();
+    plan->depot = depot;
+    plan->deliveries = deliveries;
+    plan->token = token;
+    plan->sink = sink;
+    future<PlanOutcome> outcome = plan->done.get_future();
+    PlanExecutor* pool = &executor;
+    executor.submit([this, plan, pool]() {
+        try {
+            CancellationScope scope(&plan->token);
+            if (!plan->token.cancelled()){ //case for a plan abandoned before it got a thread
+                DeliveryOptimizer dO(m_sm, m_metric, m_overlay, m_oracle);
+                double l = 0;
+                double k = 0;
+                dO.optimizeDeliveryOrder(plan->depot, plan->deliveries, plan->order, l, k);
+            }
+            pool->submit([this, plan]() { routeAsync(*plan); });
+        }
+        catch (...) {
+            plan->done.set_exception(current_exception());
+        }
+    });
+    return outcome;
+}
+
+void DeliveryPlannerImpl::routeAsync(AsyncPlan& plan) const
+{
+    try {
+        CancellationScope scope(&plan.token);
+        CommandVectorSink collect(plan.outcome.commands);
+        DeliveryCommandSink& sink = plan.sink != nullptr ? *plan.sink : collect;
+        if (plan.token.cancelled()){ //case for cancelled while optimizing or while waiting for a thread
+            sink.beginPlan(m_sm, plan.deliveries);
+            sink.endPlan(CANCELLED, 0);
+            plan.outcome.result = CANCELLED;
+        }
+        else plan.outcome.result = planLegs(plan.depot, plan.deliveries, plan.order, sink, plan.outcome.totalDistanceTravelled);
+        plan.done.set_value(move(plan.outcome));
+    }
+    catch (...) {
+        plan.done.set_exception(current_exception());
+    }
+}
+
+DeliveryResult DeliveryPlannerImpl::planLegs(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    const vector<int>& order,
+    DeliveryCommandSink& sink,
+    double& totalDistanceTravelled) const
+{
+    totalDistanceTravelled = 0;
+    sink.beginPlan(m_sm, deliveries);
+    if (order.empty()){ //case for nothing to deliver, so nowhere to go
+        sink.endPlan(DELIVERY_SUCCESS, 0);
+        return DELIVERY_SUCCESS;
+    }
+    PointToPointRouter router(m_sm, m_cache, m_overlay);
+    int depotNode = m_sm->nodeId(depot);
+    vector<int> route; //edge ids of the current leg, reused for every leg
+    for (int i = 0; i <= order.size(); i++){ //for all deliveries that need to be made +1 because we need to head back to the depot at the end
+        int from = (i == 0) ? depotNode : m_sm->nodeId(deliveries[order[i-1]].location);
+        int to = (i == order.size()) ? depotNode : m_sm->nodeId(deliveries[order[i]].location);
+        if (cancellationRequested()){ //checked here too, since a leg found in the cache never searches
+            sink.endPlan(CANCELLED, totalDistanceTravelled);
+            return CANCELLED;
+        }
         double dist = 0;
         DeliveryResult del;
-        if (i == 0) //case for routing from depot to first delivery
-            del = router.generatePointToPointRoute(start, newDeliveries[0].location, route, dist);
-        else if(i == newDeliveries.size()) //routing from one delivery spot to next
-            del = router.generatePointToPointRoute(newDeliveries[i-1].location, start, route, dist);
-        else del = router.generatePointToPointRoute(newDeliveries[i-1].location, newDeliveries[i].location, route, dist); //routing back to depot
-        //if del is badCoord or NoRoute then must stop
-        if (del == BAD_COORD || del == NO_ROUTE){
+        {
+            GOOBER_PHASE(routeMillis);
+            del = router.generatePointToPointPath(from, to, route, dist);
+        }
+        //if del is badCoord, NoRoute or Cancelled then must stop
+        if (del != DELIVERY_SUCCESS){
+            sink.endPlan(del, totalDistanceTravelled);
             return del;
         }
         totalDistanceTravelled += dist; //adding to total distance traveled the distance traveled for this delivery
-        p = route.begin();
-        string streetName = route.front().name;
-        double directionSegment = angleOfLine(route.front());
-        dist = 0;
-        int j;
-        for (j = 0; j < route.size(); j++){
-            if (p->name != streetName){ //case for a turn occuring
+        GOOBER_PHASE(commandMillis);
+        sink.consumeLeg(from, route);
+        legCommands(route, (i != order.size()) ? order[i] : -1, sink);
+    }
+    sink.endPlan(DELIVERY_SUCCESS, totalDistanceTravelled);
+    return DELIVERY_SUCCESS;
+}
+
+void DeliveryPlannerImpl::legCommands(const vector<int>& route, int delivery, DeliveryCommandSink& sink) const
+{
+    const StreetGraph& g = m_sm->graph();
+    CompactCommand command;
+    double dist = 0;
+    if (!route.empty()){ //an empty route means the stop is where we already are, so there is nothing to drive
+        int street = g.edgeStreet[route.front()];
+        double directionSegment = edgeAngle(g, route.front());
+        for (int j = 0; j < route.size(); j++){
+            int e = route[j];
+            if (g.edgeStreet[e] != street){ //case for a turn occuring
                 if (dist != 0){
-                    DeliveryCommand deliv;
-                    list<StreetSegment>::iterator prevp = --p;
-                    p++;
-                    double dir = angleBetween2Lines(*p, *prevp); //checking what direction to turn in
-                    deliv.initAsProceedCommand(direction(directionSegment), prevp->name, dist); //proceed command for the road right before the turn
-                    commands.push_back(deliv);
-                    directionSegment = angleOfLine(*p);
+                    int prev = route[j-1];
+                    double dir = angleBetweenEdges(g, e, prev); //checking what direction to turn in
+                    command.kind = CompactCommand::PROCEED; //proceed command for the road right before the turn
+                    command.direction = direction(directionSegment);
+                    command.street = g.edgeStreet[prev];
+                    command.delivery = -1;
+                    command.distance = dist;
+                    sink.consume(command);
+                    directionSegment = edgeAngle(g, e);
                     //determining command for the turn
+                    command.kind = CompactCommand::TURN;
+                    command.street = g.edgeStreet[e];
+                    command.distance = 0;
                     if (dir > 359 && dir < 1){ //nearly straight no turning
                     }
                     else if (dir < 180){ //turning right
-                        deliv.initAsTurnCommand("right", p->name);
-                        commands.push_back(deliv);
+                        command.direction = DIR_RIGHT;
+                        sink.consume(command);
                     }
                     else { //turning left
-                        deliv.initAsTurnCommand("left", p->name);
-                        commands.push_back(deliv);
+                        command.direction = DIR_LEFT;
+                        sink.consume(command);
                     }
-                    
                 }
                 dist = 0; //reset distance road's segment will take you
-                streetName = p->name; //street name is now different because of turn
+                street = g.edgeStreet[e]; //street is now different because of turn
             }
-            dist += distanceEarthMiles(p->start, p->end); //add distance between each geoCoord (length of segment)
-            p++;
-        }
-        DeliveryCommand delv;
-        delv.initAsProceedCommand(direction(directionSegment), (--p)->name, dist); //proceed Command for when the delivery route has completed
-        commands.push_back(delv);
-        if (i != newDeliveries.size()){ //case for when headed to a delivery point
-            delv.initAsDeliverCommand(newDeliveries[i].item); // delivery command to deliver the item
-            commands.push_back(delv);
-            continue;
+            dist += g.edgeLength[e]; //add length of each segment
         }
+        command.kind = CompactCommand::PROCEED; //proceed Command for when the delivery route has completed
+        command.direction = direction(directionSegment);
+        command.street = g.edgeStreet[route.back()];
+        command.delivery = -1;
+        command.distance = dist;
+        sink.consume(command);
     }
+    if (delivery != -1){ //case for when headed to a delivery point
+        command.kind = CompactCommand::DELIVER; // delivery command to deliver the item
+        command.direction = DIR_EAST;
+        command.street = -1;
+        command.delivery = delivery;
+        command.distance = 0;
+        sink.consume(command);
+    }
+}
+
+class IncrementalPlanImpl
+{
+public:
+    IncrementalPlanImpl(const StreetMap* sm, RouteCache* cache, const WeightOverlay* overlay, OptimizerMetric metric);
+    ~IncrementalPlanImpl();
+    DeliveryResult plan(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries);
+    DeliveryResult insertStop(const DeliveryRequest& delivery, int& position);
+    DeliveryResult removeStop(int position);
+    const vector<DeliveryRequest>& deliveries() const { return m_stops; }
+    const vector<DeliveryCommand>& commands() const { return m_commands; }
+    double totalDistanceTravelled() const { return m_total; }
+    long long legsRouted() const { return m_legsRouted; }
+private:
+    struct Leg
+    {
+        vector<int> route;  // edge ids
+        double distance;
+        int commandCount;   // this leg's commands in m_commands, its DELIVER included
+    };
+    const StreetMap* m_sm;
+    const WeightOverlay* m_overlay;
+    OptimizerMetric m_metric;
+    DeliveryPlannerImpl m_planner;  // makes each leg's commands
+    PointToPointRouter m_router;
+    int m_depotNode;                // -1 until a plan succeeds
+    vector<DeliveryRequest> m_stops;
+    vector<int> m_nodes;            // node id of each of m_stops
+    vector<Leg> m_legs;             // m_legs[i] ends at m_stops[i], the last one at the depot; none without stops
+    vector<DeliveryCommand> m_commands;
+    double m_total;
+    long long m_legsRouted;
+    int nodeAt(int stop) const{ //node of stop, where -1 and m_stops.size() are the depot
+        return (stop < 0 || stop >= m_nodes.size()) ? m_depotNode : m_nodes[stop];
+    }
+    double crow(int from, int to) const;
+    void estimateFrom(const GeoCoord& location, int node, vector<pair<int, double>>& miles) const;
+    DeliveryResult routeLeg(int from, int to, Leg& leg);
+    void spliceLegs(int first, int count, vector<Leg>& fresh);
+    bool reverseIfShorter(int first, int last, const function<double(int, int)>& estimate, int* follow);
+    bool reverseWindow(int first, int width, const function<double(int, int)>& estimate, int* follow = nullptr);
+};
+
+IncrementalPlanImpl::IncrementalPlanImpl(const StreetMap* sm, RouteCache* cache, const WeightOverlay* overlay, OptimizerMetric metric)
+ : m_sm(sm), m_overlay(overlay), m_metric(metric), m_planner(sm, cache, overlay, metric, nullptr), m_router(sm, cache, overlay),
+   m_depotNode(-1), m_total(0), m_legsRouted(0)
+{
+}
+
+IncrementalPlanImpl::~IncrementalPlanImpl()
+{
+}
+
+DeliveryResult IncrementalPlanImpl::plan(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries)
+{
+    m_depotNode = -1;
+    m_stops.clear();
+    m_nodes.clear();
+    m_legs.clear();
+    m_commands.clear();
+    m_total = 0;
+    int depotNode = m_sm->nodeId(depot);
+    if (depotNode < 0)
+        return BAD_COORD;
+    DeliveryOptimizer dO(m_sm, m_metric, m_overlay);
+    vector<int> order;
+    double l = 0;
+    double k = 0;
+    {
+        GOOBER_PHASE(optimizeMillis);
+        dO.optimizeDeliveryOrder(depot, deliveries, order, l, k);
+    }
+    vector<DeliveryRequest> stops;
+    vector<int> nodes;
+    for (int i : order){
+        stops.push_back(deliveries[i]);
+        nodes.push_back(m_sm->nodeId(deliveries[i].location));
+        if (nodes.back() < 0)
+            return BAD_COORD;
+    }
+    m_depotNode = depotNode;
+    m_stops.swap(stops);
+    m_nodes.swap(nodes);
+    vector<Leg> legs(m_stops.empty() ? 0 : m_stops.size() + 1);
+    for (int i = 0; i < legs.size(); i++){
+        DeliveryResult result = routeLeg(nodeAt(i - 1), nodeAt(i), legs[i]);
+        if (result != DELIVERY_SUCCESS){ //case for a leg that can't be driven, so there is no plan
+            m_depotNode = -1;
+            m_stops.clear();
+            m_nodes.clear();
+            return result;
+        }
+    }
+    spliceLegs(0, 0, legs);
     return DELIVERY_SUCCESS;
 }
 
+DeliveryResult IncrementalPlanImpl::insertStop(const DeliveryRequest& delivery, int& position)
+{
+    if (m_depotNode < 0)
+        return BAD_COORD;
+    int node = m_sm->nodeId(delivery.location);
+    if (node < 0)
+        return BAD_COORD;
+    int n = m_stops.size();
+    //every gap's cost is estimated from one sweep out of the new stop, in road miles like the leg
+    //it replaces, and only the cheapest gap's two legs are routed
+    vector<pair<int, double>> miles;
+    estimateFrom(delivery.location, node, miles);
+    auto estimate = [&](int from, int to) { //legs to or from the new stop from the sweep, any other by crow distance
+        if (from != node && to != node)
+            return crow(from, to);
+        int other = (from == node) ? to : from;
+        auto it = lower_bound(miles.begin(), miles.end(), make_pair(other, -numeric_limits<double>::infinity()));
+        return (it != miles.end() && it->first == other) ? it->second : crow(from, to);
+    };
+    //gap p is between stop p-1 and stop p and replaces leg p
+    vector<pair<double, int>> gaps(n + 1);
+    for (int p = 0; p <= n; p++){
+        double replaced = (n == 0) ? 0 : m_legs[p].distance;
+        gaps[p] = make_pair(estimate(nodeAt(p - 1), node) + estimate(node, nodeAt(p)) - replaced, p);
+    }
+    sort(gaps.begin(), gaps.end());
+    vector<Leg> fresh(2);
+    position = -1;
+    for (int i = 0; i < gaps.size() && i < MAX_INSERT_GAPS && position < 0; i++){
+        int p = gaps[i].second;
+        DeliveryResult result = routeLeg(nodeAt(p - 1), node, fresh[0]);
+        if (result == DELIVERY_SUCCESS)
+            result = routeLeg(node, nodeAt(p), fresh[1]);
+        if (result == NO_ROUTE) //case for a gap the stop can't be reached from or left to
+            continue;
+        if (result != DELIVERY_SUCCESS)
+            return result;
+        position = p;
+    }
+    if (position < 0)
+        return NO_ROUTE;
+    m_stops.insert(m_stops.begin() + position, delivery);
+    m_nodes.insert(m_nodes.begin() + position, node);
+    spliceLegs(position, (n == 0) ? 0 : 1, fresh);
+    //local repair: turning the new stop and its neighbours around is a move insertion alone can't make
+    reverseWindow(position - 1, 3, estimate, &position);
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult IncrementalPlanImpl::removeStop(int position)
+{
+    if (m_depotNode < 0 || position < 0 || position >= m_stops.size())
+        return BAD_COORD;
+    vector<Leg> joined((m_stops.size() == 1) ? 0 : 1); //the last stop going takes both legs with it
+    if (!joined.empty()){
+        DeliveryResult result = routeLeg(nodeAt(position - 1), nodeAt(position + 1), joined[0]);
+        if (result != DELIVERY_SUCCESS)
+            return result;
+    }
+    m_stops.erase(m_stops.begin() + position);
+    m_nodes.erase(m_nodes.begin() + position);
+    spliceLegs(position, 2, joined);
+    reverseWindow(position - 1, 2, [this](int from, int to) { return crow(from, to); }); //local repair: the stops either side of the gap may now go better the other way round
+    return DELIVERY_SUCCESS;
+}
+
+double IncrementalPlanImpl::crow(int from, int to) const
+{
+    const StreetGraph& g = m_sm->graph();
+    return distanceEarthMiles(g.coords[from], g.coords[to]);
+}
+
+  // Road miles between node (at location) and each point of the tour, as sorted
+  // (tour node, miles) pairs, from one sweep out of node. The sweep stops at the
+  // tour's longest leg, since an insert next to anything farther is unlikely to
+  // win; a point it doesn't reach gets the larger of that budget and its crow
+  // distance. Distances are taken outbound and stand in for the way back too.
+void IncrementalPlanImpl::estimateFrom(const GeoCoord& location, int node, vector<pair<int, double>>& miles) const
+{
+    double budget = m_legs.empty() ? numeric_limits<double>::infinity() : 0; //a lone depot is swept for in full
+    for (const Leg& leg : m_legs)
+        budget = max(budget, leg.distance);
+    miles.clear();
+    miles.push_back(make_pair(m_depotNode, numeric_limits<double>::infinity()));
+    for (int stop : m_nodes)
+        miles.push_back(make_pair(stop, numeric_limits<double>::infinity()));
+    sort(miles.begin(), miles.end());
+    miles.erase(unique(miles.begin(), miles.end()), miles.end());
+    ReachableSet reached;
+    m_router.generateReachable(location, budget, reached);
+    for (int k = 0; k < reached.nodes.size(); k++){
+        auto it = lower_bound(miles.begin(), miles.end(), make_pair(reached.nodes[k], -numeric_limits<double>::infinity()));
+        if (it != miles.end() && it->first == reached.nodes[k])
+            it->second = reached.distances[k];
+    }
+    for (pair<int, double>& point : miles)
+        if (point.second == numeric_limits<double>::infinity())
+            point.second = max(budget, crow(node, point.first));
+}
+
+DeliveryResult IncrementalPlanImpl::routeLeg(int from, int to, Leg& leg)
+{
+    GOOBER_PHASE(routeMillis);
+    m_legsRouted++;
+    return m_router.generatePointToPointPath(from, to, leg.route, leg.distance);
+}
+
+  // Puts fresh in place of legs first .. first+count-1, m_stops already being in
+  // the new order so fresh[j] ends at stop first+j, and swaps their commands in
+  // for the old ones. The commands of every other leg are left where they are.
+void IncrementalPlanImpl::spliceLegs(int first, int count, vector<Leg>& fresh)
+{
+    GOOBER_PHASE(commandMillis);
+    int offset = 0;
+    for (int i = 0; i < first; i++)
+        offset += m_legs[i].commandCount;
+    int stale = 0;
+    for (int i = first; i < first + count; i++)
+        stale += m_legs[i].commandCount;
+    vector<DeliveryCommand> patch;
+    CommandVectorSink sink(patch);
+    sink.beginPlan(m_sm, m_stops);
+    for (int j = 0; j < fresh.size(); j++){
+        int before = patch.size();
+        int stop = first + j;
+        m_planner.legCommands(fresh[j].route, (stop < m_stops.size()) ? stop : -1, sink);
+        fresh[j].commandCount = patch.size() - before;
+    }
+    m_commands.erase(m_commands.begin() + offset, m_commands.begin() + offset + stale);
+    m_commands.insert(m_commands.begin() + offset, make_move_iterator(patch.begin()), make_move_iterator(patch.end()));
+    m_legs.erase(m_legs.begin() + first, m_legs.begin() + first + count);
+    m_legs.insert(m_legs.begin() + first, make_move_iterator(fresh.begin()), make_move_iterator(fresh.end()));
+    m_total = 0; //summed in order, so it comes out exactly as planLegs would have it
+    for (const Leg& leg : m_legs)
+        m_total += leg.distance;
+}
+
+  // Reverses stops first .. last if that shortens the tour, re-routing the
+  // last-first+2 legs it changes, at most MAX_REPAIR_LEGS of them. Nothing is
+  // routed unless the reversed legs' estimated miles come in under the old
+  // legs. If follow is given, it goes on pointing at the same stop.
+bool IncrementalPlanImpl::reverseIfShorter(int first, int last, const function<double(int, int)>& estimate, int* follow)
+{
+    if (first < 0 || last >= m_stops.size() || first >= last || last - first + 2 > MAX_REPAIR_LEGS)
+        return false;
+    double old = 0;
+    for (int i = first; i <= last + 1; i++)
+        old += m_legs[i].distance;
+    vector<int> path; //the nodes the new legs run between
+    path.push_back(nodeAt(first - 1));
+    for (int i = last; i >= first; i--)
+        path.push_back(m_nodes[i]);
+    path.push_back(nodeAt(last + 1));
+    double estimated = 0;
+    for (int i = 0; i + 1 < path.size(); i++)
+        estimated += estimate(path[i], path[i + 1]);
+    if (estimated >= old)
+        return false;
+    vector<Leg> fresh(path.size() - 1);
+    double length = 0;
+    for (int i = 0; i < fresh.size(); i++){
+        if (routeLeg(path[i], path[i + 1], fresh[i]) != DELIVERY_SUCCESS)
+            return false;
+        length += fresh[i].distance;
+        if (length >= old) //case for already no shorter, so the rest needn't be routed
+            return false;
+    }
+    reverse(m_stops.begin() + first, m_stops.begin() + last + 1);
+    reverse(m_nodes.begin() + first, m_nodes.begin() + last + 1);
+    spliceLegs(first, fresh.size(), fresh);
+    if (follow != nullptr && *follow >= first && *follow <= last)
+        *follow = first + last - *follow;
+    return true;
+}
+
+  // reverseIfShorter on the width stops from first, slid back inside the tour
+  // where they would run off either end, so a stop next to the depot still
+  // gets its repair
+bool IncrementalPlanImpl::reverseWindow(int first, int width, const function<double(int, int)>& estimate, int* follow)
+{
+    int size = m_stops.size();
+    first = max(0, min(first, size - width));
+    return reverseIfShorter(first, min(first + width, size) - 1, estimate, follow);
+}
+
 //******************** DeliveryPlanner functions ******************************
 
 // These functions simply delegate to DeliveryPlannerImpl's functions.
 // You probably don't want to change any of this code.
 
-DeliveryPlanner::DeliveryPlanner(const StreetMap* sm)
+DeliveryPlanner::DeliveryPlanner(const StreetMap* sm, RouteCache* cache, const WeightOverlay* overlay,
+                                 OptimizerMetric metric, const DistanceOracle* oracle)
 {
-    m_impl = new DeliveryPlannerImpl(sm);
+    m_impl = new DeliveryPlannerImpl(sm, cache, overlay, metric, oracle);
 }
 
 DeliveryPlanner::~DeliveryPlanner()
@@ -148,7 +666,77 @@ DeliveryResult DeliveryPlanner::generateDeliveryPlan(
     vector<DeliveryCommand>& commands,
     double& totalDistanceTravelled) const
 {
-    return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled);
+#ifdef GOOBER_INSTRUMENT
+    QueryStats stats;
+    return generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled, stats);
+#else
+    CommandVectorSink sink(commands);
+    return m_impl->generateDeliveryPlan(depot, deliveries, sink, totalDistanceTravelled);
+#endif
+}
+
+DeliveryResult DeliveryPlanner::generateDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<DeliveryCommand>& commands,
+    double& totalDistanceTravelled,
+    QueryStats& stats) const
+{
+    stats = QueryStats();
+    QueryStatsScope scope(&stats);
+    CommandVectorSink sink(commands);
+    DeliveryResult result = m_impl->generateDeliveryPlan(depot, deliveries, sink, totalDistanceTravelled);
+#ifdef GOOBER_INSTRUMENT
+    if (scope.outermost())
+        recordQueryTotals(stats);
+#endif
+    return result;
+}
+
+DeliveryResult DeliveryPlanner::generateDeliveryPlanInOrder(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<DeliveryCommand>& commands,
+    double& totalDistanceTravelled) const
+{
+    CommandVectorSink sink(commands);
+    return m_impl->generateDeliveryPlanInOrder(depot, deliveries, sink, totalDistanceTravelled);
+}
+
+DeliveryResult DeliveryPlanner::generateDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    DeliveryCommandSink& sink,
+    double& totalDistanceTravelled) const
+{
+    return m_impl->generateDeliveryPlan(depot, deliveries, sink, totalDistanceTravelled);
+}
+
+DeliveryResult DeliveryPlanner::generateDeliveryPlanInOrder(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    DeliveryCommandSink& sink,
+    double& totalDistanceTravelled) const
+{
+    return m_impl->generateDeliveryPlanInOrder(depot, deliveries, sink, totalDistanceTravelled);
+}
+
+future<PlanOutcome> DeliveryPlanner::generateDeliveryPlanAsync(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    PlanExecutor& executor) const
+{
+    return m_impl->generateDeliveryPlanAsync(depot, deliveries, executor, CancellationToken(), nullptr);
+}
+
+future<PlanOutcome> DeliveryPlanner::generateDeliveryPlanAsync(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    PlanExecutor& executor,
+    CancellationToken token,
+    DeliveryCommandSink* sink) const
+{
+    return m_impl->generateDeliveryPlanAsync(depot, deliveries, executor, token, sink);
 }
 //int main(){
 //    StreetMap sm;
@@ -169,3 +757,53 @@ DeliveryResult DeliveryPlanner::generateDeliveryPlan(
 //        cout << commands[i].description() << endl;
 //    }
 //}
+
+//******************** IncrementalPlan functions ******************************
+
+// These functions simply delegate to IncrementalPlanImpl's functions.
+
+IncrementalPlan::IncrementalPlan(const StreetMap* sm, RouteCache* cache, const WeightOverlay* overlay,
+                                 OptimizerMetric metric)
+{
+    m_impl = new IncrementalPlanImpl(sm, cache, overlay, metric);
+}
+
+IncrementalPlan::~IncrementalPlan()
+{
+    delete m_impl;
+}
+
+DeliveryResult IncrementalPlan::plan(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries)
+{
+    return m_impl->plan(depot, deliveries);
+}
+
+DeliveryResult IncrementalPlan::insertStop(const DeliveryRequest& delivery, int& position)
+{
+    return m_impl->insertStop(delivery, position);
+}
+
+DeliveryResult IncrementalPlan::removeStop(int position)
+{
+    return m_impl->removeStop(position);
+}
+
+const vector<DeliveryRequest>& IncrementalPlan::deliveries() const
+{
+    return m_impl->deliveries();
+}
+
+const vector<DeliveryCommand>& IncrementalPlan::commands() const
+{
+    return m_impl->commands();
+}
+
+double IncrementalPlan::totalDistanceTravelled() const
+{
+    return m_impl->totalDistanceTravelled();
+}
+
+long long IncrementalPlan::legsRouted() const
+{
+    return m_impl->legsRouted();
+}
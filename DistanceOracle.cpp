@@ -0,0 +1,429 @@
+#include "provided.h"
+#include "DistanceOracle.h"
+#include "StreetGraph.h"
+#include <vector>
+#include <queue>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <chrono>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+// The index is a pruned landmark labeling. Nodes are ranked by importance and
+// every node v keeps a label: a list of (hub rank, distance from v to that hub)
+// sorted by rank. For any two nodes some hub on a shortest path between them
+// is in both labels, so their distance is the smallest d1 + d2 over the hubs
+// the two labels share. Labels are built by one Dijkstra per node in rank
+// order, each pruned wherever the labels built so far already give the right
+// distance, which keeps them short on road networks.
+//
+// Index file layout (native byte order, every section 8-byte aligned so the
+// file can be mmapped and used in place):
+//   header: "GHL2", node count, edge count (uint32 each), pad (uint32), entry count,
+//           graphFingerprint of the map it was built on (uint64 each)
+//   offsets: uint64 per node plus one; node v's label is entries offsets[v] up to offsets[v+1]
+//   distances: double per entry
+//   hubs: uint32 per entry
+
+namespace {
+
+const char INDEX_MAGIC[4] = { 'G', 'H', 'L', '2' };
+
+struct IndexHeader
+{
+    char magic[4];
+    uint32_t nodes;
+    uint32_t edges;
+    uint32_t pad;
+    uint64_t entries;
+    uint64_t fingerprint;
+};
+
+const double UNREACHABLE = numeric_limits<double>::infinity();
+
+}  // namespace
+
+class DistanceOracleImpl
+{
+public:
+    DistanceOracleImpl(const StreetMap* sm);
+    ~DistanceOracleImpl();
+    bool build();
+    bool save(string indexFile) const;
+    bool load(string indexFile);
+    bool ready() const { return m_offsets != nullptr; }
+    double nodeDistance(int fromNode, int toNode) const;
+    DeliveryResult distance(const GeoCoord& start, const GeoCoord& end, double& distance) const;
+    long labelEntries() const { return ready() ? (long)m_offsets[m_nodes] : 0; }
+    long indexBytes() const;
+    int nodeCount() const { return m_nodes; }
+    double buildSeconds() const { return m_buildSeconds; }
+private:
+    const StreetMap* m_sm;
+    //views of the index, pointing either into the vectors below (built here) or into a mapped file
+    int m_nodes;
+    const uint64_t* m_offsets;
+    const double* m_dists;
+    const uint32_t* m_hubs;
+    vector<uint64_t> m_ownOffsets;
+    vector<double> m_ownDists;
+    vector<uint32_t> m_ownHubs;
+    void* m_mapping;
+    size_t m_mappingBytes;
+    double m_buildSeconds;
+    void release();
+    vector<int> rankNodes(const StreetGraph& g) const;
+};
+
+DistanceOracleImpl::DistanceOracleImpl(const StreetMap* sm)
+ : m_sm(sm), m_nodes(0), m_offsets(nullptr), m_dists(nullptr), m_hubs(nullptr),
+   m_mapping(nullptr), m_mappingBytes(0), m_buildSeconds(0)
+{
+}
+
+DistanceOracleImpl::~DistanceOracleImpl()
+{
+    release();
+}
+
+void DistanceOracleImpl::release()
+{
+    if (m_mapping != nullptr)
+        munmap(m_mapping, m_mappingBytes);
+    m_mapping = nullptr;
+    m_mappingBytes = 0;
+    m_ownOffsets.clear();
+    m_ownDists.clear();
+    m_ownHubs.clear();
+    m_offsets = nullptr;
+    m_dists = nullptr;
+    m_hubs = nullptr;
+    m_nodes = 0;
+}
+
+  // Orders nodes most important first. Importance is how many nodes hang below
+  // each node in shortest-path trees grown from a sample of roots, which favours
+  // the through streets most shortest paths run along.
+vector<int> DistanceOracleImpl::rankNodes(const StreetGraph& g) const
+{
+    const int n = g.nodeCount();
+    const int samples = min(n, 48);
+    vector<double> importance(n, 0);
+    vector<double> dist(n);
+    vector<int> parent(n);
+    vector<int> settledOrder;
+    mt19937 rng(n); //seeded by map size so the same map always builds the same index
+    uniform_int_distribution<int> pick(0, n - 1);
+    typedef pair<double, int> QueueEntry;
+    for (int s = 0; s < samples; s++){
+        int root = pick(rng);
+        fill(dist.begin(), dist.end(), UNREACHABLE);
+        fill(parent.begin(), parent.end(), -1);
+        settledOrder.clear();
+        priority_queue<QueueEntry, vector<QueueEntry>, greater<QueueEntry>> open;
+        dist[root] = 0;
+        open.push(QueueEntry(0, root));
+        while (!open.empty()){
+            QueueEntry top = open.top();
+            open.pop();
+            int u = top.second;
+            if (top.first > dist[u])
+                continue;
+            settledOrder.push_back(u);
+            for (int e = g.firstEdge[u]; e < g.firstEdge[u + 1]; e++){
+                int v = g.edgeTarget[e];
+                double d = dist[u] + g.edgeLength[e];
+                if (d < dist[v]){
+                    dist[v] = d;
+                    parent[v] = u;
+                    open.push(QueueEntry(d, v));
+                }
+            }
+        }
+        //subtree sizes, children before parents
+        vector<double> below(n, 0);
+        for (int i = (int)settledOrder.size() - 1; i > 0; i--){
+            int u = settledOrder[i];
+            below[parent[u]] += below[u] + 1;
+        }
+        for (int u : settledOrder)
+            importance[u] += below[u];
+    }
+    vector<int> order(n);
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        if (importance[a] != importance[b])
+            return importance[a] > importance[b];
+        return (g.firstEdge[a + 1] - g.firstEdge[a]) > (g.firstEdge[b + 1] - g.firstEdge[b]);
+    });
+    return order;
+}
+
+bool DistanceOracleImpl::build()
+{
+    auto started = chrono::steady_clock::now();
+    release();
+    const StreetGraph& g = m_sm->graph();
+    const int n = g.nodeCount();
+    if (n == 0)
+        return false;
+    vector<int> order = rankNodes(g);
+
+    //labels as they grow; hubs are added in rank order so every label stays sorted
+    vector<vector<uint32_t>> hubs(n);
+    vector<vector<double>> dists(n);
+    vector<double> rootLabel(n, UNREACHABLE); //current root's label indexed by hub rank, for fast pruning
+    vector<double> dist(n, UNREACHABLE);
+    vector<int> touched;
+    typedef pair<double, int> QueueEntry;
+    for (int rank = 0; rank < n; rank++){
+        int root = order[rank];
+        for (size_t i = 0; i < hubs[root].size(); i++)
+            rootLabel[hubs[root][i]] = dists[root][i];
+        priority_queue<QueueEntry, vector<QueueEntry>, greater<QueueEntry>> open;
+        dist[root] = 0;
+        touched.push_back(root);
+        open.push(QueueEntry(0, root));
+        while (!open.empty()){
+            QueueEntry top = open.top();
+            open.pop();
+            int u = top.second;
+            double d = top.first;
+            if (d > dist[u])
+                continue;
+            //prune if hubs already in both labels give a path this short
+            bool covered = false;
+            for (size_t i = 0; i < hubs[u].size(); i++)
+                if (rootLabel[hubs[u][i]] + dists[u][i] <= d){
+                    covered = true;
+                    break;
+                }
+            if (covered)
+                continue;
+            hubs[u].push_back(rank);
+            dists[u].push_back(d);
+            for (int e = g.firstEdge[u]; e < g.firstEdge[u + 1]; e++){
+                int v = g.edgeTarget[e];
+                double nd = d + g.edgeLength[e];
+                if (nd < dist[v]){
+                    if (dist[v] == UNREACHABLE)
+                        touched.push_back(v);
+                    dist[v] = nd;
+                    open.push(QueueEntry(nd, v));
+                }
+            }
+        }
+        for (int v : touched)
+            dist[v] = UNREACHABLE;
+        touched.clear();
+        for (uint32_t h : hubs[root])
+            rootLabel[h] = UNREACHABLE;
+    }
+
+    //flatten into the same layout the index file uses
+    m_ownOffsets.assign(n + 1, 0);
+    for (int v = 0; v < n; v++)
+        m_ownOffsets[v + 1] = m_ownOffsets[v] + hubs[v].size();
+    m_ownHubs.reserve(m_ownOffsets[n]);
+    m_ownDists.reserve(m_ownOffsets[n]);
+    for (int v = 0; v < n; v++){
+        m_ownHubs.insert(m_ownHubs.end(), hubs[v].begin(), hubs[v].end());
+        m_ownDists.insert(m_ownDists.end(), dists[v].begin(), dists[v].end());
+        vector<uint32_t>().swap(hubs[v]);
+        vector<double>().swap(dists[v]);
+    }
+    m_nodes = n;
+    m_offsets = m_ownOffsets.data();
+    m_hubs = m_ownHubs.data();
+    m_dists = m_ownDists.data();
+    m_buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    return true;
+}
+
+double DistanceOracleImpl::nodeDistance(int fromNode, int toNode) const
+{
+    if (!ready() || fromNode < 0 || toNode < 0 || fromNode >= m_nodes || toNode >= m_nodes)
+        return -1;
+    if (fromNode == toNode)
+        return 0;
+    //merge the two sorted labels, keeping the best total through a shared hub
+    uint64_t i = m_offsets[fromNode], iEnd = m_offsets[fromNode + 1];
+    uint64_t j = m_offsets[toNode], jEnd = m_offsets[toNode + 1];
+    double best = UNREACHABLE;
+    while (i < iEnd && j < jEnd){
+        uint32_t a = m_hubs[i];
+        uint32_t b = m_hubs[j];
+        if (a == b){
+            double d = m_dists[i] + m_dists[j];
+            if (d < best)
+                best = d;
+            i++;
+            j++;
+        }
+        else if (a < b)
+            i++;
+        else
+            j++;
+    }
+    return best == UNREACHABLE ? -1 : best;
+}
+
+DeliveryResult DistanceOracleImpl::distance(const GeoCoord& start, const GeoCoord& end, double& distance) const
+{
+    int from = m_sm->nodeId(start);
+    int to = m_sm->nodeId(end);
+    if (from < 0 || to < 0)
+        return BAD_COORD;
+    double d = nodeDistance(from, to);
+    if (d < 0)
+        return NO_ROUTE;
+    distance = d;
+    return DELIVERY_SUCCESS;
+}
+
+long DistanceOracleImpl::indexBytes() const
+{
+    if (!ready())
+        return 0;
+    uint64_t entries = m_offsets[m_nodes];
+    return (long)(sizeof(IndexHeader) + (m_nodes + 1) * sizeof(uint64_t) + entries * (sizeof(double) + sizeof(uint32_t)));
+}
+
+bool DistanceOracleImpl::save(string indexFile) const
+{
+    if (!ready())
+        return false;
+    ofstream out(indexFile, ios::binary);
+    if (!out)
+        return false;
+    const StreetGraph& g = m_sm->graph();
+    IndexHeader header;
+    memcpy(header.magic, INDEX_MAGIC, 4);
+    header.nodes = (uint32_t)m_nodes;
+    header.edges = (uint32_t)g.edgeCount();
+    header.pad = 0;
+    header.entries = m_offsets[m_nodes];
+    header.fingerprint = g.fingerprint;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(m_offsets), (m_nodes + 1) * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(m_dists), header.entries * sizeof(double));
+    out.write(reinterpret_cast<const char*>(m_hubs), header.entries * sizeof(uint32_t));
+    return (bool)out;
+}
+
+bool DistanceOracleImpl::load(string indexFile)
+{
+    release();
+    int fd = open(indexFile.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexHeader)){
+        close(fd);
+        return false;
+    }
+    size_t bytes = (size_t)st.st_size;
+    void* mapping = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); //the mapping stays valid on its own
+    if (mapping == MAP_FAILED)
+        return false;
+    const IndexHeader* header = static_cast<const IndexHeader*>(mapping);
+    const StreetGraph& g = m_sm->graph();
+    size_t expected = sizeof(IndexHeader) + ((size_t)header->nodes + 1) * sizeof(uint64_t)
+                      + header->entries * (sizeof(double) + sizeof(uint32_t));
+    //the fingerprint tells apart maps of the same size, and the same map with its ids renumbered (a tile file)
+    if (memcmp(header->magic, INDEX_MAGIC, 4) != 0 || (int)header->nodes != g.nodeCount()
+        || (int)header->edges != g.edgeCount() || header->fingerprint != g.fingerprint
+        || bytes != expected){ //built for a different map, or truncated
+        munmap(mapping, bytes);
+        return false;
+    }
+    const char* base = static_cast<const char*>(mapping) + sizeof(IndexHeader);
+    m_mapping = mapping;
+    m_mappingBytes = bytes;
+    m_nodes = (int)header->nodes;
+    m_offsets = reinterpret_cast<const uint64_t*>(base);
+    m_dists = reinterpret_cast<const double*>(base + (m_nodes + 1) * sizeof(uint64_t));
+    m_hubs = reinterpret_cast<const uint32_t*>(base + (m_nodes + 1) * sizeof(uint64_t) + header->entries * sizeof(double));
+    //each node's label runs from its offset to the next one's, so the offsets have to climb from 0 to the entry count
+    bool offsetsFit = m_offsets[0] == 0 && m_offsets[m_nodes] == header->entries;
+    for (int v = 0; v < m_nodes && offsetsFit; v++)
+        offsetsFit = m_offsets[v] <= m_offsets[v + 1] && m_offsets[v + 1] <= header->entries;
+    if (!offsetsFit){
+        release();
+        return false;
+    }
+    return true;
+}
+
+//******************** DistanceOracle functions *******************************
+
+// These functions simply delegate to DistanceOracleImpl's functions.
+
+DistanceOracle::DistanceOracle(const StreetMap* sm)
+{
+    m_impl = new DistanceOracleImpl(sm);
+}
+
+DistanceOracle::~DistanceOracle()
+{
+    delete m_impl;
+}
+
+bool DistanceOracle::build()
+{
+    return m_impl->build();
+}
+
+bool DistanceOracle::save(string indexFile) const
+{
+    return m_impl->save(indexFile);
+}
+
+bool DistanceOracle::load(string indexFile)
+{
+    return m_impl->load(indexFile);
+}
+
+bool DistanceOracle::ready() const
+{
+    return m_impl->ready();
+}
+
+DeliveryResult DistanceOracle::distance(const GeoCoord& start, const GeoCoord& end, double& distance) const
+{
+    return m_impl->distance(start, end, distance);
+}
+
+double DistanceOracle::nodeDistance(int fromNode, int toNode) const
+{
+    return m_impl->nodeDistance(fromNode, toNode);
+}
+
+long DistanceOracle::labelEntries() const
+{
+    return m_impl->labelEntries();
+}
+
+double DistanceOracle::averageLabelSize() const
+{
+    return m_impl->nodeCount() == 0 ? 0 : (double)m_impl->labelEntries() / m_impl->nodeCount();
+}
+
+long DistanceOracle::indexBytes() const
+{
+    return m_impl->indexBytes();
+}
+
+double DistanceOracle::buildSeconds() const
+{
+    return m_impl->buildSeconds();
+}
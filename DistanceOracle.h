@@ -0,0 +1,44 @@
+// DistanceOracle.h
+//
+// Precomputed shortest-path distances for callers that need many distances
+// and no routes. PointToPointRouter::generatePointToPointDistance answers from
+// it, and so does the ROAD_METRIC optimizer when a DeliveryOptimizer or
+// DeliveryPlanner is given one.
+
+#ifndef DISTANCEORACLE_INCLUDED
+#define DISTANCEORACLE_INCLUDED
+
+#include "provided.h"
+#include <string>
+
+class DistanceOracleImpl;
+
+  // Hub-label index over the street graph that answers exact shortest-path
+  // distance queries (no route) by merging two sorted labels. Build it once per
+  // map, save it next to the map file, and load (mmap) it in every process that
+  // needs distances. It reflects plain map lengths, not a WeightOverlay.
+class DistanceOracle
+{
+public:
+    DistanceOracle(const StreetMap* sm);
+    ~DistanceOracle();
+    bool build();
+    bool save(std::string indexFile) const;
+    bool load(std::string indexFile);  // false if missing, corrupt or built for another map
+    bool ready() const;
+    DeliveryResult distance(const GeoCoord& start, const GeoCoord& end, double& distance) const;
+      // distance between two node ids, or a negative value if there is no route
+    double nodeDistance(int fromNode, int toNode) const;
+      // size and cost figures for deciding whether a city's index is worth it
+    long labelEntries() const;
+    double averageLabelSize() const;
+    long indexBytes() const;
+    double buildSeconds() const;
+      // We prevent a DistanceOracle object from being copied or assigned.
+    DistanceOracle(const DistanceOracle&) = delete;
+    DistanceOracle& operator=(const DistanceOracle&) = delete;
+private:
+    DistanceOracleImpl* m_impl;
+};
+
+#endif // DISTANCEORACLE_INCLUDED
@@ -1,5 +1,7 @@
 // ExpandableHashMap.h
 #include <list>
+#include <utility>
+#include "Instrumentation.h"
 
 template<typename KeyType, typename ValueType>
 class ExpandableHashMap
@@ -15,6 +17,18 @@ public:
     // associated with that key is replaced by the second parameter (value).
     // Thus, the hashmap must contain no duplicate keys.
     void associate(const KeyType& key, const ValueType& value);
+    // If an association exists with the given key, returns a pointer to its value
+    // and sets inserted to false. Otherwise inserts the key with a default
+    // constructed value, sets inserted to true and returns a pointer to the new
+    // value. Either way the caller can fill in or update the value in place,
+    // with a single lookup.
+    ValueType* tryEmplace(const KeyType& key, bool& inserted);
+    // Grows the bucket array, if need be, so that n associations fit without
+    // going over the maximum load factor. Inserting up to n items then never rehashes.
+    void reserve(int n);
+    // If an association exists with the given key, removes it and returns true;
+    // otherwise returns false and leaves the hashmap unchanged.
+    bool remove(const KeyType& key);
     // If no association exists with the given key, return nullptr; otherwise,
     // return a pointer to the value associated with that key. This pointer can be
     // used to examine that value, and if the hashmap is allowed to be modified, to
@@ -36,15 +50,18 @@ private:
     struct Node{
         KeyType m_key;
         ValueType m_value;
-        Node(KeyType key, ValueType value){
-            m_key = key;
-            m_value = value;
-        }
+        Node(const KeyType& key, const ValueType& value)
+         : m_key(key), m_value(value)
+        {}
+        Node(KeyType&& key, ValueType&& value)
+         : m_key(std::move(key)), m_value(std::move(value))
+        {}
     };
     int m_size;
     int m_length;
     std::list<Node>* keyMap;
     
+    void rehash(int newLength);
     unsigned int getNodeValue(const KeyType& key) const {
         unsigned int hasher(const KeyType& k); // prototype
         unsigned int hashed = hasher(key);
@@ -81,39 +98,61 @@ template <typename KeyType, typename ValueType> int ExpandableHashMap<KeyType, V
 }
 
 template <typename KeyType, typename ValueType> void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value)
+{
+    bool inserted = false;
+    *tryEmplace(key, inserted) = value;
+}
+
+template <typename KeyType, typename ValueType> ValueType* ExpandableHashMap<KeyType, ValueType>::tryEmplace(const KeyType& key, bool& inserted)
 {
     ValueType* val = find(key);
-    if (val == nullptr){
-        m_size++;
-        if ((double)m_size/m_length > loadFactor){
-            //make new map with double the size
-            m_length = m_length * 2;
-            std::list<Node>* newList = keyMap;
-            keyMap = new std::list<Node>[m_length];
-            for (int i = 0; i < m_length/2; i++){ //for every value in the old map
-                typename std::list<Node>::iterator p;
-                p = newList[i].begin();
-                while(p!= newList[i].end()){
-                    Node newEntry(p->m_key, p->m_value);
-                    keyMap[getNodeValue(p->m_key)].push_back(newEntry); //keep rehashing the values that were previously stored in the map
-                    p++;
-                }
-            }
-            //delete old keyMap
-            delete [] newList;
-        }
-        //insert key val pair to hashmap
-        int n = getNodeValue(key);
-        Node newEntry(key, value);
-        keyMap[n].push_back(newEntry);
+    if (val != nullptr){
+        inserted = false;
+        return val;
     }
-    else {
-        *val = value;
+    inserted = true;
+    m_size++;
+    if ((double)m_size/m_length > loadFactor){
+        //make new map with double the size
+        rehash(m_length * 2);
     }
+    //insert key with a default value, for the caller to fill in
+    int n = getNodeValue(key);
+    keyMap[n].emplace_back(key, ValueType());
+    return &keyMap[n].back().m_value;
+}
+
+template <typename KeyType, typename ValueType> void ExpandableHashMap<KeyType, ValueType>::reserve(int n)
+{
+    int length = m_length;
+    while ((double)n/length > loadFactor)
+        length *= 2;
+    if (length != m_length)
+        rehash(length);
+}
+
+  // Moves every node into a new array of newLength buckets. The nodes are
+  // relinked rather than copied, so pointers from find stay valid.
+template <typename KeyType, typename ValueType> void ExpandableHashMap<KeyType, ValueType>::rehash(int newLength)
+{
+    GOOBER_COUNT(rehashes);
+    std::list<Node>* oldMap = keyMap;
+    int oldLength = m_length;
+    m_length = newLength;
+    keyMap = new std::list<Node>[m_length];
+    for (int i = 0; i < oldLength; i++){ //for every value in the old map
+        while (!oldMap[i].empty()){
+            std::list<Node>& bucket = keyMap[getNodeValue(oldMap[i].front().m_key)];
+            bucket.splice(bucket.end(), oldMap[i], oldMap[i].begin()); //keep rehashing the values that were previously stored in the map
+        }
+    }
+    //delete old keyMap
+    delete [] oldMap;
 }
 
 template <typename KeyType, typename ValueType> const ValueType* ExpandableHashMap<KeyType, ValueType>::find(const KeyType& key) const
 {
+    GOOBER_COUNT(hashLookups);
     int i = getNodeValue(key); //unhash the key to get the list in the array where the value would be stored if in Hashmap
     typename std::list<Node>::iterator p;
     p = keyMap[i].begin();
@@ -125,3 +164,17 @@ template <typename KeyType, typename ValueType> const ValueType* ExpandableHashM
     }
     return nullptr;
 }
+
+template <typename KeyType, typename ValueType> bool ExpandableHashMap<KeyType, ValueType>::remove(const KeyType& key)
+{
+    int i = getNodeValue(key);
+    typename std::list<Node>::iterator p;
+    for (p = keyMap[i].begin(); p != keyMap[i].end(); p++){
+        if (p->m_key == key){ //found the association, so unlink it from its bucket
+            keyMap[i].erase(p);
+            m_size--;
+            return true;
+        }
+    }
+    return false;
+}
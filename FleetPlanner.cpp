@@ -0,0 +1,288 @@
+#include "provided.h"
+#include "FleetPlanner.h"
+#include "RouteCache.h"
+#include "WeightOverlay.h"
+#include "StreetGraph.h"
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <functional>
+using namespace std;
+
+namespace {
+
+const double PI = 4 * atan(1.0);
+
+  // Runs body(from, to) over count items cut into one contiguous range per
+  // thread, this thread taking the first.
+void parallelRanges(size_t count, unsigned int threads, const function<void(size_t, size_t)>& body)
+{
+    threads = (unsigned int)max<size_t>(1, min<size_t>(threads, count));
+    vector<thread> pool;
+    for (unsigned int t = 1; t < threads; t++)
+        pool.emplace_back(body, count * t / threads, count * (t + 1) / threads);
+    body(0, count / threads);
+    for (thread& t : pool)
+        t.join();
+}
+
+  // stable_sort of items on threads threads: each sorts its own range, then
+  // neighbouring ranges are merged pairwise, the merges of a round in parallel.
+void parallelStableSort(vector<int>& items, unsigned int threads, const function<bool(int, int)>& less)
+{
+    threads = (unsigned int)max<size_t>(1, min<size_t>(threads, items.size()));
+    vector<size_t> bounds;
+    for (unsigned int t = 0; t <= threads; t++)
+        bounds.push_back(items.size() * t / threads);
+    parallelRanges(threads, threads, [&](size_t from, size_t to) {
+        for (size_t r = from; r < to; r++)
+            stable_sort(items.begin() + bounds[r], items.begin() + bounds[r + 1], less);
+    });
+    while (bounds.size() > 2){ //each round halves the number of sorted ranges
+        size_t pairs = (bounds.size() - 1) / 2;
+        parallelRanges(pairs, threads, [&](size_t from, size_t to) {
+            for (size_t r = from; r < to; r++)
+                inplace_merge(items.begin() + bounds[2 * r], items.begin() + bounds[2 * r + 1],
+                              items.begin() + bounds[2 * r + 2], less);
+        });
+        vector<size_t> merged;
+        for (size_t i = 0; i < bounds.size(); i += 2)
+            merged.push_back(bounds[i]);
+        if (merged.back() != bounds.back()) //case for an odd range out, carried into the next round as it is
+            merged.push_back(bounds.back());
+        bounds.swap(merged);
+    }
+}
+
+}  // namespace
+
+class FleetPlannerImpl
+{
+public:
+    FleetPlannerImpl(const StreetMap* sm, RouteCache* cache, const WeightOverlay* overlay, OptimizerMetric metric);
+    ~FleetPlannerImpl();
+    DeliveryResult generateFleetPlan( //function to split deliveries across vehicles and plan every tour
+        const GeoCoord& depot,
+        const vector<Vehicle>& vehicles,
+        const vector<DeliveryRequest>& deliveries,
+        vector<VehiclePlan>& plans,
+        vector<DeliveryRequest>& unassigned,
+        double& totalDistanceTravelled,
+        unsigned int threads) const;
+private:
+    const StreetMap* m_sm;
+    RouteCache* m_cache;
+    const WeightOverlay* m_overlay;
+    OptimizerMetric m_metric;
+    vector<bool> reachableBothWays(int depotNode, unsigned int threads) const;
+    void sweepPartition(const GeoCoord& depot, const vector<Vehicle>& vehicles,
+                        const vector<DeliveryRequest>& deliveries, vector<int> stops,
+                        vector<VehiclePlan>& plans, vector<DeliveryRequest>& unassigned, unsigned int threads) const;
+};
+
+FleetPlannerImpl::FleetPlannerImpl(const StreetMap* sm, RouteCache* cache, const WeightOverlay* overlay, OptimizerMetric metric)
+{
+    m_sm = sm;
+    m_cache = cache;
+    m_overlay = overlay;
+    m_metric = metric;
+}
+
+FleetPlannerImpl::~FleetPlannerImpl()
+{
+}
+
+  // Nodes a vehicle can drive to from the depot and back again, honouring overlay
+  // closures. One sweep each way keeps a single unreachable address from failing
+  // a whole vehicle's tour; given two threads, the two sweeps run side by side.
+vector<bool> FleetPlannerImpl::reachableBothWays(int depotNode, unsigned int threads) const
+{
+    const StreetGraph& g = m_sm->graph();
+    static const EdgeWeights baseWeights;
+    shared_ptr<const EdgeWeights> overlayWeights;
+    if (m_overlay != nullptr)
+        overlayWeights = m_overlay->weights();
+    const EdgeWeights& weights = overlayWeights ? *overlayWeights : baseWeights;
+    vector<char> seenBy[2]; //char rather than bool, so the two sweeps never write to the same word
+    auto sweep = [&](int pass) { //pass 0 follows edges outward, pass 1 follows them back toward the depot
+        vector<char>& seen = seenBy[pass];
+        seen.assign(g.nodeCount(), 0);
+        vector<int> stack(1, depotNode);
+        seen[depotNode] = 1;
+        while (!stack.empty()){
+            int u = stack.back();
+            stack.pop_back();
+            for (int e = g.firstEdge[u]; e < g.firstEdge[u + 1]; e++){
+                int used = pass == 0 ? e : g.edgeReverse[e]; //the edge actually driven, u to v or v to u
+                int v = g.edgeTarget[e];
+                if (seen[v] || weights.closed(used))
+                    continue;
+                seen[v] = 1;
+                stack.push_back(v);
+            }
+        }
+    };
+    parallelRanges(2, threads, [&](size_t from, size_t to) {
+        for (size_t pass = from; pass < to; pass++)
+            sweep((int)pass);
+    });
+    vector<bool> both(g.nodeCount(), false);
+    for (int v = 0; v < g.nodeCount(); v++)
+        both[v] = seenBy[0][v] && seenBy[1][v];
+    return both;
+}
+
+  // Cluster-first step. Stops are ordered by bearing from the depot, starting just
+  // after the widest empty wedge so no cluster straddles it, and that circle is
+  // cut into consecutive arcs sized in proportion to each vehicle's capacity.
+  // If the fleet can't take every stop, the ones farthest from the depot are left out.
+  // Distances, bearings and both sorts are spread over threads threads.
+void FleetPlannerImpl::sweepPartition(const GeoCoord& depot, const vector<Vehicle>& vehicles,
+                                      const vector<DeliveryRequest>& deliveries, vector<int> stops,
+                                      vector<VehiclePlan>& plans, vector<DeliveryRequest>& unassigned,
+                                      unsigned int threads) const
+{
+    long totalCapacity = 0;
+    for (const Vehicle& v : vehicles)
+        totalCapacity += max(v.capacity, 0);
+    if ((long)stops.size() > totalCapacity){
+        vector<double> crow(deliveries.size());
+        parallelRanges(stops.size(), threads, [&](size_t from, size_t to) {
+            for (size_t i = from; i < to; i++)
+                crow[stops[i]] = distanceEarthMiles(depot, deliveries[stops[i]].location);
+        });
+        parallelStableSort(stops, threads, [&](int a, int b) { return crow[a] < crow[b]; });
+        for (size_t i = totalCapacity; i < stops.size(); i++)
+            unassigned.push_back(deliveries[stops[i]]);
+        stops.resize(totalCapacity);
+    }
+    if (stops.empty())
+        return;
+
+    //bearing of each stop, with longitude scaled so a degree east counts the same as a degree north
+    const double lonScale = cos(deg2rad(depot.latitude));
+    vector<double> bearing(deliveries.size());
+    parallelRanges(stops.size(), threads, [&](size_t from, size_t to) {
+        for (size_t i = from; i < to; i++){
+            const GeoCoord& at = deliveries[stops[i]].location;
+            bearing[stops[i]] = atan2(at.latitude - depot.latitude, (at.longitude - depot.longitude) * lonScale);
+        }
+    });
+    parallelStableSort(stops, threads, [&](int a, int b) { return bearing[a] < bearing[b]; });
+    size_t startAt = 0;
+    double widestGap = -1;
+    for (size_t i = 0; i < stops.size(); i++){
+        double gap = (i == 0) ? bearing[stops[0]] + 2 * PI - bearing[stops.back()]
+                              : bearing[stops[i]] - bearing[stops[i - 1]];
+        if (gap > widestGap){
+            widestGap = gap;
+            startAt = i;
+        }
+    }
+    rotate(stops.begin(), stops.begin() + startAt, stops.end());
+
+    //vehicle i takes stops [n*C(i)/T, n*C(i+1)/T) where C is capacity so far; that never exceeds its capacity
+    const long n = (long)stops.size();
+    long capacitySoFar = 0;
+    for (size_t v = 0; v < vehicles.size(); v++){
+        long from = n * capacitySoFar / totalCapacity;
+        capacitySoFar += max(vehicles[v].capacity, 0);
+        long to = n * capacitySoFar / totalCapacity;
+        for (long i = from; i < to; i++)
+            plans[v].deliveries.push_back(deliveries[stops[i]]);
+    }
+}
+
+DeliveryResult FleetPlannerImpl::generateFleetPlan(
+    const GeoCoord& depot,
+    const vector<Vehicle>& vehicles,
+    const vector<DeliveryRequest>& deliveries,
+    vector<VehiclePlan>& plans,
+    vector<DeliveryRequest>& unassigned,
+    double& totalDistanceTravelled,
+    unsigned int threads) const
+{
+    plans.assign(vehicles.size(), VehiclePlan());
+    unassigned.clear();
+    totalDistanceTravelled = 0;
+    int depotNode = m_sm->nodeId(depot);
+    if (depotNode < 0)
+        return BAD_COORD;
+    if (threads == 0)
+        threads = max(1u, thread::hardware_concurrency());
+    vector<bool> reachable = reachableBothWays(depotNode, threads);
+    vector<int> nodes(deliveries.size()); //looked up in parallel, as every stop's is a hash map lookup
+    parallelRanges(deliveries.size(), threads, [&](size_t from, size_t to) {
+        for (size_t i = from; i < to; i++)
+            nodes[i] = m_sm->nodeId(deliveries[i].location);
+    });
+    vector<int> stops; //indexes of deliveries that can be routed to and back from
+    for (int i = 0; i < (int)deliveries.size(); i++){
+        if (nodes[i] < 0 || !reachable[nodes[i]])
+            unassigned.push_back(deliveries[i]);
+        else
+            stops.push_back(i);
+    }
+    sweepPartition(depot, vehicles, deliveries, stops, plans, unassigned, threads);
+
+    //route-second step: every vehicle's tour is independent, so plan them on a pool of threads
+    unsigned int planThreads = (unsigned int)min<size_t>(threads, max<size_t>(plans.size(), 1));
+    DeliveryOptimizer optimizer(m_sm, m_metric, m_overlay);
+    DeliveryPlanner planner(m_sm, m_cache, m_overlay);
+    atomic<size_t> nextPlan(0);
+    auto worker = [&]() {
+        for (size_t v = nextPlan++; v < plans.size(); v = nextPlan++){
+            VehiclePlan& plan = plans[v];
+            if (plan.deliveries.empty())
+                continue;
+            double oldCrow = 0;
+            double newCrow = 0;
+            optimizer.optimizeDeliveryOrder(depot, plan.deliveries, oldCrow, newCrow);
+            plan.result = planner.generateDeliveryPlanInOrder(depot, plan.deliveries, plan.commands, plan.totalDistanceTravelled);
+        }
+    };
+    vector<thread> pool;
+    for (unsigned int t = 1; t < planThreads; t++)
+        pool.emplace_back(worker);
+    worker(); //this thread takes a share too
+    for (thread& t : pool)
+        t.join();
+
+    DeliveryResult result = DELIVERY_SUCCESS;
+    for (const VehiclePlan& plan : plans){
+        if (plan.result != DELIVERY_SUCCESS)
+            result = NO_ROUTE;
+        else
+            totalDistanceTravelled += plan.totalDistanceTravelled;
+    }
+    return result;
+}
+
+//******************** FleetPlanner functions *********************************
+
+// These functions simply delegate to FleetPlannerImpl's functions.
+
+FleetPlanner::FleetPlanner(const StreetMap* sm, RouteCache* cache, const WeightOverlay* overlay, OptimizerMetric metric)
+{
+    m_impl = new FleetPlannerImpl(sm, cache, overlay, metric);
+}
+
+FleetPlanner::~FleetPlanner()
+{
+    delete m_impl;
+}
+
+DeliveryResult FleetPlanner::generateFleetPlan(
+    const GeoCoord& depot,
+    const vector<Vehicle>& vehicles,
+    const vector<DeliveryRequest>& deliveries,
+    vector<VehiclePlan>& plans,
+    vector<DeliveryRequest>& unassigned,
+    double& totalDistanceTravelled,
+    unsigned int threads) const
+{
+    return m_impl->generateFleetPlan(depot, vehicles, deliveries, plans, unassigned, totalDistanceTravelled, threads);
+}
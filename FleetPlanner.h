@@ -0,0 +1,65 @@
+// FleetPlanner.h
+//
+// Delivery plans for several vehicles sharing one depot.
+
+#ifndef FLEETPLANNER_INCLUDED
+#define FLEETPLANNER_INCLUDED
+
+#include "provided.h"
+#include <string>
+#include <vector>
+
+struct Vehicle
+{
+    Vehicle(std::string nm, int cap)
+     : name(nm), capacity(cap)
+    {}
+    std::string name;
+    int capacity;  // most deliveries this vehicle can take on one tour
+};
+
+  // one vehicle's share of a fleet plan
+struct VehiclePlan
+{
+    DeliveryResult result = DELIVERY_SUCCESS;
+    std::vector<DeliveryRequest> deliveries;  // in the order they will be made
+    std::vector<DeliveryCommand> commands;
+    double totalDistanceTravelled = 0;
+};
+
+class FleetPlannerImpl;
+
+  // Plans a large batch of deliveries across several vehicles from one depot:
+  // stops are first split into one spatial cluster per vehicle (a sweep around
+  // the depot, respecting capacities, its lookups and sorts spread over the
+  // threads), then each cluster's order is optimized under metric and the
+  // overlay and planned as its own tour by a DeliveryPlanner, with clusters
+  // planned in parallel.
+class FleetPlanner
+{
+public:
+    FleetPlanner(const StreetMap* sm, RouteCache* cache = nullptr, const WeightOverlay* overlay = nullptr,
+                 OptimizerMetric metric = CROW_METRIC);
+    ~FleetPlanner();
+      // plans gets one entry per vehicle, in the order given. Deliveries at unknown
+      // coordinates, ones that can't be reached from the depot and back, and ones
+      // beyond the fleet's total capacity go to unassigned. Returns
+      // BAD_COORD if the depot is unknown, NO_ROUTE if any vehicle's tour failed
+      // (see its VehiclePlan::result), otherwise DELIVERY_SUCCESS. threads == 0
+      // means one per hardware thread.
+    DeliveryResult generateFleetPlan(
+        const GeoCoord& depot,
+        const std::vector<Vehicle>& vehicles,
+        const std::vector<DeliveryRequest>& deliveries,
+        std::vector<VehiclePlan>& plans,
+        std::vector<DeliveryRequest>& unassigned,
+        double& totalDistanceTravelled,
+        unsigned int threads = 0) const;
+      // We prevent a FleetPlanner object from being copied or assigned.
+    FleetPlanner(const FleetPlanner&) = delete;
+    FleetPlanner& operator=(const FleetPlanner&) = delete;
+private:
+    FleetPlannerImpl* m_impl;
+};
+
+#endif // FLEETPLANNER_INCLUDED
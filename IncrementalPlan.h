@@ -0,0 +1,52 @@
+// IncrementalPlan.h
+//
+// Delivery plans that are edited after they were made rather than planned
+// again from scratch.
+
+#ifndef INCREMENTALPLAN_INCLUDED
+#define INCREMENTALPLAN_INCLUDED
+
+#include "provided.h"
+#include <vector>
+
+class IncrementalPlanImpl;
+
+  // A plan kept between changes, for stops added or called off after it was made.
+  // plan() optimizes and routes the whole tour like DeliveryPlanner; after that
+  // each edit re-routes only the legs it touches and patches commands() in place:
+  //   insertStop  estimates what each gap would add from one bounded sweep out
+  //               of the new stop and routes only the cheapest gap's two legs
+  //               (the next, up to three gaps, if one has no route), then
+  //               reverses the new stop and its two neighbours if that shortens
+  //               the tour
+  //   removeStop  joins the two legs around the stop into one, then tries
+  //               swapping the two stops either side of the gap
+  // An edit that fails (BAD_COORD, NO_ROUTE, or a position that isn't a stop)
+  // leaves the plan as it was. commands() and totalDistanceTravelled() are always
+  // what generateDeliveryPlanInOrder would give for deliveries().
+class IncrementalPlan
+{
+public:
+    IncrementalPlan(const StreetMap* sm, RouteCache* cache = nullptr, const WeightOverlay* overlay = nullptr,
+                    OptimizerMetric metric = CROW_METRIC);
+    ~IncrementalPlan();
+      // replaces whatever was planned before; on failure the plan is left empty
+      // and the edits return BAD_COORD until a plan succeeds
+    DeliveryResult plan(const GeoCoord& depot, const std::vector<DeliveryRequest>& deliveries);
+      // position is set to where the stop went in deliveries()
+    DeliveryResult insertStop(const DeliveryRequest& delivery, int& position);
+      // position is an index into deliveries()
+    DeliveryResult removeStop(int position);
+    const std::vector<DeliveryRequest>& deliveries() const;  // in the order they will be made
+    const std::vector<DeliveryCommand>& commands() const;
+    double totalDistanceTravelled() const;
+      // legs routed since construction, by plan() and the edits alike
+    long long legsRouted() const;
+      // We prevent an IncrementalPlan object from being copied or assigned.
+    IncrementalPlan(const IncrementalPlan&) = delete;
+    IncrementalPlan& operator=(const IncrementalPlan&) = delete;
+private:
+    IncrementalPlanImpl* m_impl;
+};
+
+#endif // INCREMENTALPLAN_INCLUDED
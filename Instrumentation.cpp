@@ -0,0 +1,100 @@
+#include "Instrumentation.h"
+#include <sstream>
+using namespace std;
+
+namespace {
+
+LatencyHistogram routeLatency;
+LatencyHistogram optimizeLatency;
+LatencyHistogram planLatency;
+
+  // running totals of every QueryStats counter, in QueryStats field order
+struct CounterTotals
+{
+    atomic<long> nodesSettled{0};
+    atomic<long> heapPushes{0};
+    atomic<long> heapPops{0};
+    atomic<long> hashLookups{0};
+    atomic<long> rehashes{0};
+    atomic<long> optimizerIterations{0};
+    atomic<long> optimizerAcceptances{0};
+    atomic<long> roadDistanceSearches{0};
+    atomic<long> roadBoundRejections{0};
+    atomic<long> tileLoads{0};
+    atomic<long> tileEvictions{0};
+    atomic<long> arcFlagPrunes{0};
+    atomic<long> queries{0};
+};
+CounterTotals totals;
+
+void writeHistogram(ostringstream& out, const char* name, const LatencyHistogram& h)
+{
+    unsigned long long cumulative = 0;
+    for (int b = 0; b < LatencyHistogram::BUCKETS; b++){
+        cumulative += h.count(b);
+        out << name << "_bucket{le=\"";
+        if (b == LatencyHistogram::BUCKETS - 1)
+            out << "+Inf";
+        else
+            out << LatencyHistogram::upperBoundMicros(b);
+        out << "\"} " << cumulative << "\n";
+    }
+    out << name << "_sum " << h.totalMicros() << "\n";
+    out << name << "_count " << cumulative << "\n";
+}
+
+}  // namespace
+
+LatencyHistogram& routeLatencyHistogram()
+{
+    return routeLatency;
+}
+
+LatencyHistogram& optimizeLatencyHistogram()
+{
+    return optimizeLatency;
+}
+
+LatencyHistogram& planLatencyHistogram()
+{
+    return planLatency;
+}
+
+void recordQueryTotals(const QueryStats& stats)
+{
+    totals.nodesSettled.fetch_add(stats.nodesSettled, memory_order_relaxed);
+    totals.heapPushes.fetch_add(stats.heapPushes, memory_order_relaxed);
+    totals.heapPops.fetch_add(stats.heapPops, memory_order_relaxed);
+    totals.hashLookups.fetch_add(stats.hashLookups, memory_order_relaxed);
+    totals.rehashes.fetch_add(stats.rehashes, memory_order_relaxed);
+    totals.optimizerIterations.fetch_add(stats.optimizerIterations, memory_order_relaxed);
+    totals.optimizerAcceptances.fetch_add(stats.optimizerAcceptances, memory_order_relaxed);
+    totals.roadDistanceSearches.fetch_add(stats.roadDistanceSearches, memory_order_relaxed);
+    totals.roadBoundRejections.fetch_add(stats.roadBoundRejections, memory_order_relaxed);
+    totals.tileLoads.fetch_add(stats.tileLoads, memory_order_relaxed);
+    totals.tileEvictions.fetch_add(stats.tileEvictions, memory_order_relaxed);
+    totals.arcFlagPrunes.fetch_add(stats.arcFlagPrunes, memory_order_relaxed);
+    totals.queries.fetch_add(1, memory_order_relaxed);
+}
+
+string scrapeInstrumentation()
+{
+    ostringstream out;
+    out << "goober_queries_total " << totals.queries.load(memory_order_relaxed) << "\n";
+    out << "goober_nodes_settled_total " << totals.nodesSettled.load(memory_order_relaxed) << "\n";
+    out << "goober_heap_pushes_total " << totals.heapPushes.load(memory_order_relaxed) << "\n";
+    out << "goober_heap_pops_total " << totals.heapPops.load(memory_order_relaxed) << "\n";
+    out << "goober_hash_lookups_total " << totals.hashLookups.load(memory_order_relaxed) << "\n";
+    out << "goober_rehashes_total " << totals.rehashes.load(memory_order_relaxed) << "\n";
+    out << "goober_optimizer_iterations_total " << totals.optimizerIterations.load(memory_order_relaxed) << "\n";
+    out << "goober_optimizer_acceptances_total " << totals.optimizerAcceptances.load(memory_order_relaxed) << "\n";
+    out << "goober_road_distance_searches_total " << totals.roadDistanceSearches.load(memory_order_relaxed) << "\n";
+    out << "goober_road_bound_rejections_total " << totals.roadBoundRejections.load(memory_order_relaxed) << "\n";
+    out << "goober_tile_loads_total " << totals.tileLoads.load(memory_order_relaxed) << "\n";
+    out << "goober_tile_evictions_total " << totals.tileEvictions.load(memory_order_relaxed) << "\n";
+    out << "goober_arc_flag_prunes_total " << totals.arcFlagPrunes.load(memory_order_relaxed) << "\n";
+    writeHistogram(out, "goober_route_latency_us", routeLatency);
+    writeHistogram(out, "goober_optimize_latency_us", optimizeLatency);
+    writeHistogram(out, "goober_plan_latency_us", planLatency);
+    return out.str();
+}
@@ -0,0 +1,161 @@
+// Instrumentation.h
+//
+// Opt-in counters and latency histograms for the routing and planning hot paths.
+// Build with -DGOOBER_INSTRUMENT to turn them on. Without it every hook below
+// expands to nothing, so the hot loops compile exactly as if it weren't here;
+// QueryStats still exists so callers can use the same API either way (the
+// numbers just stay zero).
+
+#ifndef INSTRUMENTATION_INCLUDED
+#define INSTRUMENTATION_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+  // per-query counters, filled in by whichever query the caller passed it to
+struct QueryStats
+{
+    long nodesSettled = 0;          // A* nodes expanded for the first time
+    long heapPushes = 0;
+    long heapPops = 0;
+    long hashLookups = 0;           // ExpandableHashMap::find calls
+    long rehashes = 0;              // ExpandableHashMap bucket-array doublings
+    long optimizerIterations = 0;
+    long optimizerAcceptances = 0;
+    long roadDistanceSearches = 0;  // on-demand searches by the ROAD_METRIC optimizer
+    long roadBoundRejections = 0;   // ROAD_METRIC moves turned down on crow distance alone
+    long tileLoads = 0;             // tiles of a tiled map paged in for a query
+    long tileEvictions = 0;         // tiles paged out to stay within the map's memory budget
+    long arcFlagPrunes = 0;         // edges A* skipped because they lead nowhere near the goal
+    double optimizeMillis = 0;      // DeliveryPlanner phases
+    double routeMillis = 0;
+    double commandMillis = 0;
+
+    void add(const QueryStats& other)
+    {
+        nodesSettled += other.nodesSettled;
+        heapPushes += other.heapPushes;
+        heapPops += other.heapPops;
+        hashLookups += other.hashLookups;
+        rehashes += other.rehashes;
+        optimizerIterations += other.optimizerIterations;
+        optimizerAcceptances += other.optimizerAcceptances;
+        roadDistanceSearches += other.roadDistanceSearches;
+        roadBoundRejections += other.roadBoundRejections;
+        tileLoads += other.tileLoads;
+        tileEvictions += other.tileEvictions;
+        arcFlagPrunes += other.arcFlagPrunes;
+        optimizeMillis += other.optimizeMillis;
+        routeMillis += other.routeMillis;
+        commandMillis += other.commandMillis;
+    }
+};
+
+  // Fixed log2-bucketed histogram of microsecond latencies. Recording is a couple
+  // of relaxed atomic adds, so any number of threads can record while a host
+  // process scrapes it.
+class LatencyHistogram
+{
+public:
+    static const int BUCKETS = 28;  // bucket i counts samples below 2^i us; the last one is open-ended
+
+    void record(double micros)
+    {
+        int b = 0;
+        unsigned long long v = micros < 1 ? 0 : (unsigned long long)micros;
+        while (v != 0 && b < BUCKETS - 1){
+            v >>= 1;
+            b++;
+        }
+        m_counts[b].fetch_add(1, std::memory_order_relaxed);
+        m_totalMicros.fetch_add((unsigned long long)micros, std::memory_order_relaxed);
+    }
+    unsigned long long count(int bucket) const { return m_counts[bucket].load(std::memory_order_relaxed); }
+    unsigned long long totalMicros() const { return m_totalMicros.load(std::memory_order_relaxed); }
+    static double upperBoundMicros(int bucket) { return (double)(1ULL << bucket); }
+private:
+    std::atomic<unsigned long long> m_counts[BUCKETS] = {};
+    std::atomic<unsigned long long> m_totalMicros{0};
+};
+
+  // process-wide aggregates fed by every instrumented query
+LatencyHistogram& routeLatencyHistogram();
+LatencyHistogram& optimizeLatencyHistogram();
+LatencyHistogram& planLatencyHistogram();
+void recordQueryTotals(const QueryStats& stats);
+  // Prometheus-style text dump of the histograms and counter totals
+std::string scrapeInstrumentation();
+
+  // the QueryStats the current thread is collecting into, if any
+inline thread_local QueryStats* activeQueryStats = nullptr;
+
+  // Makes stats the collection target for the current thread until the end of
+  // the scope. A nested scope's counts are folded into the enclosing one when it
+  // ends, so a planner's stats include the routes it asked for.
+class QueryStatsScope
+{
+public:
+    QueryStatsScope(QueryStats* stats)
+     : m_stats(stats), m_parent(activeQueryStats)
+    {
+        if (m_stats != nullptr)
+            activeQueryStats = m_stats;
+    }
+    ~QueryStatsScope()
+    {
+        if (m_stats == nullptr)
+            return;
+        activeQueryStats = m_parent;
+        if (m_parent != nullptr && m_parent != m_stats)
+            m_parent->add(*m_stats);
+    }
+      // true when no other query on this thread is collecting around this one
+    bool outermost() const { return m_parent == nullptr; }
+    QueryStatsScope(const QueryStatsScope&) = delete;
+    QueryStatsScope& operator=(const QueryStatsScope&) = delete;
+private:
+    QueryStats* m_stats;
+    QueryStats* m_parent;
+};
+
+  // adds the scope's wall time to a QueryStats field and/or a histogram
+class PhaseTimer
+{
+public:
+    PhaseTimer(double QueryStats::* field, LatencyHistogram* histogram = nullptr)
+     : m_field(field), m_histogram(histogram), m_started(std::chrono::steady_clock::now())
+    {}
+    ~PhaseTimer()
+    {
+        double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_started).count();
+        if (m_field != nullptr && activeQueryStats != nullptr)
+            activeQueryStats->*m_field += micros / 1000;
+        if (m_histogram != nullptr)
+            m_histogram->record(micros);
+    }
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+private:
+    double QueryStats::* m_field;
+    LatencyHistogram* m_histogram;
+    std::chrono::steady_clock::time_point m_started;
+};
+
+#define GOOBER_CONCAT_(a, b) a##b
+#define GOOBER_CONCAT(a, b) GOOBER_CONCAT_(a, b)
+
+#ifdef GOOBER_INSTRUMENT
+  #define GOOBER_COUNT(field) \
+      do { if (QueryStats* goober_s_ = activeQueryStats) goober_s_->field++; } while (0)
+  #define GOOBER_PHASE(field) \
+      PhaseTimer GOOBER_CONCAT(goober_phase_, __LINE__)(&QueryStats::field)
+  #define GOOBER_LATENCY(histogram) \
+      PhaseTimer GOOBER_CONCAT(goober_latency_, __LINE__)(nullptr, &(histogram))
+#else
+  #define GOOBER_COUNT(field) ((void)0)
+  #define GOOBER_PHASE(field) ((void)0)
+  #define GOOBER_LATENCY(histogram) ((void)0)
+#endif
+
+#endif // INSTRUMENTATION_INCLUDED
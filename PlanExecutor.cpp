@@ -0,0 +1,96 @@
+#include "provided.h"
+#include "PlanExecutor.h"
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+using namespace std;
+
+class PlanExecutorImpl
+{
+public:
+    PlanExecutorImpl(unsigned int threads);
+    ~PlanExecutorImpl();
+    void submit(function<void()> task);
+    unsigned int threads() const { return (unsigned int)m_workers.size(); }
+private:
+    mutex m_lock;
+    condition_variable m_wake;
+    deque<function<void()>> m_queue;
+    bool m_stopping;
+    vector<thread> m_workers;
+    void work();
+};
+
+PlanExecutorImpl::PlanExecutorImpl(unsigned int threads)
+ : m_stopping(false)
+{
+    if (threads == 0)
+        threads = max(1u, thread::hardware_concurrency());
+    for (unsigned int t = 0; t < threads; t++)
+        m_workers.emplace_back([this]() { work(); });
+}
+
+PlanExecutorImpl::~PlanExecutorImpl()
+{
+    {
+        lock_guard<mutex> lk(m_lock);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (thread& t : m_workers)
+        t.join();
+}
+
+void PlanExecutorImpl::submit(function<void()> task)
+{
+    {
+        lock_guard<mutex> lk(m_lock);
+        m_queue.push_back(move(task));
+    }
+    m_wake.notify_one();
+}
+
+  // Each worker takes tasks oldest first until the pool is stopping and nothing
+  // is left, so a task queued by another task during shutdown still runs.
+void PlanExecutorImpl::work()
+{
+    for (;;){
+        function<void()> task;
+        {
+            unique_lock<mutex> lk(m_lock);
+            m_wake.wait(lk, [this]() { return m_stopping || !m_queue.empty(); });
+            if (m_queue.empty()) //case for stopping with nothing left to do
+                return;
+            task = move(m_queue.front());
+            m_queue.pop_front();
+        }
+        task();
+    }
+}
+
+//******************** PlanExecutor functions *********************************
+
+// These functions simply delegate to PlanExecutorImpl's functions.
+
+PlanExecutor::PlanExecutor(unsigned int threads)
+{
+    m_impl = new PlanExecutorImpl(threads);
+}
+
+PlanExecutor::~PlanExecutor()
+{
+    delete m_impl;
+}
+
+void PlanExecutor::submit(function<void()> task)
+{
+    m_impl->submit(move(task));
+}
+
+unsigned int PlanExecutor::threads() const
+{
+    return m_impl->threads();
+}
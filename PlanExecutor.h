@@ -0,0 +1,39 @@
+// PlanExecutor.h
+//
+// The thread pool DeliveryPlanner::generateDeliveryPlanAsync runs on, and
+// what a plan run there hands back.
+
+#ifndef PLANEXECUTOR_INCLUDED
+#define PLANEXECUTOR_INCLUDED
+
+#include "provided.h"
+#include <functional>
+#include <vector>
+
+class PlanExecutorImpl;
+
+  // Fixed pool of threads that asynchronous plans run their phases on. Tasks are
+  // started in the order submitted; the destructor lets every queued task finish.
+class PlanExecutor
+{
+public:
+    PlanExecutor(unsigned int threads = 0);  // 0 means one per core
+    ~PlanExecutor();
+    void submit(std::function<void()> task);
+    unsigned int threads() const;
+      // We prevent a PlanExecutor object from being copied or assigned.
+    PlanExecutor(const PlanExecutor&) = delete;
+    PlanExecutor& operator=(const PlanExecutor&) = delete;
+private:
+    PlanExecutorImpl* m_impl;
+};
+
+  // what an asynchronous plan hands back through its future
+struct PlanOutcome
+{
+    DeliveryResult result = DELIVERY_SUCCESS;
+    std::vector<DeliveryCommand> commands;  // empty when the commands went to a sink
+    double totalDistanceTravelled = 0;      // of the legs finished, if the plan stopped early
+};
+
+#endif // PLANEXECUTOR_INCLUDED
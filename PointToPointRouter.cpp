@@ -1,58 +1,94 @@
 #include "provided.h"
-#include "ExpandableHashMap.h"
+#include "StreetGraph.h"
+#include "Instrumentation.h"
+#include "Cancellation.h"
+#include "WeightOverlay.h"
+#include "RouteCache.h"
+#include "DistanceOracle.h"
+#include "RouteGeometry.h"
 #include <list>
 #include <queue>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <limits>
 using namespace std;
 
 class PointToPointRouterImpl
 {
 public:
-    PointToPointRouterImpl(const StreetMap* sm);
+    PointToPointRouterImpl(const StreetMap* sm, RouteCache* cache, const WeightOverlay* overlay, const DistanceOracle* oracle);
     ~PointToPointRouterImpl();
     DeliveryResult generatePointToPointRoute( //function to generate segment to segment route to reach destination
         const GeoCoord& start,
         const GeoCoord& end,
         list<StreetSegment>& route,
         double& totalDistanceTravelled) const;
+    DeliveryResult generatePointToPointGeometry( //same route, encoded straight from its edge ids
+        const GeoCoord& start,
+        const GeoCoord& end,
+        RouteGeometry& geometry,
+        double& totalDistanceTravelled) const;
+    DeliveryResult generatePointToPointDistance( //distance only, from the oracle when it can answer
+        const GeoCoord& start,
+        const GeoCoord& end,
+        double& totalDistanceTravelled) const;
+    DeliveryResult generateReachable( //everything within maxDistance of start
+        const GeoCoord& start,
+        double maxDistance,
+        ReachableSet& reachable) const;
+    DeliveryResult generatePointToPointPath( //route between two node ids, giving the route as edge ids
+        int fromNode,
+        int toNode,
+        vector<int>& pathEdges,
+        double& totalDistanceTravelled) const;
+    DeliveryResult routeNodes( //same search between two node ids, giving the route as edge ids
+        int from,
+        int to,
+        vector<int>& pathEdges,
+        double& totalDistanceTravelled) const;
 private:
     const StreetMap* m_sm;
-    struct GeoInfo{ //struct that stores info about geocoord, used for priority Queue
-        double distFromEnd;
-        double distFromStart;
-        GeoCoord correspondingCoord;
-        GeoCoord pastCoord;
-        string Street;
-        GeoInfo(GeoCoord gc){
-            correspondingCoord = gc;
-            distFromEnd = 0;
-            distFromStart = 0;
+    RouteCache* m_cache;
+    const WeightOverlay* m_overlay;
+    const DistanceOracle* m_oracle;
+    struct SearchSpace{ //per-node search state kept in flat arrays indexed by node id
+        vector<double> distFromStart;
+        vector<int> pastEdge;      //edge the best known path arrives by
+        vector<unsigned> reached;  //== stamp once the node has a distance in this search
+        vector<unsigned> settled;  //== stamp once the node has been expanded in this search
+        unsigned stamp = 0;
+        void begin(int nodeCount){ //start a new search without clearing every array
+            if ((int)reached.size() != nodeCount || ++stamp == 0){
+                distFromStart.assign(nodeCount, 0);
+                pastEdge.assign(nodeCount, -1);
+                reached.assign(nodeCount, 0);
+                settled.assign(nodeCount, 0);
+                stamp = 1;
+            }
         }
-        GeoInfo(){}
-        ~GeoInfo(){}
     };
-    struct onOpen{ //struct that stores info about geocoord, used for priority inOpen Hashmap
-        bool hasBeenPushed;
+    struct OpenEntry{ //struct that stores a node waiting on the open queue
         double fVal;
-        GeoCoord pastCoord;
-        string streetName;
-        onOpen(GeoInfo g){
-            hasBeenPushed = false;
-            fVal = g.distFromEnd+g.distFromStart;
-            pastCoord = g.pastCoord;
-            streetName = g.Street;
-        }
-        onOpen(){};
+        int node;
     };
-    struct geoComp{  //comparison technique used by priority Queue
-      bool operator()(const GeoInfo& lhs, const GeoInfo& rhs) const{
-        return (lhs.distFromEnd+lhs.distFromStart) > (rhs.distFromEnd+rhs.distFromStart);
+    struct openComp{  //comparison technique used by priority Queue
+      bool operator()(const OpenEntry& lhs, const OpenEntry& rhs) const{
+        return lhs.fVal > rhs.fVal;
       }
     };
+    bool search(int from, int to, const EdgeWeights& weights, vector<int>& pathEdges, double& totalDistanceTravelled) const;
+    void sweep(int from, double maxDistance, const EdgeWeights& weights, ReachableSet& reachable) const;
 };
 
-PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm)
+PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm, RouteCache* cache, const WeightOverlay* overlay, const DistanceOracle* oracle)
 {
     m_sm = sm;
+    m_cache = cache;
+    m_overlay = overlay;
+    m_oracle = oracle;
 }
 
 PointToPointRouterImpl::~PointToPointRouterImpl()
@@ -65,79 +101,287 @@ DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
         list<StreetSegment>& route,
         double& totalDistanceTravelled) const
 {
-    vector<StreetSegment> segs;
-    if (m_sm->getSegmentsThatStartWith(start, segs)==false || m_sm->getSegmentsThatStartWith(end, segs)==false)
+    GOOBER_LATENCY(routeLatencyHistogram());
+    int from = m_sm->nodeId(start);
+    int to = m_sm->nodeId(end);
+    if (from < 0 || to < 0)
         return BAD_COORD; //case for coordinates not being present in streetMap
     route.clear(); //clearing route in case it had some segments in it earlier
-    if (start == end){ //case for starting at endpoint
+    vector<int> pathEdges;
+    DeliveryResult result = routeNodes(from, to, pathEdges, totalDistanceTravelled);
+    if (result != DELIVERY_SUCCESS)
+        return result;
+    const StreetGraph& g = m_sm->graph();
+    for (int e : pathEdges)
+        route.push_back(g.segment(e));
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult PointToPointRouterImpl::generatePointToPointGeometry(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        RouteGeometry& geometry,
+        double& totalDistanceTravelled) const
+{
+    GOOBER_LATENCY(routeLatencyHistogram());
+    int from = m_sm->nodeId(start);
+    int to = m_sm->nodeId(end);
+    if (from < 0 || to < 0)
+        return BAD_COORD;
+    geometry.clear();
+    vector<int> pathEdges;
+    DeliveryResult result = routeNodes(from, to, pathEdges, totalDistanceTravelled);
+    if (result == DELIVERY_SUCCESS)
+        geometry.addPath(m_sm, from, pathEdges);
+    return result;
+}
+
+DeliveryResult PointToPointRouterImpl::generatePointToPointDistance(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        double& totalDistanceTravelled) const
+{
+    int from = m_sm->nodeId(start);
+    int to = m_sm->nodeId(end);
+    if (from < 0 || to < 0)
+        return BAD_COORD;
+    //the oracle only knows plain map lengths, so any overlay change sends the query to search
+    bool overlayActive = m_overlay != nullptr && m_overlay->version() != 0;
+    if (m_oracle != nullptr && m_oracle->ready() && !overlayActive){
+        double dist = m_oracle->nodeDistance(from, to);
+        if (dist < 0)
+            return NO_ROUTE;
+        totalDistanceTravelled = dist;
+        return DELIVERY_SUCCESS;
+    }
+    vector<int> pathEdges;
+    return routeNodes(from, to, pathEdges, totalDistanceTravelled);
+}
+
+DeliveryResult PointToPointRouterImpl::generateReachable(
+        const GeoCoord& start,
+        double maxDistance,
+        ReachableSet& reachable) const
+{
+    reachable.nodes.clear();
+    reachable.distances.clear();
+    reachable.edges.clear();
+    int from = m_sm->nodeId(start);
+    if (from < 0)
+        return BAD_COORD;
+    if (!(maxDistance >= 0)) //case for a budget that doesn't even cover standing still
+        return DELIVERY_SUCCESS;
+    static const EdgeWeights baseWeights;
+    shared_ptr<const EdgeWeights> overlayWeights;
+    if (m_overlay != nullptr)
+        overlayWeights = m_overlay->weights();
+    const EdgeWeights& weights = overlayWeights ? *overlayWeights : baseWeights;
+    if (maxDistance == numeric_limits<double>::infinity()){ //case for no limit: the whole component
+        //no route is longer than every open edge end to end, and the sweep needs a finite budget to size its buckets
+        const StreetGraph& g = m_sm->graph();
+        maxDistance = 0;
+        for (int e = 0; e < g.edgeCount(); e++)
+            if (!weights.closed(e))
+                maxDistance += weights.weight(g, e);
+    }
+    sweep(from, maxDistance, weights, reachable);
+    return DELIVERY_SUCCESS;
+}
+
+  // Dial's algorithm: nodes are queued in buckets by distance, each bucket
+  // bucketWidth miles wide, instead of in a heap. A bucket is worked until it is
+  // empty; relaxing an edge shorter than the width can land back in the same
+  // bucket, so a node may be worked more than once there. Nothing that happens
+  // later can reach a node in a bucket that has emptied, so once a bucket
+  // empties its nodes are final and get reported.
+void PointToPointRouterImpl::sweep(int from, double maxDistance, const EdgeWeights& weights, ReachableSet& reachable) const
+{
+    const StreetGraph& g = m_sm->graph();
+    thread_local SearchSpace space;
+    thread_local vector<vector<int>> buckets;
+    thread_local vector<int> finished;
+    space.begin(g.nodeCount());
+    const unsigned stamp = space.stamp;
+    //a few hundredths of a mile is about one city block; coarser for long budgets so the array stays small
+    const double bucketWidth = max(0.02, maxDistance / 4096);
+    int tile = -1; //tile of the last node settled, on a tiled map
+    const size_t bucketCount = (size_t)(maxDistance / bucketWidth) + 1;
+    if (buckets.size() < bucketCount)
+        buckets.resize(bucketCount);
+    space.distFromStart[from] = 0;
+    space.reached[from] = stamp;
+    buckets[0].push_back(from);
+    for (size_t b = 0; b < bucketCount; b++){
+        finished.clear();
+        while (!buckets[b].empty()){
+            int q = buckets[b].back();
+            buckets[b].pop_back();
+            double qDist = space.distFromStart[q];
+            if ((size_t)(qDist / bucketWidth) != b) //stale entry, the node moved to a nearer bucket
+                continue;
+            GOOBER_COUNT(heapPops);
+            if (space.settled[q] != stamp){ //first time this node is worked in this bucket
+                space.settled[q] = stamp;
+                finished.push_back(q);
+                GOOBER_COUNT(nodesSettled);
+                if (g.tiled() && !g.inTile(q, tile)) //case for the frontier crossing into another tile
+                    m_sm->touchTile(tile = g.tileOf(q));
+            }
+            for (int e = g.firstEdge[q]; e < g.firstEdge[q + 1]; e++){ //for each segment leaving the current node
+                if (weights.closed(e))
+                    continue;
+                int next = g.edgeTarget[e];
+                double nextDist = qDist + weights.weight(g, e);
+                if (nextDist > maxDistance || (space.reached[next] == stamp && space.distFromStart[next] <= nextDist))
+                    continue; //over budget, or already reached by a path at least as short
+                space.reached[next] = stamp;
+                space.distFromStart[next] = nextDist;
+                size_t nb = min((size_t)(nextDist / bucketWidth), bucketCount - 1);
+                buckets[nb].push_back(next);
+                GOOBER_COUNT(heapPushes);
+            }
+        }
+        for (int q : finished){ //bucket b is empty, so these distances are final
+            double qDist = space.distFromStart[q];
+            reachable.nodes.push_back(q);
+            reachable.distances.push_back(qDist);
+            for (int e = g.firstEdge[q]; e < g.firstEdge[q + 1]; e++)
+                if (!weights.closed(e) && qDist + weights.weight(g, e) <= maxDistance)
+                    reachable.edges.push_back(e);
+        }
+    }
+}
+
+DeliveryResult PointToPointRouterImpl::generatePointToPointPath(
+        int fromNode,
+        int toNode,
+        vector<int>& pathEdges,
+        double& totalDistanceTravelled) const
+{
+    GOOBER_LATENCY(routeLatencyHistogram());
+    int nodes = m_sm->graph().nodeCount();
+    if (fromNode < 0 || fromNode >= nodes || toNode < 0 || toNode >= nodes)
+        return BAD_COORD; //case for ids that aren't nodes of the loaded map
+    return routeNodes(fromNode, toNode, pathEdges, totalDistanceTravelled);
+}
+
+DeliveryResult PointToPointRouterImpl::routeNodes(
+        int from,
+        int to,
+        vector<int>& pathEdges,
+        double& totalDistanceTravelled) const
+{
+    pathEdges.clear();
+    if (from == to){ //case for starting at endpoint
         totalDistanceTravelled = 0;
         return DELIVERY_SUCCESS;
     }
-    priority_queue<GeoInfo, vector<GeoInfo>, geoComp> openQueue;  //priority queue will order in terms of lowest f value (total distance traveled to reach end)
-    ExpandableHashMap<GeoCoord, onOpen> inOpen; //Hashmap to store if a Geocoord has been pushed from open queue
-    ExpandableHashMap<GeoCoord, GeoInfo> closed; //closed list stores all past GeoCoords
-    //initializing all start info
-    GeoInfo startInfo(start);
-    startInfo.distFromEnd = distanceEarthMiles(start, end);
-    startInfo.distFromStart = 0;
-    startInfo.pastCoord = start;
-    startInfo.Street = segs.back().name;
-    openQueue.push(startInfo); //push first coord onto open
-    onOpen strt(startInfo);
-    inOpen.associate(start, strt);  //adding first geocoord to inOpen
-    //add to inopen
-    while (!openQueue.empty()){ //until the priority que has no Coords in it
-        GeoInfo q = openQueue.top(); //take geoCoord with lowest f value
+    //one snapshot of the overlay serves the whole query, even if it is updated meanwhile
+    static const EdgeWeights baseWeights;
+    shared_ptr<const EdgeWeights> overlayWeights;
+    if (m_overlay != nullptr)
+        overlayWeights = m_overlay->weights();
+    const EdgeWeights& weights = overlayWeights ? *overlayWeights : baseWeights;
+    double dist = 0;
+    if (m_cache != nullptr && m_cache->find(from, to, pathEdges, dist, weights.version)){ //repeat leg, no search needed
+        if (dist < 0)
+            return NO_ROUTE;
+        totalDistanceTravelled = dist;
+        return DELIVERY_SUCCESS;
+    }
+    bool found = search(from, to, weights, pathEdges, dist);
+    if (!found && cancellationRequested()) //case for the search being stopped, which proves nothing about the route
+        return CANCELLED;
+    if (m_cache != nullptr)
+        m_cache->associate(from, to, pathEdges, found ? dist : -1, weights.version);
+    if (!found)
+        return NO_ROUTE;  //no route was found
+    totalDistanceTravelled = dist;
+    return DELIVERY_SUCCESS;
+}
+
+  // A* from node from to node to using crow distance to the goal as the heuristic.
+  // The search stops when the goal is taken off the open queue, at which point its
+  // distance can no longer improve. Edges are weighted by the overlay snapshot
+  // (closed ones skipped); since every factor is at least 1 the crow distance
+  // still never overestimates. The distance reported is the route's real length.
+bool PointToPointRouterImpl::search(int from, int to, const EdgeWeights& weights, vector<int>& pathEdges, double& totalDistanceTravelled) const
+{
+    const StreetGraph& g = m_sm->graph();
+    thread_local SearchSpace space;
+    space.begin(g.nodeCount());
+    const unsigned stamp = space.stamp;
+    const NodeCoord& goal = g.coords[to];
+    priority_queue<OpenEntry, vector<OpenEntry>, openComp> openQueue;  //priority queue will order in terms of lowest f value
+    int tile = -1; //tile of the last node settled, on a tiled map
+    //the map's arc flags, or the overlay's copy redone for its weights; none
+    //while the goal's region is still being redone for them
+    const uint64_t* arcFlags = weights.arcFlags(g);
+    uint64_t targetFlag = arcFlags != nullptr ? 1ULL << g.nodeRegion[to] : 0;
+    if (weights.staleRegions & targetFlag)
+        targetFlag = 0;
+    unsigned untilCancelCheck = CANCEL_CHECK_INTERVAL;
+    space.distFromStart[from] = 0;
+    space.pastEdge[from] = -1;
+    space.reached[from] = stamp;
+    openQueue.push(OpenEntry{distanceEarthMiles(g.coords[from], goal), from}); //push first node onto open
+    GOOBER_COUNT(heapPushes);
+    while (!openQueue.empty()){ //until the priority que has no nodes in it
+        int q = openQueue.top().node; //take node with lowest f value
         openQueue.pop();
-        inOpen.find(q.correspondingCoord)->hasBeenPushed = true;
-        vector<StreetSegment> segs; //vector to store all segments from current geocoord
-        m_sm->getSegmentsThatStartWith(q.correspondingCoord, segs);
-        for (int i = 0; i < segs.size(); i++){ //for each segment
-            GeoCoord current = segs[i].end; //all possible geocoords we can visit from the current one
-            //setting GeoInfo of the newest coord
-            GeoInfo curInfo(current);
-            curInfo.Street = segs[i].name;
-            curInfo.pastCoord = segs[i].start;
-            curInfo.distFromStart = q.distFromStart + distanceEarthMiles(current, q.correspondingCoord);
-            if (current == end){ //case for reaching end
-                //stop search because we have successfully traversed
-                totalDistanceTravelled = curInfo.distFromStart;
-                //include route maker by backtracking through previous coords and forming street segments
-                GeoCoord* n1 = &current;
-                GeoCoord* n2 = &curInfo.pastCoord;
-                string strName = curInfo.Street;
-                while (*n1 != *n2){
-                    StreetSegment s1(*n2, *n1, strName);
-                    route.push_front(s1); //push to front because we are going backwards
-                    *n1 = *n2;
-                    *n2 = inOpen.find(*n1)->pastCoord;
-                    strName = inOpen.find(*n1)->streetName;
-                }
-                return DELIVERY_SUCCESS;
+        GOOBER_COUNT(heapPops);
+        if (space.settled[q] == stamp)
+            continue; //stale entry, this node was already expanded with a lower f value
+        space.settled[q] = stamp;
+        GOOBER_COUNT(nodesSettled);
+        if (--untilCancelCheck == 0){
+            if (cancellationRequested())
+                return false;
+            untilCancelCheck = CANCEL_CHECK_INTERVAL;
+        }
+        if (g.tiled() && !g.inTile(q, tile)) //case for the frontier crossing into another tile
+            m_sm->touchTile(tile = g.tileOf(q));
+        if (q == to){ //case for reaching end
+            totalDistanceTravelled = 0;
+            //form the route by backtracking through the edges each node was reached by
+            for (int e = space.pastEdge[to]; e != -1; e = space.pastEdge[g.edgeSource[e]]){
+                pathEdges.push_back(e);
+                totalDistanceTravelled += g.edgeLength[e];
             }
-            curInfo.distFromEnd = distanceEarthMiles(current, end);
-            onOpen curO(curInfo);
-            if (inOpen.find(current) != nullptr){ //case for the Coords being in inOpen
-                if (inOpen.find(current)->fVal < curO.fVal) //case for fVal of coord being > than the same coord when searched earlier
-                    continue; //skip to next coord since this has been searched with a lower f val before
+            reverse(pathEdges.begin(), pathEdges.end());
+            return true;
+        }
+        double qDist = space.distFromStart[q];
+        for (int e = g.firstEdge[q]; e < g.firstEdge[q + 1]; e++){ //for each segment leaving the current node
+            if (targetFlag != 0 && (arcFlags[e] & targetFlag) == 0){
+                GOOBER_COUNT(arcFlagPrunes);
+                continue; //case for an edge that starts no shortest path into the goal's region
             }
-            openQueue.push(curInfo);
-            inOpen.associate(current, curO);
+            int next = g.edgeTarget[e];
+            if (space.settled[next] == stamp || weights.closed(e))
+                continue;
+            double nextDist = qDist + weights.weight(g, e);
+            if (space.reached[next] == stamp && space.distFromStart[next] <= nextDist)
+                continue; //skip since this node has been reached by a shorter path before
+            space.reached[next] = stamp;
+            space.distFromStart[next] = nextDist;
+            space.pastEdge[next] = e;
+            openQueue.push(OpenEntry{nextDist + distanceEarthMiles(g.coords[next], goal), next});
+            GOOBER_COUNT(heapPushes);
         }
-        closed.associate(q.correspondingCoord, q);
     }
-    return NO_ROUTE;  //no route was found
+    return false;
 }
 
-
 //******************** PointToPointRouter functions ***************************
 
 // These functions simply delegate to PointToPointRouterImpl's functions.
 // You probably don't want to change any of this code.
 
-PointToPointRouter::PointToPointRouter(const StreetMap* sm)
+PointToPointRouter::PointToPointRouter(const StreetMap* sm, RouteCache* cache, const WeightOverlay* overlay,
+                                       const DistanceOracle* oracle)
 {
-    m_impl = new PointToPointRouterImpl(sm);
+    m_impl = new PointToPointRouterImpl(sm, cache, overlay, oracle);
 }
 
 PointToPointRouter::~PointToPointRouter()
@@ -151,5 +395,87 @@ DeliveryResult PointToPointRouter::generatePointToPointRoute(
         list<StreetSegment>& route,
         double& totalDistanceTravelled) const
 {
+#ifdef GOOBER_INSTRUMENT
+    QueryStats stats;
+    return generatePointToPointRoute(start, end, route, totalDistanceTravelled, stats);
+#else
     return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
+#endif
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled,
+        QueryStats& stats) const
+{
+    stats = QueryStats();
+    QueryStatsScope scope(&stats);
+    DeliveryResult result = m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
+#ifdef GOOBER_INSTRUMENT
+    if (scope.outermost())
+        recordQueryTotals(stats);
+#endif
+    return result;
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointDistance(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        double& totalDistanceTravelled) const
+{
+    return m_impl->generatePointToPointDistance(start, end, totalDistanceTravelled);
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointPath(
+        int fromNode,
+        int toNode,
+        vector<int>& pathEdges,
+        double& totalDistanceTravelled) const
+{
+    return m_impl->generatePointToPointPath(fromNode, toNode, pathEdges, totalDistanceTravelled);
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointGeometry(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        RouteGeometry& geometry,
+        double& totalDistanceTravelled) const
+{
+    return m_impl->generatePointToPointGeometry(start, end, geometry, totalDistanceTravelled);
+}
+
+DeliveryResult PointToPointRouter::generateReachable(
+        const GeoCoord& start,
+        double maxDistance,
+        ReachableSet& reachable) const
+{
+    return m_impl->generateReachable(start, maxDistance, reachable);
+}
+
+void PointToPointRouter::generateReachable(
+        const vector<GeoCoord>& starts,
+        double maxDistance,
+        vector<ReachableSet>& reachable,
+        vector<DeliveryResult>& results,
+        unsigned int threads) const
+{
+    reachable.assign(starts.size(), ReachableSet());
+    results.assign(starts.size(), DELIVERY_SUCCESS);
+    if (threads == 0)
+        threads = max(1u, thread::hardware_concurrency());
+    threads = (unsigned int)min<size_t>(threads, max<size_t>(starts.size(), 1));
+    //every sweep has its own search state (thread_local), so they can run side by side
+    atomic<size_t> nextStart(0);
+    auto worker = [&]() {
+        for (size_t i = nextStart++; i < starts.size(); i = nextStart++)
+            results[i] = m_impl->generateReachable(starts[i], maxDistance, reachable[i]);
+    };
+    vector<thread> pool;
+    for (unsigned int t = 1; t < threads; t++)
+        pool.emplace_back(worker);
+    worker(); //this thread takes a share too
+    for (thread& t : pool)
+        t.join();
 }
@@ -0,0 +1,325 @@
+#include "provided.h"
+#include "RouteCache.h"
+#include "ExpandableHashMap.h"
+#include "StreetGraph.h"
+#include <list>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+struct RouteKey //(start node, end node) pair the cache is keyed on
+{
+    int from;
+    int to;
+};
+
+inline bool operator==(const RouteKey& lhs, const RouteKey& rhs)
+{
+    return lhs.from == rhs.from && lhs.to == rhs.to;
+}
+
+unsigned int hasher(const RouteKey& k)
+{
+    //mix the two ids so (a,b) and (b,a) land in different buckets
+    unsigned long long h = (unsigned long long)(unsigned int)k.from * 0x9E3779B97F4A7C15ULL;
+    h ^= (unsigned long long)(unsigned int)k.to + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+class RouteCacheImpl
+{
+public:
+    RouteCacheImpl(const StreetMap* sm, int maxEntries);
+    ~RouteCacheImpl();
+    bool find(int fromNode, int toNode, vector<int>& pathEdges, double& distance, unsigned long weightsVersion);
+    void associate(int fromNode, int toNode, const vector<int>& pathEdges, double distance, unsigned long weightsVersion);
+    void clear();
+    int size() const;
+    long hits() const { return m_hits.load(memory_order_relaxed); }
+    long misses() const { return m_misses.load(memory_order_relaxed); }
+    long evictions() const { return m_evictions.load(memory_order_relaxed); }
+    bool save(string cacheFile) const;
+    bool load(string cacheFile);
+private:
+    struct Entry{ //one cached route
+        RouteKey key;
+        unsigned long weightsVersion; //WeightOverlay version the route was found under
+        double distance;
+        vector<int> edges;
+    };
+    //the cache is split into independently locked shards so concurrent planners rarely wait on each other
+    static const int SHARDS = 16;
+    struct Shard{
+        mutable mutex lock;
+        list<Entry> recency; //most recently used at the front
+        ExpandableHashMap<RouteKey, list<Entry>::iterator> index;
+    };
+    const StreetMap* m_sm;
+    int m_maxPerShard;
+    Shard m_shards[SHARDS];
+    atomic<long> m_hits;
+    atomic<long> m_misses;
+    atomic<long> m_evictions;
+    Shard& shardFor(const RouteKey& key) const
+    {
+        return const_cast<Shard&>(m_shards[(hasher(key) >> 8) % SHARDS]);
+    }
+    bool validEntry(int fromNode, int toNode, const vector<int>& edges, double distance) const;
+};
+
+RouteCacheImpl::RouteCacheImpl(const StreetMap* sm, int maxEntries)
+ : m_sm(sm), m_hits(0), m_misses(0), m_evictions(0)
+{
+    m_maxPerShard = (maxEntries + SHARDS - 1) / SHARDS;
+    if (m_maxPerShard < 1)
+        m_maxPerShard = 1;
+}
+
+RouteCacheImpl::~RouteCacheImpl()
+{
+}
+
+bool RouteCacheImpl::find(int fromNode, int toNode, vector<int>& pathEdges, double& distance, unsigned long weightsVersion)
+{
+    RouteKey key{fromNode, toNode};
+    Shard& shard = shardFor(key);
+    lock_guard<mutex> lk(shard.lock);
+    list<Entry>::iterator* it = shard.index.find(key);
+    if (it == nullptr || (*it)->weightsVersion != weightsVersion){ //a route found under other weights may no longer be shortest
+        m_misses.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    shard.recency.splice(shard.recency.begin(), shard.recency, *it); //mark as most recently used
+    pathEdges = (*it)->edges;
+    distance = (*it)->distance;
+    m_hits.fetch_add(1, memory_order_relaxed);
+    return true;
+}
+
+void RouteCacheImpl::associate(int fromNode, int toNode, const vector<int>& pathEdges, double distance, unsigned long weightsVersion)
+{
+    RouteKey key{fromNode, toNode};
+    Shard& shard = shardFor(key);
+    lock_guard<mutex> lk(shard.lock);
+    list<Entry>::iterator* it = shard.index.find(key);
+    if (it != nullptr){ //case for another thread having routed the same pair first
+        (*it)->edges = pathEdges;
+        (*it)->distance = distance;
+        (*it)->weightsVersion = weightsVersion;
+        shard.recency.splice(shard.recency.begin(), shard.recency, *it);
+        return;
+    }
+    Entry entry;
+    entry.key = key;
+    entry.weightsVersion = weightsVersion;
+    entry.distance = distance;
+    entry.edges = pathEdges;
+    entry.edges.shrink_to_fit();
+    shard.recency.push_front(entry);
+    shard.index.associate(key, shard.recency.begin());
+    while ((int)shard.recency.size() > m_maxPerShard){ //evict least recently used
+        shard.index.remove(shard.recency.back().key);
+        shard.recency.pop_back();
+        m_evictions.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void RouteCacheImpl::clear()
+{
+    for (Shard& shard : m_shards){
+        lock_guard<mutex> lk(shard.lock);
+        shard.recency.clear();
+        shard.index.reset();
+    }
+}
+
+int RouteCacheImpl::size() const
+{
+    int total = 0;
+    for (const Shard& shard : m_shards){
+        lock_guard<mutex> lk(shard.lock);
+        total += (int)shard.recency.size();
+    }
+    return total;
+}
+
+  // true if a saved entry could have come from routing the loaded map: a walk
+  // from fromNode to toNode of the length recorded, the empty walk from a node
+  // to itself, or a pair known to have no route
+bool RouteCacheImpl::validEntry(int fromNode, int toNode, const vector<int>& edges, double distance) const
+{
+    const StreetGraph& g = m_sm->graph();
+    if (fromNode < 0 || fromNode >= g.nodeCount() || toNode < 0 || toNode >= g.nodeCount())
+        return false;
+    if (edges.empty()) //case for no route, or no distance to go
+        return distance < 0 || (fromNode == toNode && distance == 0);
+    int at = fromNode;
+    double length = 0;
+    for (int e : edges){
+        if (e < 0 || e >= g.edgeCount() || g.edgeSource[e] != at)
+            return false;
+        at = g.edgeTarget[e];
+        length += g.edgeLength[e];
+    }
+    return at == toNode && fabs(length - distance) <= 1e-9 * max(1.0, length);
+}
+
+// Cache file layout (native byte order):
+//   "GRC2", node count, edge count, entry count      (uint32 each)
+//   graphFingerprint of the map the routes were found on (uint64)
+//   per entry: from, to (int32), distance (double), edge count (uint32), edge ids (int32 each)
+// Entries are written least recently used first so a load restores the same recency order.
+// Only routes found on plain map lengths are written; overlay versions mean nothing to another process.
+
+namespace {
+
+const char CACHE_MAGIC[4] = { 'G', 'R', 'C', '2' };
+
+template <typename T> void writeRaw(ofstream& out, const T& v)
+{
+    out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template <typename T> bool readRaw(ifstream& in, T& v)
+{
+    return (bool)in.read(reinterpret_cast<char*>(&v), sizeof(v));
+}
+
+}  // namespace
+
+bool RouteCacheImpl::save(string cacheFile) const
+{
+    ofstream out(cacheFile, ios::binary);
+    if (!out)
+        return false;
+    const StreetGraph& g = m_sm->graph();
+    out.write(CACHE_MAGIC, 4);
+    writeRaw(out, (uint32_t)g.nodeCount());
+    writeRaw(out, (uint32_t)g.edgeCount());
+    streampos countPos = out.tellp();
+    writeRaw(out, (uint32_t)0);
+    writeRaw(out, g.fingerprint);
+    uint32_t written = 0;
+    for (const Shard& shard : m_shards){
+        lock_guard<mutex> lk(shard.lock);
+        for (auto p = shard.recency.rbegin(); p != shard.recency.rend(); p++){
+            if (p->weightsVersion != 0)
+                continue;
+            writeRaw(out, (int32_t)p->key.from);
+            writeRaw(out, (int32_t)p->key.to);
+            writeRaw(out, p->distance);
+            writeRaw(out, (uint32_t)p->edges.size());
+            for (int e : p->edges)
+                writeRaw(out, (int32_t)e);
+            written++;
+        }
+    }
+    out.seekp(countPos);
+    writeRaw(out, written);
+    return (bool)out;
+}
+
+bool RouteCacheImpl::load(string cacheFile)
+{
+    ifstream in(cacheFile, ios::binary);
+    if (!in)
+        return false;
+    char magic[4];
+    uint32_t nodes = 0, edges = 0, entries = 0;
+    uint64_t fingerprint = 0;
+    if (!in.read(magic, 4) || memcmp(magic, CACHE_MAGIC, 4) != 0)
+        return false;
+    if (!readRaw(in, nodes) || !readRaw(in, edges) || !readRaw(in, entries) || !readRaw(in, fingerprint))
+        return false;
+    const StreetGraph& g = m_sm->graph();
+    //ids only mean something for the map they came from, numbered the same way (not, say, its tile file)
+    if ((int)nodes != g.nodeCount() || (int)edges != g.edgeCount() || fingerprint != g.fingerprint)
+        return false;
+    vector<int> path;
+    for (uint32_t i = 0; i < entries; i++){
+        int32_t from = 0, to = 0;
+        double distance = 0;
+        uint32_t length = 0;
+        if (!readRaw(in, from) || !readRaw(in, to) || !readRaw(in, distance) || !readRaw(in, length))
+            break;
+        if (length > edges)
+            break;
+        path.resize(length);
+        for (uint32_t j = 0; j < length; j++){
+            int32_t e = 0;
+            if (!readRaw(in, e))
+                return true;
+            path[j] = e;
+        }
+        if (validEntry(from, to, path, distance)) //skip anything that doesn't walk the loaded map
+            associate(from, to, path, distance, 0);
+    }
+    return true;
+}
+
+//******************** RouteCache functions ***********************************
+
+// These functions simply delegate to RouteCacheImpl's functions.
+
+RouteCache::RouteCache(const StreetMap* sm, int maxEntries)
+{
+    m_impl = new RouteCacheImpl(sm, maxEntries);
+}
+
+RouteCache::~RouteCache()
+{
+    delete m_impl;
+}
+
+bool RouteCache::find(int fromNode, int toNode, vector<int>& pathEdges, double& distance,
+                      unsigned long weightsVersion) const
+{
+    return m_impl->find(fromNode, toNode, pathEdges, distance, weightsVersion);
+}
+
+void RouteCache::associate(int fromNode, int toNode, const vector<int>& pathEdges, double distance,
+                           unsigned long weightsVersion)
+{
+    m_impl->associate(fromNode, toNode, pathEdges, distance, weightsVersion);
+}
+
+void RouteCache::clear()
+{
+    m_impl->clear();
+}
+
+int RouteCache::size() const
+{
+    return m_impl->size();
+}
+
+long RouteCache::hits() const
+{
+    return m_impl->hits();
+}
+
+long RouteCache::misses() const
+{
+    return m_impl->misses();
+}
+
+long RouteCache::evictions() const
+{
+    return m_impl->evictions();
+}
+
+bool RouteCache::save(string cacheFile) const
+{
+    return m_impl->save(cacheFile);
+}
+
+bool RouteCache::load(string cacheFile)
+{
+    return m_impl->load(cacheFile);
+}
@@ -0,0 +1,48 @@
+// RouteCache.h
+//
+// Routes kept between queries, shared by the routers and planners of one map.
+// Routes are stored as edge ids of StreetMap::graph(), so a cache file only
+// loads back into the map it was written for.
+
+#ifndef ROUTECACHE_INCLUDED
+#define ROUTECACHE_INCLUDED
+
+#include "provided.h"
+#include <string>
+#include <vector>
+
+class RouteCacheImpl;
+
+  // Bounded, thread-safe least-recently-used cache of point-to-point routes,
+  // keyed on (start node, end node) and storing each route as its edge ids.
+  // One cache can be shared by any number of routers and planners on the same map.
+class RouteCache
+{
+public:
+    RouteCache(const StreetMap* sm, int maxEntries = 100000);
+    ~RouteCache();
+      // If the route from fromNode to toNode is cached, copy it out and return true.
+      // A negative distance means the pair is known to have no route. Entries
+      // only match lookups made under the same WeightOverlay version.
+    bool find(int fromNode, int toNode, std::vector<int>& pathEdges, double& distance,
+              unsigned long weightsVersion = 0) const;
+    void associate(int fromNode, int toNode, const std::vector<int>& pathEdges, double distance,
+                   unsigned long weightsVersion = 0);
+    void clear();
+    int size() const;
+    long hits() const;
+    long misses() const;
+    long evictions() const;
+      // Persist the cached routes, or warm up from a file written by save. Entries
+      // that don't fit the loaded map are skipped; load returns false only if
+      // the file can't be read or was written for a different map.
+    bool save(std::string cacheFile) const;
+    bool load(std::string cacheFile);
+      // We prevent a RouteCache object from being copied or assigned.
+    RouteCache(const RouteCache&) = delete;
+    RouteCache& operator=(const RouteCache&) = delete;
+private:
+    RouteCacheImpl* m_impl;
+};
+
+#endif // ROUTECACHE_INCLUDED
@@ -0,0 +1,108 @@
+#include "provided.h"
+#include "RouteGeometry.h"
+#include "StreetGraph.h"
+#include <string>
+#include <vector>
+#include <cmath>
+using namespace std;
+
+// VARINT layout: one record per point, each field a LEB128 varint holding a
+// zigzag-encoded difference from the previous point (from 0 for the first):
+//   node id, latitude * 1e7, longitude * 1e7
+// The map file gives coordinates to seven decimal places, so this is lossless.
+// There is no header or count; the record stream ends with the string.
+//
+// POLYLINE is the usual format: latitude and longitude * 1e5, rounded, each
+// delta zigzag-encoded and written in 5-bit groups, low first, as chr(63 + group)
+// with 0x20 set on every group but the last.
+
+namespace {
+
+unsigned long long zigzag(long long v)
+{
+    return ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63);
+}
+
+void appendVarint(string& out, unsigned long long v)
+{
+    while (v >= 0x80){
+        out += (char)(v | 0x80);
+        v >>= 7;
+    }
+    out += (char)v;
+}
+
+void appendPolylineValue(string& out, long long delta)
+{
+    unsigned long long v = zigzag(delta);
+    while (v >= 0x20){
+        out += (char)((0x20 | (v & 0x1f)) + 63);
+        v >>= 5;
+    }
+    out += (char)(v + 63);
+}
+
+}  // namespace
+
+RouteGeometry::RouteGeometry(Format format)
+ : m_format(format), m_sm(nullptr)
+{
+    clear();
+}
+
+RouteGeometry::~RouteGeometry()
+{
+}
+
+void RouteGeometry::clear()
+{
+    m_encoded.clear();
+    m_points = 0;
+    m_lastNode = 0;
+    m_lastLat = 0;
+    m_lastLon = 0;
+}
+
+void RouteGeometry::addPoint(const StreetMap* sm, int node)
+{
+    const NodeCoord& c = sm->graph().coords[node];
+    if (m_format == POLYLINE){
+        long long lat = llround(c.latitude * 1e5);
+        long long lon = llround(c.longitude * 1e5);
+        appendPolylineValue(m_encoded, lat - m_lastLat);
+        appendPolylineValue(m_encoded, lon - m_lastLon);
+        m_lastLat = lat;
+        m_lastLon = lon;
+    }
+    else {
+        long long lat = llround(c.latitude * 1e7);
+        long long lon = llround(c.longitude * 1e7);
+        appendVarint(m_encoded, zigzag((long long)node - m_lastNode));
+        appendVarint(m_encoded, zigzag(lat - m_lastLat));
+        appendVarint(m_encoded, zigzag(lon - m_lastLon));
+        m_lastLat = lat;
+        m_lastLon = lon;
+    }
+    m_lastNode = node;
+    m_points++;
+}
+
+void RouteGeometry::addPath(const StreetMap* sm, int fromNode, const vector<int>& pathEdges)
+{
+    const StreetGraph& g = sm->graph();
+    if (m_points == 0 || m_lastNode != fromNode) //case for a leg that doesn't carry on from the last point
+        addPoint(sm, fromNode);
+    for (int e : pathEdges)
+        addPoint(sm, g.edgeTarget[e]);
+}
+
+void RouteGeometry::beginPlan(const StreetMap* sm, const vector<DeliveryRequest>&)
+{
+    m_sm = sm;
+    clear();
+}
+
+void RouteGeometry::consumeLeg(int fromNode, const vector<int>& pathEdges)
+{
+    addPath(m_sm, fromNode, pathEdges);
+}
@@ -0,0 +1,43 @@
+// RouteGeometry.h
+//
+// Encoded route geometry, for callers that want to draw a route rather than
+// read its commands.
+
+#ifndef ROUTEGEOMETRY_INCLUDED
+#define ROUTEGEOMETRY_INCLUDED
+
+#include "DeliveryCommandSink.h"
+#include <string>
+#include <vector>
+
+  // Route geometry as a compact string, built straight from a route's edge ids.
+  //   POLYLINE  Google encoded polyline (latitude, longitude at 1e-5 degrees)
+  //   VARINT    varint stream of node ids and 1e-7 degree coordinates, each
+  //             delta-encoded; layout in RouteGeometry.cpp
+  // As a DeliveryCommandSink it collects a whole plan's legs into one line.
+class RouteGeometry : public DeliveryCommandSink
+{
+public:
+    enum Format { POLYLINE, VARINT };
+    RouteGeometry(Format format = POLYLINE);
+    ~RouteGeometry();
+    void clear();
+      // appends the route starting at fromNode; a leg starting where the last one ended doesn't repeat that point
+    void addPath(const StreetMap* sm, int fromNode, const std::vector<int>& pathEdges);
+    const std::string& encoded() const { return m_encoded; }
+    int points() const { return m_points; }
+    void beginPlan(const StreetMap* sm, const std::vector<DeliveryRequest>& deliveries);
+    void consume(const CompactCommand&) {}
+    void consumeLeg(int fromNode, const std::vector<int>& pathEdges);
+private:
+    Format m_format;
+    std::string m_encoded;
+    int m_points;
+    int m_lastNode;
+    long long m_lastLat;    // previous point, in the format's units
+    long long m_lastLon;
+    const StreetMap* m_sm;
+    void addPoint(const StreetMap* sm, int node);
+};
+
+#endif // ROUTEGEOMETRY_INCLUDED
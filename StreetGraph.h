@@ -0,0 +1,232 @@
+// StreetGraph.h
+//
+// Compact, id-based view of a loaded StreetMap. Every distinct coordinate in
+// the map file is a node and every street segment becomes two directed edges,
+// one per direction. Edges are stored grouped by their start node (compressed
+// sparse row), so the edges leaving node n are the ids firstEdge[n] up to but
+// not including firstEdge[n+1]. Searches can then keep their per-node state in
+// flat arrays indexed by node id instead of hashing GeoCoords.
+//
+// The arrays are either owned by the graph (a map loaded from text) or borrowed
+// from a memory-mapped tile file (StreetMap::loadTiles). A tiled graph numbers
+// its nodes cell by cell, so each GraphTile is one contiguous run of node ids
+// and, by the CSR layout, of edge ids; the pages holding a tile are only read
+// in once something touches them.
+
+#ifndef STREETGRAPH_INCLUDED
+#define STREETGRAPH_INCLUDED
+
+#include "provided.h"
+#include <string>
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+  // Read-only array that is either its own storage or a view of memory someone
+  // else owns. To fill the storage, write through storage() and then commit().
+template <typename T>
+class GraphArray
+{
+public:
+    GraphArray() : m_data(nullptr), m_size(0) {}
+    const T& operator[](size_t i) const { return m_data[i]; }
+    size_t size() const { return m_size; }
+    const T* begin() const { return m_data; }
+    const T* end() const { return m_data + m_size; }
+    std::vector<T>& storage() { return m_storage; }
+    void commit() { m_data = m_storage.data(); m_size = m_storage.size(); }
+    void borrow(const T* data, size_t size)
+    {
+        std::vector<T>().swap(m_storage);
+        m_data = data;
+        m_size = size;
+    }
+      // copying would leave the copy pointing into this array's storage
+    GraphArray(const GraphArray&) = delete;
+    GraphArray& operator=(const GraphArray&) = delete;
+private:
+    std::vector<T> m_storage;
+    const T* m_data;
+    size_t m_size;
+};
+
+struct NodeCoord
+{
+    double latitude;
+    double longitude;
+};
+
+  // the same great-circle distance as distanceEarthMiles, on bare coordinates
+inline double distanceEarthMiles(const NodeCoord& g1, const NodeCoord& g2)
+{
+    static const double earthRadiusKm = 6371.0;
+    const double milesPerKm = 1 / 1.609344;
+    double lat1r = deg2rad(g1.latitude);
+    double lon1r = deg2rad(g1.longitude);
+    double lat2r = deg2rad(g2.latitude);
+    double lon2r = deg2rad(g2.longitude);
+    double u = std::sin((lat2r - lat1r) / 2);
+    double v = std::sin((lon2r - lon1r) / 2);
+    return 2.0 * earthRadiusKm * std::asin(std::sqrt(u * u + std::cos(lat1r) * std::cos(lat2r) * v * v)) * milesPerKm;
+}
+
+  // Hash of a graph's id layout: every node's coordinate and first edge, then
+  // every edge's target and length, in id order. Files that store node or edge
+  // ids (route cache, distance oracle) record it and refuse a graph whose ids
+  // mean something else, such as the same map renumbered into tiles.
+inline uint64_t graphFingerprint(const NodeCoord* coords, const int* firstEdge, int nodes,
+                                 const int* edgeTarget, const double* edgeLength, int edges)
+{
+    uint64_t h = 14695981039346656037ull; //FNV-1a, a 64-bit word at a time
+    auto mix = [&h](const void* p, size_t bytes) {
+        const unsigned char* b = static_cast<const unsigned char*>(p);
+        for (size_t i = 0; i < bytes; i += 8){
+            uint64_t word = 0;
+            std::memcpy(&word, b + i, std::min<size_t>(8, bytes - i));
+            h = (h ^ word) * 1099511628211ull;
+        }
+    };
+    mix(&nodes, sizeof(nodes));
+    mix(&edges, sizeof(edges));
+    mix(coords, nodes * sizeof(NodeCoord));
+    mix(firstEdge, (nodes + 1) * sizeof(int));
+    mix(edgeTarget, edges * sizeof(int));
+    mix(edgeLength, edges * sizeof(double));
+    return h;
+}
+
+  // One geographic cell of a tiled graph: every node whose coordinate falls in
+  // [cellLat, cellLat+1) x [cellLon, cellLon+1) cells of the map's cell size.
+struct GraphTile
+{
+    int cellLat;        // floor(latitude / cellDegrees)
+    int cellLon;        // floor(longitude / cellDegrees)
+    int firstNode;      // the tile's nodes are [firstNode, endNode)
+    int endNode;
+    int firstBoundary;  // its boundary nodes are boundaryNodes[firstBoundary, endBoundary)
+    int endBoundary;
+};
+
+struct StreetGraph
+{
+    GraphArray<NodeCoord> coords;          // node id -> coordinate
+    GraphArray<uint32_t> coordText;        // node id -> offset in coordTextPool of "latitude\0longitude\0"; nodeCount()+1 entries
+    GraphArray<char> coordTextPool;        // the coordinates exactly as the map file wrote them
+    GraphArray<int> firstEdge;             // node id -> first outgoing edge id; nodeCount()+1 entries
+    GraphArray<int> edgeSource;            // edge id -> node it starts at
+    GraphArray<int> edgeTarget;            // edge id -> node it ends at
+    GraphArray<int> edgeReverse;           // edge id -> the same segment travelled the other way
+    GraphArray<int> edgeStreet;            // edge id -> index into streetNames
+    GraphArray<double> edgeLength;         // edge id -> length in miles
+    std::vector<std::string> streetNames;  // each distinct street name once
+    uint64_t fingerprint = 0;              // graphFingerprint of the arrays above
+
+    //tiled graphs only; empty for a map loaded from text
+    double cellDegrees = 0;
+    std::vector<GraphTile> tiles;          // ordered by (cellLat, cellLon), so also by node id
+    GraphArray<int> boundaryNodes;         // per tile, its nodes with an edge into another tile
+
+    //arc flags (StreetMap::buildArcFlags); regionCount is 0 when there are none
+    int regionCount = 0;
+    GraphArray<uint8_t> nodeRegion;        // node id -> region, 0 to regionCount-1
+    GraphArray<uint64_t> edgeFlags;        // edge id -> bit r set if the edge starts a shortest path into region r
+    GraphArray<uint64_t> edgeTrees;        // edge id -> bit r set if the edge is in a shortest-path tree to one of r's boundary nodes; not in tile files
+
+    int nodeCount() const { return (int)coords.size(); }
+    int edgeCount() const { return (int)edgeTarget.size(); }
+    bool tiled() const { return !tiles.empty(); }
+    bool arcFlagged() const { return regionCount > 0; }
+      // the regions' boundary trees; a tiled graph doesn't keep them, so there
+      // the flags, which hold every tree edge and more, stand in for them
+    const uint64_t* arcTrees() const
+    {
+        return edgeTrees.size() == edgeFlags.size() ? edgeTrees.begin() : edgeFlags.begin();
+    }
+
+    const std::string& streetName(int edge) const
+    {
+        return streetNames[edgeStreet[edge]];
+    }
+
+    const char* latitudeText(int node) const { return &coordTextPool[coordText[node]]; }
+    const char* longitudeText(int node) const
+    {
+        const char* lat = latitudeText(node);
+        return lat + std::char_traits<char>::length(lat) + 1;
+    }
+
+      // the node as the GeoCoord the public API hands out
+    GeoCoord coord(int node) const
+    {
+        return GeoCoord(latitudeText(node), longitudeText(node));
+    }
+
+      // the edge as the StreetSegment the public API hands out
+    StreetSegment segment(int edge) const
+    {
+        return StreetSegment(coord(edgeSource[edge]), coord(edgeTarget[edge]), streetName(edge));
+    }
+
+      // index in tiles of the tile holding node; tiled graphs only
+    int tileOf(int node) const
+    {
+        auto after = std::upper_bound(tiles.begin(), tiles.end(), node,
+                                      [](int n, const GraphTile& t) { return n < t.firstNode; });
+        return (int)(after - tiles.begin()) - 1;
+    }
+
+    bool inTile(int node, int tile) const
+    {
+        return tile >= 0 && node >= tiles[tile].firstNode && node < tiles[tile].endNode;
+    }
+};
+
+  // One published state of a WeightOverlay. Searches read a snapshot of this for
+  // their whole run, so an update never changes weights under a running query.
+struct EdgeWeights
+{
+    unsigned long version = 0;      // 0 means plain map lengths; otherwise unique per published state
+    std::vector<float> multiplier;  // edge id -> factor >= 1, infinity if closed; empty when version is 0
+    std::vector<uint64_t> edgeFlags;  // the map's arc flags redone for these weights; empty if there are none
+    std::vector<uint64_t> edgeTrees;  // the map's edgeTrees to go with them
+    uint64_t staleRegions = 0;        // regions whose flags are still being redone; searches into them can't prune
+
+    bool isBase() const { return multiplier.empty(); }
+    double weight(const StreetGraph& g, int edge) const
+    {
+        return isBase() ? g.edgeLength[edge] : g.edgeLength[edge] * multiplier[edge];
+    }
+    bool closed(int edge) const
+    {
+        return !isBase() && multiplier[edge] == std::numeric_limits<float>::infinity();
+    }
+      // the arc flags a search under these weights may prune with, or nullptr if none fit them
+    const uint64_t* arcFlags(const StreetGraph& g) const
+    {
+        if (!g.arcFlagged())
+            return nullptr;
+        if (isBase())
+            return g.edgeFlags.begin();
+        return edgeFlags.size() == (size_t)g.edgeCount() ? edgeFlags.data() : nullptr;
+    }
+};
+
+  // Recomputes, in flags and trees, the arc flags and boundary trees of every
+  // region whose bit is set in mask under weights, leaving other regions' bits
+  // as they were. region is the graph's node id -> region array. Regions are
+  // spread over threads threads, or one per core if that is 0.
+void flagArcRegions(const StreetGraph& g, const uint8_t* region, int regions, uint64_t mask, const EdgeWeights& weights,
+                    std::vector<uint64_t>& flags, std::vector<uint64_t>& trees, unsigned int threads = 0);
+
+  // What a bounded one-to-all search found: everything within the budget of one start.
+struct ReachableSet
+{
+    std::vector<int> nodes;          // node ids (see StreetMap::graph()), nearest first to within a few yards
+    std::vector<double> distances;   // road miles to each of nodes, weighted by the overlay if there is one
+    std::vector<int> edges;          // edge ids that can be driven end to end within the budget
+};
+
+#endif // STREETGRAPH_INCLUDED
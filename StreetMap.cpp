@@ -3,12 +3,37 @@
 #include <fstream>
 #include <vector>
 #include <functional>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "ExpandableHashMap.h"
+#include "StreetGraph.h"
+#include "Instrumentation.h"
 using namespace std;
 
 unsigned int hasher(const GeoCoord& g)
 {
-    return std::hash<string>()(g.latitudeText + g.longitudeText);
+    //combine the two halves' hashes rather than hashing a concatenated copy
+    size_t h = std::hash<string>()(g.latitudeText);
+    h ^= std::hash<string>()(g.longitudeText) + 0x9E3779B9 + (h << 6) + (h >> 2);
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+unsigned int hasher(const string& s)
+{
+    return std::hash<string>()(s);
 }
 
 class StreetMapImpl
@@ -18,88 +43,817 @@ public:
     ~StreetMapImpl();
     bool load(string mapFile);
     bool getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const;
+    int nodeId(const GeoCoord& gc) const;
+    const StreetGraph& graph() const { return m_graph; }
+    bool saveTiles(string tileFile, double cellDegrees) const;
+    bool loadTiles(string tileFile, size_t memoryBudgetBytes);
+    bool buildArcFlags(int regions, unsigned int threads);
+    void touchTile(int tile) const;
+    size_t residentTileBytes() const { return m_residentBytes.load(memory_order_relaxed); }
 private:
-    //hashmap of geocoords
-    ExpandableHashMap<GeoCoord, vector<StreetSegment>> Coords;
+    //hashmap of geocoords to node ids; the segments at each node are kept in m_graph, rebuilt at the end of every load
+    ExpandableHashMap<GeoCoord, int> m_nodeIds;
+    ExpandableHashMap<string, int> m_streetIds;
+    struct SegmentIds{ //one street segment of the map file, by node and street id
+        int from;
+        int to;
+        int street;
+    };
+    vector<SegmentIds> m_segments;
+    StreetGraph m_graph;
+    int internNode(const GeoCoord& gc);
+    int internStreet(const string& name);
+    void buildGraph();
+    void partition(vector<int>& nodes, int from, int to, int regions, int firstRegion, vector<uint8_t>& region) const;
+    //tiled maps: the mapped file, and which tiles are paged in
+    void* m_mapping;
+    size_t m_mappingBytes;
+    size_t m_budget;
+    mutable mutex m_tileLock;                          //held while paging tiles in or out
+    mutable unique_ptr<atomic<bool>[]> m_tileResident;
+    mutable unique_ptr<atomic<unsigned long>[]> m_tileUsed;  //m_useClock when each tile was last touched
+    mutable atomic<unsigned long> m_useClock;
+    mutable atomic<size_t> m_residentBytes;
+    int tiledNodeId(const GeoCoord& gc) const;
+    void adviseTile(int tile, int advice) const;
+    size_t tileBytes(int tile) const;
 };
 
 StreetMapImpl::StreetMapImpl()
+ : m_mapping(nullptr), m_mappingBytes(0), m_budget(0), m_useClock(0), m_residentBytes(0)
 {
+    m_graph.firstEdge.storage().assign(1, 0);
+    m_graph.firstEdge.commit();
+    m_graph.coordText.storage().assign(1, 0);
+    m_graph.coordText.commit();
 }
 
 StreetMapImpl::~StreetMapImpl()
 {
-    //deallocate all streetSegment pointers stored as hashtable values
+    if (m_mapping != nullptr)
+        munmap(m_mapping, m_mappingBytes);
 }
 
 bool StreetMapImpl::load(string mapFile)
 {
+    if (m_graph.tiled()) //a tiled map's arrays belong to its file
+        return false;
     ifstream infile(mapFile);
     if (!infile){ //only true if file is empty
         return false;
     }
+    //a segment line brings at most two new coordinates and a street takes two lines of its own, so the line
+    //count bounds how many new nodes, segments and streets there can be; sizing the tables for that up front
+    //means they never rehash during the load
+    long lines = count(istreambuf_iterator<char>(infile), istreambuf_iterator<char>(), '\n') + 1; //the last line may have no newline
+    infile.clear();
+    infile.seekg(0);
+    m_nodeIds.reserve(m_nodeIds.size() + (int)(2 * lines));
+    m_streetIds.reserve(m_streetIds.size() + (int)lines / 2);
+    m_segments.reserve(m_segments.size() + lines);
+    m_graph.coords.storage().reserve(m_graph.coords.storage().size() + 2 * lines);
+    m_graph.coordText.storage().reserve(m_graph.coordText.storage().size() + 2 * lines);
     //to go through the file for all street segments
+    string street = "";
+    string lon = "";
+    string lat = "";
+    string lon2 = "";
+    string lat2 = "";
     while (infile){
         //for each different street
-        string street = "";
         //getting street name
         getline(infile, street);
         int segs = 0;
         //getting amount of segments for the particular street
         infile >> segs;
         infile.ignore(10000, '\n');
-        //adding each streetsegment on the street to its geocoord and updating hashtable of geocoords
+        int streetId = segs > 0 ? internStreet(street) : -1;
+        //adding each streetsegment on the street by the ids of its two geocoords
         for (int i = 0; i < segs; i++){
-            //first vector is for first geocoord second is for second geocoord
-            vector<StreetSegment> streets;
-            vector<StreetSegment> streets2;
-            string lon = "";
-            string lat = "";
-            string lon2 = "";
-            string lat2 = "";
             //get long and latt of geoCoords then make them
             infile >> lat;
             infile >> lon;
             infile >> lat2;
             infile >> lon2;
             infile.ignore(10000, '\n');
-            GeoCoord newCoord(lat, lon);
-            GeoCoord newCoord2(lat2, lon2);
-            //seeing if there are already street segments asociated with geocoords
-            if (Coords.find(newCoord)!= nullptr){
-                streets = *Coords.find(newCoord);
-            }
-            if (Coords.find(newCoord2)!= nullptr){
-                streets2 = *Coords.find(newCoord2);
-            }
-            //creating street segments with the geocoords
-            StreetSegment newStreet(newCoord, newCoord2, street);
-            StreetSegment newStreetrev(newCoord2, newCoord, street);
-            streets.push_back(newStreet);
-            streets2.push_back(newStreetrev);
-            //updating or adding (whichecer is necessary) the two GeoCoords
-            Coords.associate(newCoord, streets);
-            Coords.associate(newCoord2, streets2);
+            SegmentIds ids;
+            ids.from = internNode(GeoCoord(lat, lon));
+            ids.to = internNode(GeoCoord(lat2, lon2));
+            ids.street = streetId;
+            m_segments.push_back(ids);
         }
     }
-    
+    buildGraph();
     return true;  // in what case is this false other than empty file...
 }
 
 bool StreetMapImpl::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const
 {
-    if (Coords.find(gc)!= nullptr){
-        segs.clear(); //in case segs has random values already in it
-        vector<StreetSegment> strts = *Coords.find(gc); //getting all corresponding street segments for geocoord using hashmap
-        for (int i = 0; i < strts.size(); i++){
-            StreetSegment tempstr = strts[i];
-            segs.push_back(tempstr); //pushing each streetSegment to segs so it has the necessary values
+    int id = nodeId(gc);
+    if (id < 0) // case for the GeoCoord not being in the map
+        return false;
+    segs.clear(); //in case segs has random values already in it
+    for (int e = m_graph.firstEdge[id]; e < m_graph.firstEdge[id + 1]; e++) //edges leaving the node, in the order the file gave them
+        segs.push_back(m_graph.segment(e));
+    return true;
+}
+
+int StreetMapImpl::nodeId(const GeoCoord& gc) const
+{
+    if (m_graph.tiled())
+        return tiledNodeId(gc);
+    const int* id = m_nodeIds.find(gc);
+    return id == nullptr ? -1 : *id;
+}
+
+int StreetMapImpl::internNode(const GeoCoord& gc)
+{
+    bool inserted = false;
+    int* id = m_nodeIds.tryEmplace(gc, inserted);
+    if (inserted){ //ids are handed out in order of first appearance in the file
+        *id = (int)m_graph.coords.storage().size();
+        m_graph.coords.storage().push_back(NodeCoord{gc.latitude, gc.longitude});
+        vector<char>& pool = m_graph.coordTextPool.storage();
+        pool.insert(pool.end(), gc.latitudeText.c_str(), gc.latitudeText.c_str() + gc.latitudeText.size() + 1);
+        pool.insert(pool.end(), gc.longitudeText.c_str(), gc.longitudeText.c_str() + gc.longitudeText.size() + 1);
+        m_graph.coordText.storage().push_back((uint32_t)pool.size()); //where the next node's text will start
+    }
+    return *id;
+}
+
+int StreetMapImpl::internStreet(const string& name)
+{
+    bool inserted = false;
+    int* id = m_streetIds.tryEmplace(name, inserted);
+    if (inserted){
+        *id = (int)m_graph.streetNames.size();
+        m_graph.streetNames.push_back(name);
+    }
+    return *id;
+}
+
+void StreetMapImpl::buildGraph()
+{
+    //segment i becomes directed edges 2i (as written) and 2i+1 (reversed); count how many leave each node
+    m_graph.coords.commit();
+    m_graph.coordText.commit();
+    m_graph.coordTextPool.commit();
+    int n = (int)m_graph.coords.size();
+    int m = (int)m_segments.size() * 2;
+    vector<int>& first = m_graph.firstEdge.storage();
+    first.assign(n + 1, 0);
+    for (const SegmentIds& seg : m_segments){
+        first[seg.from + 1]++;
+        first[seg.to + 1]++;
+    }
+    for (int v = 0; v < n; v++)
+        first[v + 1] += first[v];
+    //place every directed edge in its start node's range, remembering where each one landed
+    vector<int> next(first.begin(), first.end() - 1);
+    vector<int> position(m);
+    vector<int>& source = m_graph.edgeSource.storage();
+    vector<int>& target = m_graph.edgeTarget.storage();
+    vector<int>& street = m_graph.edgeStreet.storage();
+    vector<double>& length = m_graph.edgeLength.storage();
+    vector<int>& reverse = m_graph.edgeReverse.storage();
+    source.resize(m);
+    target.resize(m);
+    street.resize(m);
+    length.resize(m);
+    reverse.resize(m);
+    for (int i = 0; i < (int)m_segments.size(); i++){
+        const SegmentIds& seg = m_segments[i];
+        double miles = distanceEarthMiles(m_graph.coords[seg.from], m_graph.coords[seg.to]);
+        for (int dir = 0; dir < 2; dir++){
+            int from = dir == 0 ? seg.from : seg.to;
+            int to = dir == 0 ? seg.to : seg.from;
+            int e = next[from]++;
+            position[2*i + dir] = e;
+            source[e] = from;
+            target[e] = to;
+            street[e] = seg.street;
+            length[e] = miles;
+        }
+    }
+    for (int i = 0; i < (int)m_segments.size(); i++){
+        reverse[position[2*i]] = position[2*i + 1];
+        reverse[position[2*i + 1]] = position[2*i];
+    }
+    m_graph.firstEdge.commit();
+    m_graph.edgeSource.commit();
+    m_graph.edgeTarget.commit();
+    m_graph.edgeStreet.commit();
+    m_graph.edgeLength.commit();
+    m_graph.edgeReverse.commit();
+    m_graph.fingerprint = graphFingerprint(m_graph.coords.begin(), m_graph.firstEdge.begin(), n,
+                                           m_graph.edgeTarget.begin(), m_graph.edgeLength.begin(), m);
+    //the map changed under any arc flags
+    m_graph.regionCount = 0;
+    m_graph.nodeRegion.storage().clear();
+    m_graph.nodeRegion.commit();
+    m_graph.edgeFlags.storage().clear();
+    m_graph.edgeFlags.commit();
+    m_graph.edgeTrees.storage().clear();
+    m_graph.edgeTrees.commit();
+}
+
+  // Recursive geometric bisection: cut the nodes across their wider extent
+  // (east-west distances scaled to match north-south ones) so each side gets
+  // node counts in proportion to the regions it will hold, until one region is left.
+void StreetMapImpl::partition(vector<int>& nodes, int from, int to, int regions, int firstRegion, vector<uint8_t>& region) const
+{
+    if (regions == 1){
+        for (int i = from; i < to; i++)
+            region[nodes[i]] = (uint8_t)firstRegion;
+        return;
+    }
+    double minLat = 1e9, maxLat = -1e9, minLon = 1e9, maxLon = -1e9;
+    for (int i = from; i < to; i++){
+        const NodeCoord& c = m_graph.coords[nodes[i]];
+        minLat = min(minLat, c.latitude);
+        maxLat = max(maxLat, c.latitude);
+        minLon = min(minLon, c.longitude);
+        maxLon = max(maxLon, c.longitude);
+    }
+    bool byLatitude = (maxLat - minLat) >= (maxLon - minLon) * cos(deg2rad((minLat + maxLat) / 2));
+    auto key = [&](int v) {
+        const NodeCoord& c = m_graph.coords[v];
+        return make_pair(byLatitude ? c.latitude : c.longitude, v); //node id breaks ties so the cut is repeatable
+    };
+    int lowRegions = regions / 2;
+    int cut = from + (int)((long)(to - from) * lowRegions / regions);
+    nth_element(nodes.begin() + from, nodes.begin() + cut, nodes.begin() + to,
+                [&](int a, int b) { return key(a) < key(b); });
+    partition(nodes, from, cut, lowRegions, firstRegion, region);
+    partition(nodes, cut, to, regions - lowRegions, firstRegion + lowRegions, region);
+}
+
+namespace {
+
+  // Region r's flags: every edge inside r, plus every edge that is the first step
+  // of a shortest path from its start node to one of r's boundary nodes (nodes
+  // with an edge leaving r). Any shortest route into r can be rebuilt from those
+  // edges: follow a flagged path to the boundary node where the route last enters
+  // r, then the route's own edges inside r. Each boundary node gets a search over
+  // the reversed graph, which walks edgeReverse and weighs each step by the edge
+  // it reverses. Edges within a hair of tight are all flagged so rounding can't
+  // leave out a path the router would take; closed edges are never flagged.
+  // Each search's tree, the edge every node was last improved through, goes
+  // in trees: while none of those edges gets slower the distances to the
+  // boundary stay put, so slowing any other edge can only drop tight edges.
+void flagRegion(const StreetGraph& g, int r, const uint8_t* region, const EdgeWeights& weights,
+                vector<uint64_t>& flags, vector<uint64_t>& trees)
+{
+    const uint64_t bit = 1ULL << r;
+    const double TIGHT = 1e-9;
+    int n = g.nodeCount();
+    vector<double> dist(n);
+    vector<char> done(n);
+    vector<int> parent(n); //node -> the edge out of it its distance came through
+    typedef pair<double, int> QueueEntry;
+    for (int b = 0; b < n; b++){
+        if (region[b] != r)
+            continue;
+        bool boundary = false;
+        for (int e = g.firstEdge[b]; e < g.firstEdge[b + 1]; e++){
+            if (region[g.edgeTarget[e]] != r)
+                boundary = true;
+            else if (!weights.closed(e))
+                flags[e] |= bit;
+        }
+        if (!boundary)
+            continue;
+        fill(dist.begin(), dist.end(), numeric_limits<double>::infinity());
+        fill(done.begin(), done.end(), 0);
+        priority_queue<QueueEntry, vector<QueueEntry>, greater<QueueEntry>> open;
+        dist[b] = 0;
+        open.push(QueueEntry(0, b));
+        while (!open.empty()){
+            int v = open.top().second;
+            open.pop();
+            if (done[v])
+                continue;
+            done[v] = 1;
+            for (int e = g.firstEdge[v]; e < g.firstEdge[v + 1]; e++){
+                int u = g.edgeTarget[e];
+                int forward = g.edgeReverse[e]; //the edge u to v
+                if (weights.closed(forward))
+                    continue;
+                double d = dist[v] + weights.weight(g, forward);
+                if (d < dist[u]){
+                    dist[u] = d;
+                    parent[u] = forward;
+                    open.push(QueueEntry(d, u));
+                }
+            }
+        }
+        for (int u = 0; u < n; u++){ //every tight edge out of every node that can reach b
+            if (dist[u] == numeric_limits<double>::infinity())
+                continue;
+            if (u != b)
+                trees[parent[u]] |= bit;
+            for (int e = g.firstEdge[u]; e < g.firstEdge[u + 1]; e++){
+                if (weights.closed(e))
+                    continue;
+                int v = g.edgeTarget[e];
+                if (dist[v] + weights.weight(g, e) <= dist[u] + TIGHT)
+                    flags[e] |= bit;
+            }
+        }
+    }
+}
+
+}  // namespace
+
+void flagArcRegions(const StreetGraph& g, const uint8_t* region, int regions, uint64_t mask, const EdgeWeights& weights,
+                    vector<uint64_t>& flags, vector<uint64_t>& trees, unsigned int threads)
+{
+    vector<int> todo;
+    for (int r = 0; r < regions; r++)
+        if (mask & (1ULL << r))
+            todo.push_back(r);
+    flags.resize(g.edgeCount(), 0);
+    trees.resize(g.edgeCount(), 0);
+    for (int e = 0; e < g.edgeCount(); e++){
+        flags[e] &= ~mask;
+        trees[e] &= ~mask;
+    }
+    if (todo.empty())
+        return;
+    //regions are independent; each thread ors its regions' bits into its own copy of the flags and trees
+    if (threads == 0)
+        threads = max(1u, thread::hardware_concurrency());
+    threads = min<unsigned int>(threads, todo.size());
+    vector<vector<uint64_t>> partial(threads, vector<uint64_t>(g.edgeCount(), 0));
+    vector<vector<uint64_t>> partialTrees(threads, vector<uint64_t>(g.edgeCount(), 0));
+    atomic<int> next(0);
+    auto worker = [&](unsigned int t) {
+        for (int i = next++; i < (int)todo.size(); i = next++)
+            flagRegion(g, todo[i], region, weights, partial[t], partialTrees[t]);
+    };
+    vector<thread> pool;
+    for (unsigned int t = 1; t < threads; t++)
+        pool.emplace_back(worker, t);
+    worker(0); //this thread takes a share too
+    for (thread& t : pool)
+        t.join();
+    for (unsigned int t = 0; t < threads; t++)
+        for (int e = 0; e < g.edgeCount(); e++){
+            flags[e] |= partial[t][e];
+            trees[e] |= partialTrees[t][e];
+        }
+}
+
+bool StreetMapImpl::buildArcFlags(int regions, unsigned int threads)
+{
+    StreetGraph& g = m_graph;
+    int n = g.nodeCount();
+    if (n == 0 || regions < 1 || regions > 64)
+        return false;
+    regions = min(regions, n);
+    vector<uint8_t>& region = g.nodeRegion.storage();
+    region.assign(n, 0);
+    vector<int> nodes(n);
+    for (int v = 0; v < n; v++)
+        nodes[v] = v;
+    partition(nodes, 0, n, regions, 0, region);
+    static const EdgeWeights baseWeights;
+    vector<uint64_t>& flags = g.edgeFlags.storage();
+    vector<uint64_t>& trees = g.edgeTrees.storage();
+    flags.assign(g.edgeCount(), 0);
+    trees.assign(g.edgeCount(), 0);
+    flagArcRegions(g, region.data(), regions, regions == 64 ? ~0ULL : (1ULL << regions) - 1, baseWeights, flags, trees, threads);
+    g.nodeRegion.commit();
+    g.edgeFlags.commit();
+    g.edgeTrees.commit();
+    g.regionCount = regions;
+    return true;
+}
+
+// Tile file layout (native byte order):
+//   "GTM3", node count, edge count, street count, tile count, boundary count,
+//   arc flag region count (0 if none)  (uint32 each)
+//   cell size in degrees (double)
+//   graphFingerprint of the renumbered graph (uint64)
+//   file offset of each array below (uint64 each, in the order listed)
+//   per tile: cellLat, cellLon, firstNode, endNode, firstBoundary, endBoundary  (int32 each)
+//   per street: name length (uint32), name bytes
+// then the graph's arrays, each starting on a page boundary:
+//   coords (NodeCoord), coordText (uint32, nodes+1), coordTextPool (char),
+//   firstEdge (int32, nodes+1), edgeSource, edgeTarget, edgeReverse, edgeStreet (int32),
+//   edgeLength (double), boundaryNodes (int32),
+//   nodeRegion (uint8) and edgeFlags (uint64), both empty if there are no regions
+// Nodes are ordered by cell and within a cell by coordinate text, so a tile's part
+// of every array is one contiguous run and a coordinate can be found by binary search.
+
+namespace {
+
+const char TILES_MAGIC[4] = { 'G', 'T', 'M', '3' };
+const size_t TILE_PAGE = 4096;
+enum { SEC_COORDS, SEC_COORD_TEXT, SEC_TEXT_POOL, SEC_FIRST_EDGE, SEC_SOURCE, SEC_TARGET,
+       SEC_REVERSE, SEC_STREET, SEC_LENGTH, SEC_BOUNDARY, SEC_REGION, SEC_FLAGS, SECTIONS };
+
+struct TilesHeader
+{
+    char magic[4];
+    uint32_t nodes;
+    uint32_t edges;
+    uint32_t streets;
+    uint32_t tiles;
+    uint32_t boundary;
+    uint32_t regions;
+    double cellDegrees;
+    uint64_t fingerprint;
+    uint64_t offset[SECTIONS];
+};
+
+template <typename T> void writeRaw(ofstream& out, const T& v)
+{
+    out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template <typename T> void writeSection(ofstream& out, uint64_t& offset, const vector<T>& v)
+{
+    long pad = (long)((TILE_PAGE - out.tellp() % TILE_PAGE) % TILE_PAGE);
+    for (long i = 0; i < pad; i++)
+        out.put('\0');
+    offset = (uint64_t)out.tellp();
+    out.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+}
+
+int cellOf(double degrees, double cellDegrees)
+{
+    return (int)floor(degrees / cellDegrees);
+}
+
+  // orders nodes by the text of their coordinate, latitude first
+int compareText(const char* lat1, const char* lon1, const char* lat2, const char* lon2)
+{
+    int c = strcmp(lat1, lat2);
+    return c != 0 ? c : strcmp(lon1, lon2);
+}
+
+}  // namespace
+
+bool StreetMapImpl::saveTiles(string tileFile, double cellDegrees) const
+{
+    const StreetGraph& g = m_graph;
+    if (!(cellDegrees > 0))
+        return false;
+    int n = g.nodeCount();
+    int m = g.edgeCount();
+    vector<int> cellLat(n), cellLon(n);
+    for (int v = 0; v < n; v++){
+        cellLat[v] = cellOf(g.coords[v].latitude, cellDegrees);
+        cellLon[v] = cellOf(g.coords[v].longitude, cellDegrees);
+    }
+    vector<int> order(n); //new id -> old id
+    for (int v = 0; v < n; v++)
+        order[v] = v;
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        if (cellLat[a] != cellLat[b])
+            return cellLat[a] < cellLat[b];
+        if (cellLon[a] != cellLon[b])
+            return cellLon[a] < cellLon[b];
+        return compareText(g.latitudeText(a), g.longitudeText(a), g.latitudeText(b), g.longitudeText(b)) < 0;
+    });
+    vector<int> newId(n);
+    for (int v = 0; v < n; v++)
+        newId[order[v]] = v;
+
+    //each node keeps its edges in the same order, so only the ids change
+    vector<NodeCoord> coords(n);
+    vector<uint32_t> coordText(n + 1, 0);
+    vector<char> pool;
+    vector<int> first(n + 1, 0);
+    vector<int> newEdge(m);
+    for (int v = 0; v < n; v++){
+        int u = order[v];
+        coords[v] = g.coords[u];
+        const char* text = g.latitudeText(u);
+        pool.insert(pool.end(), text, text + (g.coordText[u + 1] - g.coordText[u]));
+        coordText[v + 1] = (uint32_t)pool.size();
+        first[v + 1] = first[v] + (g.firstEdge[u + 1] - g.firstEdge[u]);
+        for (int e = g.firstEdge[u]; e < g.firstEdge[u + 1]; e++)
+            newEdge[e] = first[v] + (e - g.firstEdge[u]);
+    }
+    vector<int> source(m), target(m), reverse(m), street(m);
+    vector<double> length(m);
+    vector<uint64_t> flags(g.arcFlagged() ? m : 0);
+    for (int e = 0; e < m; e++){
+        int f = newEdge[e];
+        source[f] = newId[g.edgeSource[e]];
+        target[f] = newId[g.edgeTarget[e]];
+        reverse[f] = newEdge[g.edgeReverse[e]];
+        street[f] = g.edgeStreet[e];
+        length[f] = g.edgeLength[e];
+        if (g.arcFlagged())
+            flags[f] = g.edgeFlags[e];
+    }
+    vector<uint8_t> region(g.arcFlagged() ? n : 0);
+    for (int v = 0; v < (int)region.size(); v++)
+        region[v] = g.nodeRegion[order[v]];
+
+    //one tile per run of nodes in the same cell; a boundary node has an edge leaving its cell
+    vector<GraphTile> tiles;
+    vector<int> boundary;
+    for (int v = 0; v < n; v++){
+        int u = order[v];
+        if (tiles.empty() || cellLat[u] != tiles.back().cellLat || cellLon[u] != tiles.back().cellLon){
+            if (!tiles.empty())
+                tiles.back().endBoundary = (int)boundary.size();
+            tiles.push_back(GraphTile{cellLat[u], cellLon[u], v, v, (int)boundary.size(), (int)boundary.size()});
+        }
+        tiles.back().endNode = v + 1;
+        for (int f = first[v]; f < first[v + 1]; f++){
+            int w = order[target[f]];
+            if (cellLat[w] != cellLat[u] || cellLon[w] != cellLon[u]){
+                boundary.push_back(v);
+                break;
+            }
+        }
+    }
+    if (!tiles.empty())
+        tiles.back().endBoundary = (int)boundary.size();
+
+    ofstream out(tileFile, ios::binary);
+    if (!out)
+        return false;
+    TilesHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TILES_MAGIC, 4);
+    header.nodes = (uint32_t)n;
+    header.edges = (uint32_t)m;
+    header.streets = (uint32_t)g.streetNames.size();
+    header.tiles = (uint32_t)tiles.size();
+    header.boundary = (uint32_t)boundary.size();
+    header.regions = (uint32_t)g.regionCount;
+    header.cellDegrees = cellDegrees;
+    header.fingerprint = graphFingerprint(coords.data(), first.data(), n, target.data(), length.data(), m);
+    writeRaw(out, header); //written again once the offsets are known
+    for (const GraphTile& t : tiles){
+        writeRaw(out, (int32_t)t.cellLat);
+        writeRaw(out, (int32_t)t.cellLon);
+        writeRaw(out, (int32_t)t.firstNode);
+        writeRaw(out, (int32_t)t.endNode);
+        writeRaw(out, (int32_t)t.firstBoundary);
+        writeRaw(out, (int32_t)t.endBoundary);
+    }
+    for (const string& name : g.streetNames){
+        writeRaw(out, (uint32_t)name.size());
+        out.write(name.data(), name.size());
+    }
+    writeSection(out, header.offset[SEC_COORDS], coords);
+    writeSection(out, header.offset[SEC_COORD_TEXT], coordText);
+    writeSection(out, header.offset[SEC_TEXT_POOL], pool);
+    writeSection(out, header.offset[SEC_FIRST_EDGE], first);
+    writeSection(out, header.offset[SEC_SOURCE], source);
+    writeSection(out, header.offset[SEC_TARGET], target);
+    writeSection(out, header.offset[SEC_REVERSE], reverse);
+    writeSection(out, header.offset[SEC_STREET], street);
+    writeSection(out, header.offset[SEC_LENGTH], length);
+    writeSection(out, header.offset[SEC_BOUNDARY], boundary);
+    writeSection(out, header.offset[SEC_REGION], region);
+    writeSection(out, header.offset[SEC_FLAGS], flags);
+    out.seekp(0);
+    writeRaw(out, header);
+    return (bool)out;
+}
+
+bool StreetMapImpl::loadTiles(string tileFile, size_t memoryBudgetBytes)
+{
+    if (m_graph.nodeCount() != 0 || m_graph.tiled()) //tiles replace a load, they don't add to one
+        return false;
+    int fd = open(tileFile.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(TilesHeader))
+        mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); //the mapping keeps the file open
+    if (mapping == MAP_FAILED)
+        return false;
+    size_t bytes = info.st_size;
+    const char* base = static_cast<const char*>(mapping);
+    TilesHeader header;
+    memcpy(&header, base, sizeof(header));
+    //every array has to lie inside the file
+    const size_t n = header.nodes, m = header.edges;
+    const size_t sectionBytes[SECTIONS] = {
+        n * sizeof(NodeCoord), (n + 1) * sizeof(uint32_t), 0, (n + 1) * sizeof(int32_t),
+        m * sizeof(int32_t), m * sizeof(int32_t), m * sizeof(int32_t), m * sizeof(int32_t),
+        m * sizeof(double), header.boundary * sizeof(int32_t),
+        header.regions != 0 ? n * sizeof(uint8_t) : 0, header.regions != 0 ? m * sizeof(uint64_t) : 0
+    };
+    bool valid = memcmp(header.magic, TILES_MAGIC, 4) == 0 && header.cellDegrees > 0 && header.tiles > 0
+              && header.regions <= 64;
+    for (int s = 0; valid && s < SECTIONS; s++)
+        valid = header.offset[s] % TILE_PAGE == 0 && header.offset[s] <= bytes && sectionBytes[s] <= bytes - header.offset[s];
+    const uint32_t* coordText = valid ? reinterpret_cast<const uint32_t*>(base + header.offset[SEC_COORD_TEXT]) : nullptr;
+    size_t poolBytes = valid ? coordText[n] : 0;
+    valid = valid && poolBytes <= bytes - header.offset[SEC_TEXT_POOL];
+    //the tile index and street names follow the header
+    size_t at = sizeof(TilesHeader);
+    vector<GraphTile> tiles;
+    vector<string> streets;
+    if (valid && (bytes - at) / (6 * sizeof(int32_t)) >= header.tiles){
+        tiles.resize(header.tiles);
+        for (GraphTile& t : tiles){
+            int32_t fields[6];
+            memcpy(fields, base + at, sizeof(fields));
+            at += sizeof(fields);
+            t = GraphTile{fields[0], fields[1], fields[2], fields[3], fields[4], fields[5]};
+            int before = &t == &tiles[0] ? 0 : (&t)[-1].endNode;
+            if (t.firstNode != before || t.endNode < t.firstNode || t.endNode > (int)n
+                || t.firstBoundary < 0 || t.endBoundary < t.firstBoundary || t.endBoundary > (int)header.boundary)
+                valid = false;
+        }
+        valid = valid && tiles.back().endNode == (int)n;
+        for (uint32_t i = 0; valid && i < header.streets; i++){
+            uint32_t length = 0;
+            valid = bytes - at >= sizeof(length);
+            if (valid){
+                memcpy(&length, base + at, sizeof(length));
+                at += sizeof(length);
+                valid = bytes - at >= length;
+            }
+            if (valid){
+                streets.push_back(string(base + at, length));
+                at += length;
+            }
+        }
+    }
+    else valid = false;
+    //every id the searches index by has to be in range, or a damaged file would send them outside the arrays
+    if (valid){
+        const int32_t* first = reinterpret_cast<const int32_t*>(base + header.offset[SEC_FIRST_EDGE]);
+        valid = first[0] == 0 && first[n] == (int32_t)m;
+        for (size_t v = 0; valid && v < n; v++)
+            valid = first[v] <= first[v + 1];
+        const int32_t* source = reinterpret_cast<const int32_t*>(base + header.offset[SEC_SOURCE]);
+        const int32_t* target = reinterpret_cast<const int32_t*>(base + header.offset[SEC_TARGET]);
+        const int32_t* reverse = reinterpret_cast<const int32_t*>(base + header.offset[SEC_REVERSE]);
+        const int32_t* street = reinterpret_cast<const int32_t*>(base + header.offset[SEC_STREET]);
+        for (size_t e = 0; valid && e < m; e++)
+            valid = source[e] >= 0 && (size_t)source[e] < n && target[e] >= 0 && (size_t)target[e] < n
+                 && reverse[e] >= 0 && (size_t)reverse[e] < m && street[e] >= 0 && (size_t)street[e] < header.streets;
+        const int32_t* boundary = reinterpret_cast<const int32_t*>(base + header.offset[SEC_BOUNDARY]);
+        for (size_t i = 0; valid && i < header.boundary; i++)
+            valid = boundary[i] >= 0 && (size_t)boundary[i] < n;
+        const uint8_t* region = reinterpret_cast<const uint8_t*>(base + header.offset[SEC_REGION]);
+        for (size_t v = 0; valid && header.regions != 0 && v < n; v++)
+            valid = region[v] < header.regions;
+    }
+    if (!valid){
+        munmap(mapping, bytes);
+        return false;
+    }
+    //the checks above read the index arrays in; drop them again, since a search
+    //reads a tile's pages in as it reaches them and the budget counts only those
+    madvise(mapping, bytes, MADV_DONTNEED);
+    madvise(mapping, bytes, MADV_RANDOM);
+    m_mapping = mapping;
+    m_mappingBytes = bytes;
+    m_budget = memoryBudgetBytes;
+    m_nodeIds.reset();
+    m_streetIds.reset();
+    m_segments.clear();
+    StreetGraph& g = m_graph;
+    g.coords.borrow(reinterpret_cast<const NodeCoord*>(base + header.offset[SEC_COORDS]), n);
+    g.coordText.borrow(coordText, n + 1);
+    g.coordTextPool.borrow(base + header.offset[SEC_TEXT_POOL], poolBytes);
+    g.firstEdge.borrow(reinterpret_cast<const int*>(base + header.offset[SEC_FIRST_EDGE]), n + 1);
+    g.edgeSource.borrow(reinterpret_cast<const int*>(base + header.offset[SEC_SOURCE]), m);
+    g.edgeTarget.borrow(reinterpret_cast<const int*>(base + header.offset[SEC_TARGET]), m);
+    g.edgeReverse.borrow(reinterpret_cast<const int*>(base + header.offset[SEC_REVERSE]), m);
+    g.edgeStreet.borrow(reinterpret_cast<const int*>(base + header.offset[SEC_STREET]), m);
+    g.edgeLength.borrow(reinterpret_cast<const double*>(base + header.offset[SEC_LENGTH]), m);
+    g.boundaryNodes.borrow(reinterpret_cast<const int*>(base + header.offset[SEC_BOUNDARY]), header.boundary);
+    g.regionCount = header.regions;
+    g.nodeRegion.borrow(reinterpret_cast<const uint8_t*>(base + header.offset[SEC_REGION]), header.regions != 0 ? n : 0);
+    g.edgeFlags.borrow(reinterpret_cast<const uint64_t*>(base + header.offset[SEC_FLAGS]), header.regions != 0 ? m : 0);
+    g.edgeTrees.borrow(nullptr, 0);
+    g.streetNames = streets;
+    g.cellDegrees = header.cellDegrees;
+    g.fingerprint = header.fingerprint;
+    g.tiles = tiles;
+    m_tileResident.reset(new atomic<bool>[tiles.size()]);
+    m_tileUsed.reset(new atomic<unsigned long>[tiles.size()]);
+    for (size_t t = 0; t < tiles.size(); t++){
+        m_tileResident[t] = false;
+        m_tileUsed[t] = 0;
+    }
+    m_residentBytes = 0;
+    return true;
+}
+
+  // Finds the coordinate's cell in the tile index, then the coordinate in that
+  // tile's nodes, which are sorted by their text.
+int StreetMapImpl::tiledNodeId(const GeoCoord& gc) const
+{
+    const StreetGraph& g = m_graph;
+    int cellLat = cellOf(gc.latitude, g.cellDegrees);
+    int cellLon = cellOf(gc.longitude, g.cellDegrees);
+    auto t = lower_bound(g.tiles.begin(), g.tiles.end(), make_pair(cellLat, cellLon),
+                         [](const GraphTile& tile, const pair<int, int>& cell) {
+                             return make_pair(tile.cellLat, tile.cellLon) < cell;
+                         });
+    if (t == g.tiles.end() || t->cellLat != cellLat || t->cellLon != cellLon) //case for no node in that cell
+        return -1;
+    touchTile((int)(t - g.tiles.begin()));
+    int lo = t->firstNode;
+    int hi = t->endNode;
+    while (lo < hi){
+        int mid = lo + (hi - lo) / 2;
+        int c = compareText(g.latitudeText(mid), g.longitudeText(mid), gc.latitudeText.c_str(), gc.longitudeText.c_str());
+        if (c == 0)
+            return mid;
+        if (c < 0)
+            lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+  // applies advice to the pages holding tile's part of every array
+void StreetMapImpl::adviseTile(int tile, int advice) const
+{
+    const StreetGraph& g = m_graph;
+    const GraphTile& t = g.tiles[tile];
+    int fromEdge = g.firstEdge[t.firstNode];
+    int toEdge = g.firstEdge[t.endNode];
+    const char* mapped = static_cast<const char*>(m_mapping);
+    auto advise = [&](const void* begin, const void* end) {
+        if (begin < mapped || begin >= mapped + m_mappingBytes) //case for an array built after loading, which the map owns
+            return;
+        uintptr_t from = (uintptr_t)begin & ~(uintptr_t)(TILE_PAGE - 1);
+        if ((uintptr_t)end > from)
+            madvise((void*)from, (uintptr_t)end - from, advice);
+    };
+    advise(&g.coords[t.firstNode], &g.coords[0] + t.endNode);
+    advise(&g.coordText[t.firstNode], &g.coordText[0] + t.endNode + 1);
+    advise(&g.coordTextPool[0] + g.coordText[t.firstNode], &g.coordTextPool[0] + g.coordText[t.endNode]);
+    advise(&g.firstEdge[t.firstNode], &g.firstEdge[0] + t.endNode + 1);
+    advise(g.edgeSource.begin() + fromEdge, g.edgeSource.begin() + toEdge);
+    advise(g.edgeTarget.begin() + fromEdge, g.edgeTarget.begin() + toEdge);
+    advise(g.edgeReverse.begin() + fromEdge, g.edgeReverse.begin() + toEdge);
+    advise(g.edgeStreet.begin() + fromEdge, g.edgeStreet.begin() + toEdge);
+    advise(g.edgeLength.begin() + fromEdge, g.edgeLength.begin() + toEdge);
+    if (g.arcFlagged()){
+        advise(g.nodeRegion.begin() + t.firstNode, g.nodeRegion.begin() + t.endNode);
+        advise(g.edgeFlags.begin() + fromEdge, g.edgeFlags.begin() + toEdge);
+    }
+}
+
+size_t StreetMapImpl::tileBytes(int tile) const
+{
+    const StreetGraph& g = m_graph;
+    const GraphTile& t = g.tiles[tile];
+    size_t nodes = t.endNode - t.firstNode;
+    size_t edges = g.firstEdge[t.endNode] - g.firstEdge[t.firstNode];
+    return nodes * (sizeof(NodeCoord) + 2 * sizeof(int)) + (g.coordText[t.endNode] - g.coordText[t.firstNode])
+         + edges * (4 * sizeof(int) + sizeof(double))
+         + (g.arcFlagged() ? nodes * sizeof(uint8_t) + edges * sizeof(uint64_t) : 0);
+}
+
+  // Marks the tile used and, if it isn't resident, reads it in with one request
+  // rather than a page fault at a time. Going over budget drops the least recently
+  // used tiles other than this one. Dropping is always safe: the mapping is a
+  // read-only view of the file, so a search still holding a dropped tile's nodes
+  // just faults the pages back in.
+void StreetMapImpl::touchTile(int tile) const
+{
+    if (!m_graph.tiled())
+        return;
+    m_tileUsed[tile].store(++m_useClock, memory_order_relaxed);
+    if (m_tileResident[tile].load(memory_order_acquire))
+        return;
+    lock_guard<mutex> lk(m_tileLock);
+    if (m_tileResident[tile].load(memory_order_relaxed)) //case for another thread having read it in while this one waited
+        return;
+    adviseTile(tile, MADV_WILLNEED);
+    m_tileResident[tile].store(true, memory_order_release);
+    m_residentBytes += tileBytes(tile);
+    GOOBER_COUNT(tileLoads);
+    while (m_budget != 0 && m_residentBytes > m_budget){
+        int victim = -1;
+        for (int t = 0; t < (int)m_graph.tiles.size(); t++){
+            if (t == tile || !m_tileResident[t].load(memory_order_relaxed))
+                continue;
+            if (victim < 0 || m_tileUsed[t].load(memory_order_relaxed) < m_tileUsed[victim].load(memory_order_relaxed))
+                victim = t;
         }
-        return true;
+        if (victim < 0) //case for this tile alone being over budget
+            break;
+        m_tileResident[victim].store(false, memory_order_release);
+        adviseTile(victim, MADV_DONTNEED);
+        m_residentBytes -= tileBytes(victim);
+        GOOBER_COUNT(tileEvictions);
     }
-    return false; // case for find returning nullptr because the GeoCoord hasn't been stored in Coords
 }
 
+
 //******************** StreetMap functions ************************************
 
 // These functions simply delegate to StreetMapImpl's functions.
@@ -125,9 +879,38 @@ bool StreetMap::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegmen
    return m_impl->getSegmentsThatStartWith(gc, segs);
 }
 
-//unsigned int hasher(const string& g)
-//{
-//    std::hash<string> hasher;
-//    return hasher(g);
-//}
+int StreetMap::nodeId(const GeoCoord& gc) const
+{
+    return m_impl->nodeId(gc);
+}
+
+const StreetGraph& StreetMap::graph() const
+{
+    return m_impl->graph();
+}
+
+bool StreetMap::saveTiles(string tileFile, double cellDegrees) const
+{
+    return m_impl->saveTiles(tileFile, cellDegrees);
+}
+
+bool StreetMap::loadTiles(string tileFile, size_t memoryBudgetBytes)
+{
+    return m_impl->loadTiles(tileFile, memoryBudgetBytes);
+}
+
+bool StreetMap::buildArcFlags(int regions, unsigned int threads)
+{
+    return m_impl->buildArcFlags(regions, threads);
+}
+
+void StreetMap::touchTile(int tile) const
+{
+    m_impl->touchTile(tile);
+}
+
+size_t StreetMap::residentTileBytes() const
+{
+    return m_impl->residentTileBytes();
+}
 
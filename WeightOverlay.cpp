@@ -0,0 +1,292 @@
+#include "provided.h"
+#include "WeightOverlay.h"
+#include "StreetGraph.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <limits>
+using namespace std;
+
+namespace {
+
+  // versions are unique across every overlay in the process, so a RouteCache
+  // shared by routers with different overlays never mixes their routes
+atomic<unsigned long> lastWeightsVersion(0);
+
+const float CLOSED = numeric_limits<float>::infinity();
+
+  // The regions whose arc flags, found under before with boundary trees trees,
+  // still fit after: every edge kept its weight or got slower without being in
+  // one of the region's trees (see flagRegion). An edge that got faster can
+  // start a new shortest path anywhere, so then none do.
+uint64_t regionsStillFlagged(const StreetGraph& g, const EdgeWeights& before, const uint64_t* trees, const EdgeWeights& after)
+{
+    uint64_t broken = 0;
+    for (int e = 0; e < g.edgeCount(); e++){
+        float was = before.isBase() ? 1.0f : before.multiplier[e];
+        float now = after.isBase() ? 1.0f : after.multiplier[e];
+        if (now < was)
+            return 0;
+        if (now > was)
+            broken |= trees[e];
+    }
+    return ~broken;
+}
+
+}  // namespace
+
+class WeightOverlayImpl
+{
+public:
+    WeightOverlayImpl(const StreetMap* sm);
+    ~WeightOverlayImpl();
+    bool setSegment(const GeoCoord& from, const GeoCoord& to, float factor, bool bothWays);
+    bool setStreet(const string& streetName, float factor);
+    void clear();
+    shared_ptr<const EdgeWeights> weights() const { return atomic_load(&m_current); }
+    void waitForArcFlags() const;
+private:
+    const StreetMap* m_sm;
+    mutable mutex m_writeLock; //writers copy, change and publish one at a time; readers never wait
+    mutable condition_variable m_published; //a snapshot went out, or the overlay is going away
+    shared_ptr<const EdgeWeights> m_current;
+    thread m_reflagger; //redoes stale regions' arc flags; started by the first edit that leaves any
+    bool m_stopping;
+    bool modify(const function<bool(vector<float>&)>& change);
+    void carryFlags(const EdgeWeights& previous, EdgeWeights& next) const;
+    void publish(const shared_ptr<const EdgeWeights>& next);
+    void reflagLoop();
+};
+
+WeightOverlayImpl::WeightOverlayImpl(const StreetMap* sm)
+ : m_sm(sm), m_current(make_shared<EdgeWeights>()), m_stopping(false)
+{
+}
+
+  // A region being redone when the overlay goes away is finished first.
+WeightOverlayImpl::~WeightOverlayImpl()
+{
+    {
+        lock_guard<mutex> lk(m_writeLock);
+        m_stopping = true;
+    }
+    m_published.notify_all();
+    if (m_reflagger.joinable())
+        m_reflagger.join();
+}
+
+  // Applies change to a copy of the current multipliers and, if it reports a
+  // match, publishes the copy as the new snapshot.
+bool WeightOverlayImpl::modify(const function<bool(vector<float>&)>& change)
+{
+    lock_guard<mutex> lk(m_writeLock);
+    const StreetGraph& g = m_sm->graph();
+    shared_ptr<const EdgeWeights> current = atomic_load(&m_current);
+    vector<float> multiplier = current->multiplier;
+    if (multiplier.empty())
+        multiplier.assign(g.edgeCount(), 1.0f);
+    if (!change(multiplier))
+        return false;
+    auto next = make_shared<EdgeWeights>();
+    bool anyChange = false;
+    for (float f : multiplier)
+        if (f != 1.0f){
+            anyChange = true;
+            break;
+        }
+    if (anyChange){ //case for everything being back to 1, which is just the plain map again
+        next->version = ++lastWeightsVersion;
+        next->multiplier = std::move(multiplier);
+        if (g.arcFlagged())
+            carryFlags(*current, *next);
+    }
+    publish(next);
+    return true;
+}
+
+  // Arc flags for next, without a search: each region takes the map's flags
+  // if they still fit, else previous's if those do. The regions neither fits
+  // are marked stale for the reflagger, and searches into them don't prune
+  // until it has redone them.
+void WeightOverlayImpl::carryFlags(const EdgeWeights& previous, EdgeWeights& next) const
+{
+    static const EdgeWeights baseWeights;
+    const StreetGraph& g = m_sm->graph();
+    int m = g.edgeCount();
+    const uint64_t all = g.regionCount == 64 ? ~0ULL : (1ULL << g.regionCount) - 1;
+    const uint64_t* before = previous.arcFlags(g);
+    const uint64_t* beforeTrees = previous.isBase() ? g.arcTrees() : previous.edgeTrees.data();
+    uint64_t fromMap = all & regionsStillFlagged(g, baseWeights, g.arcTrees(), next);
+    uint64_t fromPrevious = 0;
+    if (before != nullptr)
+        fromPrevious = all & ~fromMap & ~previous.staleRegions & regionsStillFlagged(g, previous, beforeTrees, next);
+    next.edgeFlags.resize(m);
+    next.edgeTrees.resize(m);
+    for (int e = 0; e < m; e++){ //the map's bits where they fit, previous's for the rest
+        next.edgeFlags[e] = (g.edgeFlags[e] & fromMap) | (before != nullptr ? before[e] & ~fromMap : 0);
+        next.edgeTrees[e] = (g.arcTrees()[e] & fromMap) | (before != nullptr ? beforeTrees[e] & ~fromMap : 0);
+    }
+    next.staleRegions = all & ~fromMap & ~fromPrevious;
+}
+
+  // Makes next the snapshot searches see, waking the reflagger if it leaves
+  // regions stale. The caller holds m_writeLock.
+void WeightOverlayImpl::publish(const shared_ptr<const EdgeWeights>& next)
+{
+    atomic_store(&m_current, next);
+    if (next->staleRegions != 0 && !m_reflagger.joinable())
+        m_reflagger = thread(&WeightOverlayImpl::reflagLoop, this);
+    m_published.notify_all();
+}
+
+  // Redoes the stale regions of the newest snapshot, without holding up edits.
+  // If edits were published meanwhile, the regions they left stale take the
+  // fresh flags wherever those still fit the newer weights; the rest go round again.
+void WeightOverlayImpl::reflagLoop()
+{
+    const StreetGraph& g = m_sm->graph();
+    unique_lock<mutex> lk(m_writeLock);
+    for (;;){
+        m_published.wait(lk, [this] { return m_stopping || atomic_load(&m_current)->staleRegions != 0; });
+        if (m_stopping)
+            return;
+        shared_ptr<const EdgeWeights> target = atomic_load(&m_current);
+        lk.unlock();
+        vector<uint64_t> flags = target->edgeFlags;
+        vector<uint64_t> trees = target->edgeTrees;
+        flagArcRegions(g, g.nodeRegion.begin(), g.regionCount, target->staleRegions, *target, flags, trees);
+        lk.lock();
+        shared_ptr<const EdgeWeights> current = atomic_load(&m_current);
+        uint64_t fresh = target->staleRegions & current->staleRegions;
+        if (current != target) //case for edits published while the flags were redone
+            fresh &= regionsStillFlagged(g, *target, trees.data(), *current);
+        if (fresh == 0)
+            continue;
+        auto next = make_shared<EdgeWeights>(*current); //same weights and version, fresher flags
+        for (int e = 0; e < g.edgeCount(); e++){
+            next->edgeFlags[e] = (next->edgeFlags[e] & ~fresh) | (flags[e] & fresh);
+            next->edgeTrees[e] = (next->edgeTrees[e] & ~fresh) | (trees[e] & fresh);
+        }
+        next->staleRegions &= ~fresh;
+        publish(next);
+    }
+}
+
+  // Returns at once if no region is stale, including on a map without arc flags.
+void WeightOverlayImpl::waitForArcFlags() const
+{
+    unique_lock<mutex> lk(m_writeLock);
+    m_published.wait(lk, [this] { return atomic_load(&m_current)->staleRegions == 0; });
+}
+
+bool WeightOverlayImpl::setSegment(const GeoCoord& from, const GeoCoord& to, float factor, bool bothWays)
+{
+    int a = m_sm->nodeId(from);
+    int b = m_sm->nodeId(to);
+    if (a < 0 || b < 0)
+        return false;
+    return modify([&](vector<float>& multiplier) {
+        const StreetGraph& g = m_sm->graph();
+        bool found = false;
+        for (int e = g.firstEdge[a]; e < g.firstEdge[a + 1]; e++){ //every edge from a to b (maps can repeat a segment)
+            if (g.edgeTarget[e] != b)
+                continue;
+            multiplier[e] = factor;
+            if (bothWays)
+                multiplier[g.edgeReverse[e]] = factor;
+            found = true;
+        }
+        return found;
+    });
+}
+
+bool WeightOverlayImpl::setStreet(const string& streetName, float factor)
+{
+    const StreetGraph& g = m_sm->graph();
+    int street = -1;
+    for (int i = 0; i < (int)g.streetNames.size(); i++)
+        if (g.streetNames[i] == streetName){
+            street = i;
+            break;
+        }
+    if (street < 0)
+        return false;
+    return modify([&](vector<float>& multiplier) {
+        for (int e = 0; e < g.edgeCount(); e++)
+            if (g.edgeStreet[e] == street)
+                multiplier[e] = factor;
+        return true;
+    });
+}
+
+void WeightOverlayImpl::clear()
+{
+    lock_guard<mutex> lk(m_writeLock);
+    publish(make_shared<EdgeWeights>());
+}
+
+//******************** WeightOverlay functions ********************************
+
+// These functions simply delegate to WeightOverlayImpl's functions.
+
+WeightOverlay::WeightOverlay(const StreetMap* sm)
+{
+    m_impl = new WeightOverlayImpl(sm);
+}
+
+WeightOverlay::~WeightOverlay()
+{
+    delete m_impl;
+}
+
+bool WeightOverlay::setMultiplier(const GeoCoord& from, const GeoCoord& to, double factor, bool bothWays)
+{
+    if (!(factor >= 1))
+        return false;
+    return m_impl->setSegment(from, to, (float)factor, bothWays);
+}
+
+bool WeightOverlay::close(const GeoCoord& from, const GeoCoord& to, bool bothWays)
+{
+    return m_impl->setSegment(from, to, CLOSED, bothWays);
+}
+
+bool WeightOverlay::reopen(const GeoCoord& from, const GeoCoord& to, bool bothWays)
+{
+    return m_impl->setSegment(from, to, 1.0f, bothWays);
+}
+
+bool WeightOverlay::setStreetMultiplier(string streetName, double factor)
+{
+    if (!(factor >= 1))
+        return false;
+    return m_impl->setStreet(streetName, (float)factor);
+}
+
+bool WeightOverlay::closeStreet(string streetName)
+{
+    return m_impl->setStreet(streetName, CLOSED);
+}
+
+void WeightOverlay::clear()
+{
+    m_impl->clear();
+}
+
+shared_ptr<const EdgeWeights> WeightOverlay::weights() const
+{
+    return m_impl->weights();
+}
+
+unsigned long WeightOverlay::version() const
+{
+    return m_impl->weights()->version;
+}
+
+void WeightOverlay::waitForArcFlags() const
+{
+    m_impl->waitForArcFlags();
+}
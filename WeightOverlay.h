@@ -0,0 +1,53 @@
+// WeightOverlay.h
+//
+// Per-edge slowdowns and closures that routers, planners and the optimizer
+// take in place of plain map lengths. The snapshot it publishes is an
+// EdgeWeights (see StreetGraph.h).
+
+#ifndef WEIGHTOVERLAY_INCLUDED
+#define WEIGHTOVERLAY_INCLUDED
+
+#include "provided.h"
+#include <memory>
+#include <string>
+
+struct EdgeWeights;  // StreetGraph.h
+
+class WeightOverlayImpl;
+
+  // Runtime slowdowns and closures layered over a StreetMap's segment lengths.
+  // Every change publishes a new snapshot atomically; queries already running
+  // keep the snapshot they started with and the next query sees the change.
+  // Factors must be at least 1 so crow distance stays a valid A* estimate.
+  // Accelerators under a change in effect:
+  //   arc flags - a change publishes at once, keeping each region's flags
+  //               that no slowed edge's shortest paths run through; the other
+  //               regions are redone on a background thread, and until then
+  //               searches into them run without pruning;
+  //   DistanceOracle - not customized; routers skip it and search instead;
+  //   RouteCache - entries are kept per snapshot version, so nothing is reused.
+class WeightOverlay
+{
+public:
+    WeightOverlay(const StreetMap* sm);
+    ~WeightOverlay();
+      // Each returns false, changing nothing, if the map has no such segment or street.
+    bool setMultiplier(const GeoCoord& from, const GeoCoord& to, double factor, bool bothWays = true);
+    bool close(const GeoCoord& from, const GeoCoord& to, bool bothWays = true);
+    bool reopen(const GeoCoord& from, const GeoCoord& to, bool bothWays = true);
+    bool setStreetMultiplier(std::string streetName, double factor);
+    bool closeStreet(std::string streetName);
+    void clear();  // back to plain map lengths
+      // the current snapshot; version 0 whenever no change is in effect
+    std::shared_ptr<const EdgeWeights> weights() const;
+    unsigned long version() const;
+      // blocks until no region's arc flags are still being redone for the current snapshot
+    void waitForArcFlags() const;
+      // We prevent a WeightOverlay object from being copied or assigned.
+    WeightOverlay(const WeightOverlay&) = delete;
+    WeightOverlay& operator=(const WeightOverlay&) = delete;
+private:
+    WeightOverlayImpl* m_impl;
+};
+
+#endif // WEIGHTOVERLAY_INCLUDED
@@ -0,0 +1,123 @@
+// BenchSupport.h
+//
+// Helpers shared by the programs in bench/: timing, the map's coordinates as
+// seeded query material, and the small JSON emitter their reports are written
+// with. Each program is one translation unit, so everything here is inline.
+
+#ifndef BENCHSUPPORT_INCLUDED
+#define BENCHSUPPORT_INCLUDED
+
+#include "provided.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/resource.h>
+
+using Clock = std::chrono::steady_clock;
+
+inline double millisSince(Clock::time_point started)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - started).count();
+}
+
+inline long peakRssKb()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;  //kilobytes on Linux
+}
+
+  // every distinct coordinate in the map file, in a fixed order so seeded picks are reproducible
+inline bool loadMapCoords(std::string mapFile, std::vector<GeoCoord>& coords)
+{
+    std::ifstream infile(mapFile);
+    if (!infile)
+        return false;
+    std::set<std::pair<std::string, std::string>> seen;
+    std::string street;
+    while (std::getline(infile, street))
+    {
+        int segs = 0;
+        infile >> segs;
+        infile.ignore(10000, '\n');
+        for (int i = 0; i < segs; i++)
+        {
+            std::string lat, lon, lat2, lon2;
+            infile >> lat >> lon >> lat2 >> lon2;
+            infile.ignore(10000, '\n');
+            seen.insert(std::make_pair(lat, lon));
+            seen.insert(std::make_pair(lat2, lon2));
+        }
+    }
+    for (const auto& p : seen)
+        coords.push_back(GeoCoord(p.first, p.second));
+    return !coords.empty();
+}
+
+inline double percentile(std::vector<double> sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+  // minimal JSON emitter; keys are written in call order
+class JsonWriter
+{
+public:
+    JsonWriter()
+    {
+        m_out.setf(std::ios::fixed);
+        m_out.precision(4);
+    }
+    void beginObject(const char* key = nullptr) { prefix(key); m_out << '{'; m_first = true; }
+    void endObject() { m_out << '}'; m_first = false; }
+    void beginArray(const char* key) { prefix(key); m_out << '['; m_first = true; }
+    void endArray() { m_out << ']'; m_first = false; }
+    void value(const char* key, double v) { prefix(key); m_out << v; }
+    void value(const char* key, long v) { prefix(key); m_out << v; }
+    void value(const char* key, const std::string& v) { prefix(key); m_out << '"' << v << '"'; }
+    std::string str() const { return m_out.str(); }
+private:
+    void prefix(const char* key)
+    {
+        if (!m_first)
+            m_out << ',';
+        m_first = false;
+        if (key != nullptr)
+            m_out << '"' << key << "\":";
+    }
+    std::ostringstream m_out;
+    bool m_first = true;
+};
+
+inline void latencySummary(JsonWriter& json, std::vector<double> millis)
+{
+    std::sort(millis.begin(), millis.end());
+    double total = 0;
+    for (double m : millis)
+        total += m;
+    json.value("mean_ms", millis.empty() ? 0.0 : total / millis.size());
+    json.value("p50_ms", percentile(millis, 0.50));
+    json.value("p90_ms", percentile(millis, 0.90));
+    json.value("p99_ms", percentile(millis, 0.99));
+    json.value("max_ms", millis.empty() ? 0.0 : millis.back());
+}
+
+inline std::vector<DeliveryRequest> randomDeliveries(const std::vector<GeoCoord>& coords, int count, std::mt19937& rng)
+{
+    std::uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+    std::vector<DeliveryRequest> deliveries;
+    for (int i = 0; i < count; i++)
+        deliveries.push_back(DeliveryRequest("item " + std::to_string(i), coords[pick(rng)]));
+    return deliveries;
+}
+
+#endif // BENCHSUPPORT_INCLUDED
@@ -0,0 +1,775 @@
+// Benchmark.cpp
+//
+// Performance benchmark for map loading, point-to-point routing, delivery
+// order optimization, end-to-end delivery planning and the shared hash maps.
+// Everything is driven from a seeded generator so two runs with the same map,
+// seed and sizes issue exactly the same queries. Results are printed as a
+// single JSON object.
+//
+// Build from the repository root, as one command (main.cpp is left out; this file has its own main):
+//   g++ -std=c++17 -O2 -pthread -I. bench/Benchmark.cpp $(ls *.cpp | grep -v main.cpp) -o benchmark
+// Add -DGOOBER_INSTRUMENT to also report per-phase planner counters.
+// Run:
+//   ./benchmark mapdata.txt [--seed N] [--queries N] [--plans N] [--out results.json]
+
+#include "provided.h"
+#include "StreetGraph.h"
+#include "Instrumentation.h"
+#include "Cancellation.h"
+#include "RouteCache.h"
+#include "DistanceOracle.h"
+#include "RouteGeometry.h"
+#include "DeliveryCommandWriters.h"
+#include "PlanExecutor.h"
+#include "IncrementalPlan.h"
+#include "BenchSupport.h"
+#include "ExpandableHashMap.h"
+#include "ConcurrentHashMap.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " mapdata.txt [--seed N] [--queries N] [--plans N] [--out results.json]" << endl;
+        return 1;
+    }
+    string mapFile = argv[1];
+    unsigned int seed = 42;
+    int queries = 1000;
+    int plans = 50;
+    string outFile;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        string flag = argv[i];
+        if (flag == "--seed")
+            seed = stoul(argv[i + 1]);
+        else if (flag == "--queries")
+            queries = stoi(argv[i + 1]);
+        else if (flag == "--plans")
+            plans = stoi(argv[i + 1]);
+        else if (flag == "--out")
+            outFile = argv[i + 1];
+        else
+        {
+            cerr << "Unknown option " << flag << endl;
+            return 1;
+        }
+    }
+
+    vector<GeoCoord> coords;
+    if (!loadMapCoords(mapFile, coords))
+    {
+        cerr << "Unable to read map data file " << mapFile << endl;
+        return 1;
+    }
+
+    JsonWriter json;
+    json.beginObject();
+    json.value("map", mapFile);
+    json.value("seed", (long)seed);
+    json.value("nodes", (long)coords.size());
+
+    //******************** StreetMap::load ********************
+    const int loadRuns = 3;
+    vector<double> loadMillis;
+    long rssBefore = peakRssKb();
+    StreetMap sm;
+    for (int i = 0; i < loadRuns; i++)
+    {
+        StreetMap scratch;
+        Clock::time_point started = Clock::now();
+        if (!(i == 0 ? sm : scratch).load(mapFile))
+        {
+            cerr << "Unable to load map data file " << mapFile << endl;
+            return 1;
+        }
+        loadMillis.push_back(millisSince(started));
+    }
+    json.beginObject("load");
+    json.value("runs", (long)loadRuns);
+    latencySummary(json, loadMillis);
+    json.value("peak_rss_kb", peakRssKb());
+    json.value("peak_rss_before_load_kb", rssBefore);
+    json.endObject();
+
+    //******************** generatePointToPointRoute ********************
+    {
+        mt19937 rng(seed);
+        uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+        PointToPointRouter router(&sm);
+        vector<double> millis;
+        long success = 0, noRoute = 0, badCoord = 0;
+        double miles = 0;
+        for (int q = 0; q < queries; q++)
+        {
+            const GeoCoord& from = coords[pick(rng)];
+            const GeoCoord& to = coords[pick(rng)];
+            list<StreetSegment> route;
+            double dist = 0;
+            Clock::time_point started = Clock::now();
+            DeliveryResult result = router.generatePointToPointRoute(from, to, route, dist);
+            millis.push_back(millisSince(started));
+            if (result == DELIVERY_SUCCESS)
+            {
+                success++;
+                miles += dist;
+            }
+            else if (result == NO_ROUTE)
+                noRoute++;
+            else
+                badCoord++;
+        }
+        json.beginObject("route");
+        json.value("queries", (long)queries);
+        json.value("success", success);
+        json.value("no_route", noRoute);
+        json.value("bad_coord", badCoord);
+        json.value("total_miles", miles);
+        latencySummary(json, millis);
+        json.endObject();
+    }
+
+    //******************** tiled map: the same queries paged in on demand under a budget ********************
+    {
+        const string tileFile = mapFile + ".bench-tiles";
+        Clock::time_point started = Clock::now();
+        bool saved = sm.saveTiles(tileFile);
+        double saveMillis = millisSince(started);
+        const size_t budget = 1048576;
+        StreetMap tiled;
+        started = Clock::now();
+        bool loaded = saved && tiled.loadTiles(tileFile, budget);
+        double loadTilesMillis = millisSince(started);
+        if (loaded)
+        {
+            mt19937 rng(seed);
+            uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+            PointToPointRouter router(&tiled);
+            vector<double> millis;
+            double miles = 0;
+            QueryStats total;
+            for (int q = 0; q < queries; q++)
+            {
+                const GeoCoord& from = coords[pick(rng)];
+                const GeoCoord& to = coords[pick(rng)];
+                list<StreetSegment> route;
+                double dist = 0;
+                QueryStats stats;
+                Clock::time_point queryStarted = Clock::now();
+                if (router.generatePointToPointRoute(from, to, route, dist, stats) == DELIVERY_SUCCESS)
+                    miles += dist;
+                millis.push_back(millisSince(queryStarted));
+                total.add(stats);
+            }
+            json.beginObject("route_tiled");
+            json.value("tiles", (long)tiled.graph().tiles.size());
+            json.value("budget_bytes", (long)budget);
+            json.value("save_ms", saveMillis);
+            json.value("load_ms", loadTilesMillis);
+            json.value("total_miles", miles);  //matches route.total_miles
+            json.value("resident_bytes", (long)tiled.residentTileBytes());
+            json.value("tile_loads", total.tileLoads);  //stay 0 without -DGOOBER_INSTRUMENT
+            json.value("tile_evictions", total.tileEvictions);
+            latencySummary(json, millis);
+            json.endObject();
+        }
+        remove(tileFile.c_str());
+    }
+
+    //******************** arc flags: the same queries with edges pruned by destination region ********************
+    {
+        StreetMap flagged;
+        flagged.load(mapFile);
+        const int regions = 32;
+        Clock::time_point started = Clock::now();
+        bool built = flagged.buildArcFlags(regions);
+        double buildMillis = millisSince(started);
+        if (built)
+        {
+            mt19937 rng(seed);
+            uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+            PointToPointRouter router(&flagged);
+            vector<double> millis;
+            double miles = 0;
+            QueryStats total;
+            for (int q = 0; q < queries; q++)
+            {
+                const GeoCoord& from = coords[pick(rng)];
+                const GeoCoord& to = coords[pick(rng)];
+                list<StreetSegment> route;
+                double dist = 0;
+                QueryStats stats;
+                Clock::time_point queryStarted = Clock::now();
+                if (router.generatePointToPointRoute(from, to, route, dist, stats) == DELIVERY_SUCCESS)
+                    miles += dist;
+                millis.push_back(millisSince(queryStarted));
+                total.add(stats);
+            }
+            json.beginObject("route_arc_flags");
+            json.value("regions", (long)regions);
+            json.value("build_ms", buildMillis);
+            json.value("total_miles", miles);  //matches route.total_miles
+            json.value("nodes_settled", total.nodesSettled);  //stay 0 without -DGOOBER_INSTRUMENT
+            json.value("edges_pruned", total.arcFlagPrunes);
+            latencySummary(json, millis);
+            json.endObject();
+        }
+    }
+
+    //******************** route geometry: StreetSegment text vs encoded ********************
+    {
+        mt19937 rng(seed);  //same pairs as the route section
+        uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+        RouteCache cache(&sm, queries);  //routes are found once, so only serializing is timed
+        PointToPointRouter router(&sm, &cache);
+        long segmentBytes = 0, polylineBytes = 0, varintBytes = 0;
+        double segmentMillis = 0, polylineMillis = 0, varintMillis = 0;
+        RouteGeometry polyline(RouteGeometry::POLYLINE);
+        RouteGeometry varint(RouteGeometry::VARINT);
+        for (int q = 0; q < queries; q++)
+        {
+            const GeoCoord& from = coords[pick(rng)];
+            const GeoCoord& to = coords[pick(rng)];
+            list<StreetSegment> route;
+            double dist = 0;
+            if (router.generatePointToPointRoute(from, to, route, dist) != DELIVERY_SUCCESS)
+                continue;
+            Clock::time_point started = Clock::now();
+            route.clear();
+            router.generatePointToPointRoute(from, to, route, dist);
+            ostringstream text;
+            for (const StreetSegment& seg : route)
+                text << seg.start.latitudeText << ' ' << seg.start.longitudeText << ' '
+                     << seg.end.latitudeText << ' ' << seg.end.longitudeText << ' ' << seg.name << '\n';
+            segmentBytes += (long)text.tellp();
+            segmentMillis += millisSince(started);
+            started = Clock::now();
+            router.generatePointToPointGeometry(from, to, polyline, dist);
+            polylineBytes += (long)polyline.encoded().size();
+            polylineMillis += millisSince(started);
+            started = Clock::now();
+            router.generatePointToPointGeometry(from, to, varint, dist);
+            varintBytes += (long)varint.encoded().size();
+            varintMillis += millisSince(started);
+        }
+        json.beginObject("route_geometry");
+        json.value("segment_text_bytes", segmentBytes);
+        json.value("segment_text_ms", segmentMillis);
+        json.value("polyline_bytes", polylineBytes);
+        json.value("polyline_ms", polylineMillis);
+        json.value("varint_bytes", varintBytes);
+        json.value("varint_ms", varintMillis);
+        json.endObject();
+    }
+
+    //******************** reachability: one sweep vs a point query per candidate ********************
+    {
+        const double budgetMiles = 2.0;
+        const int candidates = min(queries, 1000);
+        mt19937 rng(seed + 4);
+        uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+        PointToPointRouter router(&sm);
+        GeoCoord depot = coords[pick(rng)];
+        vector<GeoCoord> points;
+        for (int i = 0; i < candidates; i++)
+            points.push_back(coords[pick(rng)]);
+        Clock::time_point started = Clock::now();
+        long withinByQuery = 0;
+        for (const GeoCoord& p : points)
+        {
+            double dist = 0;
+            if (router.generatePointToPointDistance(depot, p, dist) == DELIVERY_SUCCESS && dist <= budgetMiles)
+                withinByQuery++;
+        }
+        double queryMillis = millisSince(started);
+        started = Clock::now();
+        ReachableSet reachable;
+        router.generateReachable(depot, budgetMiles, reachable);
+        vector<bool> inReach(coords.size(), false);
+        for (int node : reachable.nodes)
+            inReach[node] = true;
+        long withinBySweep = 0;
+        for (const GeoCoord& p : points)
+        {
+            int node = sm.nodeId(p);
+            if (node >= 0 && inReach[node])
+                withinBySweep++;
+        }
+        double sweepMillis = millisSince(started);
+        vector<GeoCoord> depots;
+        for (int i = 0; i < 16; i++)
+            depots.push_back(coords[pick(rng)]);
+        vector<ReachableSet> batch;
+        vector<DeliveryResult> results;
+        started = Clock::now();
+        router.generateReachable(depots, budgetMiles, batch, results);
+        double batchMillis = millisSince(started);
+        json.beginObject("reachability");
+        json.value("budget_miles", budgetMiles);
+        json.value("candidates", (long)candidates);
+        json.value("within_by_query", withinByQuery);
+        json.value("within_by_sweep", withinBySweep);
+        json.value("point_queries_ms", queryMillis);
+        json.value("sweep_ms", sweepMillis);
+        json.value("sweep_nodes", (long)reachable.nodes.size());
+        json.value("sweep_edges", (long)reachable.edges.size());
+        json.value("batch_depots", (long)depots.size());
+        json.value("batch_ms", batchMillis);
+        json.endObject();
+    }
+
+    //******************** generatePointToPointRoute through a RouteCache ********************
+    {
+        //a small pool of depots paired with random stops, in both directions, like planner legs
+        mt19937 rng(seed + 3);
+        uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+        vector<GeoCoord> depots;
+        for (int i = 0; i < 8; i++)
+            depots.push_back(coords[pick(rng)]);
+        RouteCache cache(&sm);
+        PointToPointRouter router(&sm, &cache);
+        vector<double> millis;
+        for (int q = 0; q < queries; q++)
+        {
+            const GeoCoord& depot = depots[q % depots.size()];
+            const GeoCoord& stop = coords[pick(rng) % (coords.size() / 16 + 1)];  //stops drawn from a small area so legs repeat
+            list<StreetSegment> route;
+            double dist = 0;
+            Clock::time_point started = Clock::now();
+            if (q % 2 == 0)
+                router.generatePointToPointRoute(depot, stop, route, dist);
+            else
+                router.generatePointToPointRoute(stop, depot, route, dist);
+            millis.push_back(millisSince(started));
+        }
+        json.beginObject("route_cached");
+        json.value("queries", (long)queries);
+        json.value("hits", cache.hits());
+        json.value("misses", cache.misses());
+        json.value("entries", (long)cache.size());
+        latencySummary(json, millis);
+        json.endObject();
+    }
+
+    //******************** DistanceOracle ********************
+    {
+        DistanceOracle oracle(&sm);
+        oracle.build();
+        PointToPointRouter router(&sm, nullptr, nullptr, &oracle);
+        mt19937 rng(seed);  //same pairs as the route section
+        uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+        vector<double> millis;
+        for (int q = 0; q < queries; q++)
+        {
+            const GeoCoord& from = coords[pick(rng)];
+            const GeoCoord& to = coords[pick(rng)];
+            double dist = 0;
+            Clock::time_point started = Clock::now();
+            router.generatePointToPointDistance(from, to, dist);
+            millis.push_back(millisSince(started));
+        }
+        json.beginObject("distance_oracle");
+        json.value("build_seconds", oracle.buildSeconds());
+        json.value("label_entries", oracle.labelEntries());
+        json.value("average_label_size", oracle.averageLabelSize());
+        json.value("index_bytes", oracle.indexBytes());
+        json.value("queries", (long)queries);
+        latencySummary(json, millis);
+        json.endObject();
+    }
+
+    //******************** optimizeDeliveryOrder ********************
+    {
+        const int stopCounts[] = { 2, 4, 8, 16, 32, 64, 128 };
+        const int runsPerCount = 5;
+        mt19937 rng(seed + 1);
+        DeliveryOptimizer optimizer(&sm);
+        json.beginArray("optimize");
+        for (int stops : stopCounts)
+        {
+            vector<double> millis;
+            double oldTotal = 0, newTotal = 0;
+            for (int r = 0; r < runsPerCount; r++)
+            {
+                GeoCoord depot = coords[uniform_int_distribution<size_t>(0, coords.size() - 1)(rng)];
+                vector<DeliveryRequest> deliveries = randomDeliveries(coords, stops, rng);
+                double oldCrow = 0, newCrow = 0;
+                Clock::time_point started = Clock::now();
+                optimizer.optimizeDeliveryOrder(depot, deliveries, oldCrow, newCrow);
+                millis.push_back(millisSince(started));
+                oldTotal += oldCrow;
+                newTotal += newCrow;
+            }
+            json.beginObject();
+            json.value("stops", (long)stops);
+            json.value("runs", (long)runsPerCount);
+            latencySummary(json, millis);
+            json.value("old_crow_miles", oldTotal / runsPerCount);
+            json.value("new_crow_miles", newTotal / runsPerCount);
+            json.value("improvement_ratio", oldTotal > 0 ? newTotal / oldTotal : 1.0);
+            json.endObject();
+        }
+        json.endArray();
+    }
+
+    //******************** optimizeDeliveryOrder by road distance ********************
+    {
+        const int stopCounts[] = { 8, 32, 128 };
+        const int runsPerCount = 3;
+        mt19937 rng(seed + 3);
+        uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+        PointToPointRouter router(&sm);
+        DeliveryOptimizer crowOptimizer(&sm);
+        DeliveryOptimizer roadOptimizer(&sm, ROAD_METRIC);
+        DeliveryPlanner planner(&sm);
+        json.beginArray("optimize_road");
+        for (int stops : stopCounts)
+        {
+            double crowMillis = 0, roadMillis = 0, crowTourMiles = 0, roadTourMiles = 0;
+            for (int r = 0; r < runsPerCount; r++)
+            {
+                //stops the depot can reach and get back from, so every tour has a road length
+                GeoCoord depot = coords[pick(rng)];
+                vector<DeliveryRequest> deliveries;
+                while ((int)deliveries.size() < stops)
+                {
+                    const GeoCoord& stop = coords[pick(rng)];
+                    double there = 0, back = 0;
+                    if (router.generatePointToPointDistance(depot, stop, there) == DELIVERY_SUCCESS &&
+                        router.generatePointToPointDistance(stop, depot, back) == DELIVERY_SUCCESS)
+                        deliveries.push_back(DeliveryRequest("item", stop));
+                }
+                vector<int> order;
+                double oldDist = 0, newDist = 0;
+                Clock::time_point started = Clock::now();
+                crowOptimizer.optimizeDeliveryOrder(depot, deliveries, order, oldDist, newDist);
+                crowMillis += millisSince(started);
+                vector<DeliveryRequest> inOrder;
+                for (int i : order)
+                    inOrder.push_back(deliveries[i]);
+                vector<DeliveryCommand> commands;
+                double miles = 0;
+                planner.generateDeliveryPlanInOrder(depot, inOrder, commands, miles);
+                crowTourMiles += miles;
+                started = Clock::now();
+                roadOptimizer.optimizeDeliveryOrder(depot, deliveries, order, oldDist, newDist);
+                roadMillis += millisSince(started);
+                roadTourMiles += newDist;
+            }
+            json.beginObject();
+            json.value("stops", (long)stops);
+            json.value("runs", (long)runsPerCount);
+            json.value("crow_metric_ms", crowMillis / runsPerCount);
+            json.value("crow_metric_road_miles", crowTourMiles / runsPerCount);
+            json.value("road_metric_ms", roadMillis / runsPerCount);
+            json.value("road_metric_road_miles", roadTourMiles / runsPerCount);
+            json.endObject();
+        }
+        json.endArray();
+    }
+
+    //******************** generateDeliveryPlan ********************
+    {
+        const int stopsPerPlan = 8;
+        mt19937 rng(seed + 2);
+        uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+        DeliveryPlanner planner(&sm);
+        vector<double> millis;
+        long success = 0;
+        long commandCount = 0;
+        QueryStats allStats;
+        Clock::time_point allStarted = Clock::now();
+        for (int p = 0; p < plans; p++)
+        {
+            GeoCoord depot = coords[pick(rng)];
+            vector<DeliveryRequest> deliveries = randomDeliveries(coords, stopsPerPlan, rng);
+            vector<DeliveryCommand> commands;
+            double miles = 0;
+            Clock::time_point started = Clock::now();
+            QueryStats stats;
+            if (planner.generateDeliveryPlan(depot, deliveries, commands, miles, stats) == DELIVERY_SUCCESS)
+                success++;
+            millis.push_back(millisSince(started));
+            allStats.add(stats);
+            commandCount += commands.size();
+        }
+        double allMillis = millisSince(allStarted);
+        json.beginObject("plan");
+        json.value("plans", (long)plans);
+        json.value("stops_per_plan", (long)stopsPerPlan);
+        json.value("success", success);
+        json.value("commands", commandCount);
+        json.value("plans_per_second", allMillis > 0 ? plans * 1000.0 / allMillis : 0.0);
+        latencySummary(json, millis);
+#ifdef GOOBER_INSTRUMENT
+        json.beginObject("stats");
+        json.value("nodes_settled", allStats.nodesSettled);
+        json.value("heap_pushes", allStats.heapPushes);
+        json.value("heap_pops", allStats.heapPops);
+        json.value("hash_lookups", allStats.hashLookups);
+        json.value("rehashes", allStats.rehashes);
+        json.value("optimizer_iterations", allStats.optimizerIterations);
+        json.value("optimizer_acceptances", allStats.optimizerAcceptances);
+        json.value("optimize_ms", allStats.optimizeMillis);
+        json.value("route_ms", allStats.routeMillis);
+        json.value("command_ms", allStats.commandMillis);
+        json.endObject();
+#endif
+        json.endObject();
+    }
+
+    //******************** plan text: vector of commands vs streamed writer ********************
+    {
+        const int stopsPerPlan = 8;
+        DeliveryPlanner planner(&sm);
+        long vectorBytes = 0;
+        long streamBytes = 0;
+        double vectorMillis = 0;
+        double streamMillis = 0;
+        for (int pass = 0; pass < 2; pass++)
+        {
+            mt19937 rng(seed + 2);  //same plans as the plan section
+            uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+            ostringstream text;
+            TextCommandWriter writer(text);
+            Clock::time_point started = Clock::now();
+            for (int p = 0; p < plans; p++)
+            {
+                GeoCoord depot = coords[pick(rng)];
+                vector<DeliveryRequest> deliveries = randomDeliveries(coords, stopsPerPlan, rng);
+                double miles = 0;
+                if (pass == 0)
+                {
+                    vector<DeliveryCommand> commands;
+                    planner.generateDeliveryPlan(depot, deliveries, commands, miles);
+                    for (const DeliveryCommand& dc : commands)
+                        text << dc.description() << '\n';
+                }
+                else
+                    planner.generateDeliveryPlan(depot, deliveries, writer, miles);
+            }
+            (pass == 0 ? vectorMillis : streamMillis) = millisSince(started);
+            (pass == 0 ? vectorBytes : streamBytes) = (long)text.tellp();
+        }
+        json.beginObject("plan_text");
+        json.value("plans", (long)plans);
+        json.value("vector_ms", vectorMillis);
+        json.value("stream_ms", streamMillis);
+        json.value("vector_bytes", vectorBytes);
+        json.value("stream_bytes", streamBytes);
+        json.endObject();
+    }
+
+    //******************** async plans: throughput on an executor, and how fast cancelled ones let go ********************
+    {
+        const int stopsPerPlan = 8;
+        const int slowStops = 100;
+        DeliveryPlanner planner(&sm);
+        DeliveryPlanner roadPlanner(&sm, nullptr, nullptr, ROAD_METRIC);
+        PlanExecutor executor;
+        mt19937 rng(seed + 2);  //same plans as the plan section
+        uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+        vector<future<PlanOutcome>> outcomes;
+        Clock::time_point started = Clock::now();
+        for (int p = 0; p < plans; p++)
+        {
+            GeoCoord depot = coords[pick(rng)];
+            outcomes.push_back(planner.generateDeliveryPlanAsync(depot, randomDeliveries(coords, stopsPerPlan, rng), executor));
+        }
+        long success = 0;
+        for (future<PlanOutcome>& outcome : outcomes)
+            if (outcome.get().result == DELIVERY_SUCCESS)
+                success++;
+        double asyncMillis = millisSince(started);
+
+        //road-metric plans big enough to run a while, each cancelled shortly after it starts
+        vector<double> releaseMillis;
+        long cancelled = 0;
+        for (int p = 0; p < 5; p++)
+        {
+            GeoCoord depot = coords[pick(rng)];
+            CancellationToken token;
+            future<PlanOutcome> outcome = roadPlanner.generateDeliveryPlanAsync(depot, randomDeliveries(coords, slowStops, rng),
+                                                                                executor, token);
+            outcome.wait_for(chrono::milliseconds(20));
+            Clock::time_point cancelledAt = Clock::now();
+            token.cancel();
+            if (outcome.get().result == CANCELLED)
+                cancelled++;
+            releaseMillis.push_back(millisSince(cancelledAt));
+        }
+        json.beginObject("plan_async");
+        json.value("plans", (long)plans);
+        json.value("threads", (long)executor.threads());
+        json.value("success", success);
+        json.value("wall_ms", asyncMillis);
+        json.value("cancelled", cancelled);
+        json.beginObject("cancel_to_ready");
+        latencySummary(json, releaseMillis);
+        json.endObject();
+        json.endObject();
+    }
+
+    //******************** incremental plans: one stop added or called off vs planning again ********************
+    {
+        const int stopsPerPlan = 40;
+        const int edits = 30;
+        IncrementalPlan incremental(&sm);
+        DeliveryPlanner planner(&sm);
+        mt19937 rng(seed + 3);
+        uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+        GeoCoord depot;
+        DeliveryResult planned = NO_ROUTE;
+        for (int attempt = 0; attempt < 20 && planned != DELIVERY_SUCCESS; attempt++)  //random stops aren't always all reachable
+        {
+            depot = coords[pick(rng)];
+            planned = incremental.plan(depot, randomDeliveries(coords, stopsPerPlan, rng));
+        }
+        vector<double> editMillis;
+        vector<double> replanMillis;
+        long success = 0;
+        long long legsBefore = incremental.legsRouted();
+        double replanMiles = 0;
+        for (int e = 0; e < edits && planned == DELIVERY_SUCCESS && !incremental.deliveries().empty(); e++)
+        {
+            Clock::time_point started = Clock::now();
+            DeliveryResult result;
+            if (e % 3 == 2)
+                result = incremental.removeStop((int)(rng() % incremental.deliveries().size()));
+            else
+            {
+                int position;
+                result = incremental.insertStop(DeliveryRequest("late item " + to_string(e), coords[pick(rng)]), position);
+            }
+            editMillis.push_back(millisSince(started));
+            if (result == DELIVERY_SUCCESS)
+                success++;
+        }
+        long long legs = incremental.legsRouted() - legsBefore;
+        if (planned == DELIVERY_SUCCESS)
+        {
+            vector<DeliveryCommand> commands;
+            for (int r = 0; r < 5; r++)  //the same stops planned from scratch
+            {
+                Clock::time_point started = Clock::now();
+                planner.generateDeliveryPlan(depot, incremental.deliveries(), commands, replanMiles);
+                replanMillis.push_back(millisSince(started));
+                commands.clear();
+            }
+        }
+        json.beginObject("plan_incremental");
+        json.value("planned", (long)(planned == DELIVERY_SUCCESS));
+        json.value("stops", (long)incremental.deliveries().size());
+        json.value("edits", (long)editMillis.size());
+        json.value("success", success);
+        json.value("legs_per_edit", editMillis.empty() ? 0.0 : (double)legs / editMillis.size());
+        json.value("miles", incremental.totalDistanceTravelled());
+        json.value("replan_miles", replanMiles);
+        json.beginObject("edit");
+        latencySummary(json, editMillis);
+        json.endObject();
+        json.beginObject("replan");
+        latencySummary(json, replanMillis);
+        json.endObject();
+        json.endObject();
+    }
+
+    //******************** shared hash map under contention: ConcurrentHashMap vs a mutex around ExpandableHashMap ********************
+    {
+        const int opsPerThread = 200000;
+        const int writePercent = 5;  //read-mostly, as a shared coordinate table or memo would be
+        ConcurrentHashMap<GeoCoord, int> concurrent;
+        ExpandableHashMap<GeoCoord, int> locked;
+        mutex lockedMutex;
+        for (int i = 0; i < (int)coords.size(); i++)
+        {
+            concurrent.associate(coords[i], i);
+            locked.associate(coords[i], i);
+        }
+        unsigned int maxThreads = max(4u, thread::hardware_concurrency());
+        json.beginArray("hashmap_contention");
+        for (unsigned int threads = 1; threads <= maxThreads; threads *= 2)
+        {
+            double millis[2];
+            long found[2] = { 0, 0 };
+            for (int variant = 0; variant < 2; variant++)
+            {
+                atomic<long> hits(0);
+                vector<thread> workers;
+                Clock::time_point started = Clock::now();
+                for (unsigned int t = 0; t < threads; t++)
+                    workers.emplace_back([&, t, variant]() {
+                        mt19937 rng(seed + 4 + t);
+                        uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+                        uniform_int_distribution<int> percent(0, 99);
+                        long mine = 0;
+                        int value = 0;
+                        for (int op = 0; op < opsPerThread; op++)
+                        {
+                            const GeoCoord& key = coords[pick(rng)];
+                            bool write = percent(rng) < writePercent;
+                            if (variant == 0)
+                            {
+                                if (write)
+                                    concurrent.associate(key, op);
+                                else if (concurrent.find(key, value))
+                                    mine++;
+                            }
+                            else
+                            {
+                                lock_guard<mutex> lk(lockedMutex);
+                                if (write)
+                                    locked.associate(key, op);
+                                else if (locked.find(key) != nullptr)
+                                    mine++;
+                            }
+                        }
+                        hits.fetch_add(mine);
+                    });
+                for (thread& w : workers)
+                    w.join();
+                millis[variant] = millisSince(started);
+                found[variant] = hits.load();
+            }
+            long ops = (long)threads * opsPerThread;
+            json.beginObject();
+            json.value("threads", (long)threads);
+            json.value("write_percent", (long)writePercent);
+            json.value("concurrent_ops_per_second", millis[0] > 0 ? ops * 1000.0 / millis[0] : 0.0);
+            json.value("mutex_ops_per_second", millis[1] > 0 ? ops * 1000.0 / millis[1] : 0.0);
+            json.value("concurrent_hits", found[0]);
+            json.value("mutex_hits", found[1]);
+            json.endObject();
+        }
+        json.endArray();
+    }
+
+    json.value("peak_rss_kb", peakRssKb());
+    json.endObject();
+
+    if (outFile.empty())
+        cout << json.str() << endl;
+    else
+    {
+        ofstream out(outFile);
+        if (!out)
+        {
+            cerr << "Unable to write " << outFile << endl;
+            return 1;
+        }
+        out << json.str() << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,1041 @@
+// Differential.cpp
+//
+// Checks the routers, the reachability sweep, incremental plans and the
+// optimizer against plain reference answers on the same map, and reports what
+// each faster mode buys over the reference.
+//
+// Reference: the map file is read a second time by a parser of its own into
+// an adjacency list keyed on the coordinate text, so no answer it gives goes
+// through StreetMap, its graph or its node ids. A textbook Dijkstra (binary
+// heap, stops when the goal is settled) runs on that list.
+//
+// Routers: seeded random pairs, a few with the same start and end and a few
+// with a coordinate that isn't on the map. Every router mode answers the same
+// pairs and must agree on the result (DELIVERY_SUCCESS, NO_ROUTE or BAD_COORD)
+// and the distance. Modes that return a route must also return a connected
+// chain of real segments from start to end whose lengths add up to the
+// distance. The same checks run again under a WeightOverlay: seeded
+// slowdowns, one-way and two-way closures, reopened segments and whole-street
+// changes, made to the overlay and to a copy of the reference alike. There the
+// route must also be open end to end and its weights must add up to the
+// reference's cheapest, while the distance is still the route's real miles.
+//
+// Reachable: generateReachable from seeded starts for several budgets, with
+// and without the overlay, must report exactly the nodes within the budget at
+// their reference distances, and exactly the edges that can be driven end to
+// end within it. Nodes and edges within a hair of the budget may go either
+// way. The batch version must give what one call per start gives.
+//
+// Incremental: an IncrementalPlan takes seeded inserts and removals. After each,
+// its stops must be the ones added and not removed, its distance the reference
+// tour length through them, and its commands what generateDeliveryPlanInOrder
+// gives for its order. Edits that can't succeed must leave the plan as it was.
+//
+// Optimizer: for small stop sets the best order is found by trying every
+// permutation, on crow distance for CROW_METRIC (depot through every stop) and
+// on reference road distance for ROAD_METRIC (back to the depot included),
+// which runs with and without the DistanceOracle. The optimizer's order must
+// be a permutation whose length is what it reports. Up to EXACT_STOPS stops it
+// must also be the best order; above that the optimizer is a heuristic, so a
+// set fails only when it is more than MAX_GAP longer than the best. How far off
+// it is on average is reported either way.
+//
+// Build from the repository root (main.cpp is left out; this file has its own main):
+//   g++ -std=c++17 -O2 -pthread -I. bench/Differential.cpp $(ls *.cpp | grep -v main.cpp) -o differential
+// Run:
+//   ./differential mapdata.txt [--seed N] [--pairs N] [--stop-sets N] [--edits N] [--out results.json]
+// Prints a JSON report and exits with 1 if any check failed.
+
+#include "provided.h"
+#include "StreetGraph.h"
+#include "WeightOverlay.h"
+#include "RouteCache.h"
+#include "DistanceOracle.h"
+#include "IncrementalPlan.h"
+#include "BenchSupport.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cmath>
+using namespace std;
+
+namespace {
+
+const double INF = numeric_limits<double>::infinity();
+
+  // distances agree if they are within this fraction of the longer one (plus a hair, for zero)
+const double RELATIVE_TOLERANCE = 1e-9;
+
+  // up to this many stops the optimizer has to find the best order outright
+const int EXACT_STOPS = 3;
+  // above that, how much longer than the best order a set may be before it counts as a failure
+const double MAX_GAP = 0.5;
+
+bool sameDistance(double a, double b)
+{
+    return fabs(a - b) <= RELATIVE_TOLERANCE * max(1.0, max(fabs(a), fabs(b)));
+}
+
+struct ReferenceEdge
+{
+    int to;
+    double length;  // miles
+    double weight;  // what a search pays: length times the overlay's factor, INF if closed
+    string street;
+};
+
+  // The map file read independently of StreetMap: a node per distinct
+  // coordinate text, numbered in the order they first appear, and both
+  // directions of every segment in adjacency lists.
+struct ReferenceMap
+{
+    vector<GeoCoord> coords;
+    map<pair<string, string>, int> ids;
+    vector<vector<ReferenceEdge>> edges;  // node -> edges leaving it
+
+    int node(const GeoCoord& gc) const  // -1 if not on the map
+    {
+        auto it = ids.find(make_pair(gc.latitudeText, gc.longitudeText));
+        return it == ids.end() ? -1 : it->second;
+    }
+
+    int nodeCount() const { return (int)coords.size(); }
+
+    bool load(string mapFile)
+    {
+        ifstream infile(mapFile);
+        if (!infile)
+            return false;
+        string street;
+        while (getline(infile, street))
+        {
+            int segs = 0;
+            infile >> segs;
+            infile.ignore(10000, '\n');
+            for (int i = 0; i < segs; i++)
+            {
+                string lat, lon, lat2, lon2;
+                infile >> lat >> lon >> lat2 >> lon2;
+                infile.ignore(10000, '\n');
+                int a = addNode(lat, lon);
+                int b = addNode(lat2, lon2);
+                double length = distanceEarthMiles(coords[a], coords[b]);
+                edges[a].push_back(ReferenceEdge{b, length, length, street});
+                edges[b].push_back(ReferenceEdge{a, length, length, street});
+            }
+        }
+        return !coords.empty();
+    }
+
+private:
+    int addNode(const string& lat, const string& lon)
+    {
+        auto it = ids.find(make_pair(lat, lon));
+        if (it != ids.end())
+            return it->second;
+        ids[make_pair(lat, lon)] = nodeCount();
+        coords.push_back(GeoCoord(lat, lon));
+        edges.push_back(vector<ReferenceEdge>());
+        return nodeCount() - 1;
+    }
+};
+
+  // Textbook Dijkstra from node from over the reference's edge weights. dist
+  // gets every node's distance (INF if not reached); with to >= 0 it stops once
+  // to is settled, so only the nodes settled by then are final. If miles is
+  // given it gets the real length of the path each node was reached by.
+void referenceDijkstra(const ReferenceMap& ref, int from, int to, vector<double>& dist, vector<double>* miles = nullptr)
+{
+    dist.assign(ref.nodeCount(), INF);
+    if (miles != nullptr)
+        miles->assign(ref.nodeCount(), INF);
+    vector<bool> settled(ref.nodeCount(), false);
+    typedef pair<double, int> Entry;
+    priority_queue<Entry, vector<Entry>, greater<Entry>> open;
+    dist[from] = 0;
+    if (miles != nullptr)
+        (*miles)[from] = 0;
+    open.push(Entry(0, from));
+    while (!open.empty()){
+        int q = open.top().second;
+        open.pop();
+        if (settled[q])
+            continue;
+        settled[q] = true;
+        if (q == to)
+            return;
+        for (const ReferenceEdge& e : ref.edges[q]){
+            double nextDist = dist[q] + e.weight;
+            if (nextDist < dist[e.to]){
+                dist[e.to] = nextDist;
+                if (miles != nullptr)
+                    (*miles)[e.to] = (*miles)[q] + e.length;
+                open.push(Entry(nextDist, e.to));
+            }
+        }
+    }
+}
+
+  // One change to make to a WeightOverlay and to the reference alike.
+struct OverlayEdit
+{
+    enum Kind { MULTIPLY, CLOSE, REOPEN, MULTIPLY_STREET, CLOSE_STREET };
+    Kind kind;
+    GeoCoord from;
+    GeoCoord to;
+    bool bothWays;
+    string street;
+    double factor;  // MULTIPLY and MULTIPLY_STREET
+};
+
+bool applyEdit(WeightOverlay& overlay, const OverlayEdit& edit)
+{
+    switch (edit.kind)
+    {
+      case OverlayEdit::MULTIPLY:
+        return overlay.setMultiplier(edit.from, edit.to, edit.factor, edit.bothWays);
+      case OverlayEdit::CLOSE:
+        return overlay.close(edit.from, edit.to, edit.bothWays);
+      case OverlayEdit::REOPEN:
+        return overlay.reopen(edit.from, edit.to, edit.bothWays);
+      case OverlayEdit::MULTIPLY_STREET:
+        return overlay.setStreetMultiplier(edit.street, edit.factor);
+      case OverlayEdit::CLOSE_STREET:
+        return overlay.closeStreet(edit.street);
+    }
+    return false;
+}
+
+void applyEdit(ReferenceMap& ref, const OverlayEdit& edit)
+{
+    double factor = edit.kind == OverlayEdit::CLOSE || edit.kind == OverlayEdit::CLOSE_STREET ? INF
+                  : edit.kind == OverlayEdit::REOPEN ? 1 : edit.factor;
+    if (edit.kind == OverlayEdit::MULTIPLY_STREET || edit.kind == OverlayEdit::CLOSE_STREET)
+    {
+        for (vector<ReferenceEdge>& out : ref.edges)
+            for (ReferenceEdge& e : out)
+                if (e.street == edit.street)
+                    e.weight = e.length * factor;
+        return;
+    }
+    int a = ref.node(edit.from);
+    int b = ref.node(edit.to);
+    for (ReferenceEdge& e : ref.edges[a])  //every copy of the segment, if the map repeats it
+        if (e.to == b)
+            e.weight = e.length * factor;
+    if (edit.bothWays)
+        for (ReferenceEdge& e : ref.edges[b])
+            if (e.to == a)
+                e.weight = e.length * factor;
+}
+
+struct QueryPair
+{
+    GeoCoord from;
+    GeoCoord to;
+};
+
+struct Answer
+{
+    DeliveryResult result;
+    double distance;  // real miles, which routers report even under an overlay
+    double weight;    // what the route costs under the weights it was found by
+};
+
+  // reference answers to every pair under one set of weights
+struct ReferenceAnswers
+{
+    vector<Answer> answers;
+    long counts[3] = { 0, 0, 0 };  // by DeliveryResult, CANCELLED aside
+    double millis = 0;
+};
+
+void answerPairs(const ReferenceMap& ref, const vector<QueryPair>& queryPairs, ReferenceAnswers& out)
+{
+    out.answers.resize(queryPairs.size());
+    vector<double> dist, miles;
+    Clock::time_point started = Clock::now();
+    for (size_t q = 0; q < queryPairs.size(); q++)
+    {
+        int from = ref.node(queryPairs[q].from);
+        int to = ref.node(queryPairs[q].to);
+        if (from < 0 || to < 0)
+            out.answers[q] = Answer{BAD_COORD, 0, 0};
+        else
+        {
+            referenceDijkstra(ref, from, to, dist, &miles);
+            out.answers[q] = dist[to] == INF ? Answer{NO_ROUTE, 0, 0} : Answer{DELIVERY_SUCCESS, miles[to], dist[to]};
+        }
+        out.counts[out.answers[q].result]++;
+    }
+    out.millis = millisSince(started);
+}
+
+  // One way of answering a pair, checked against the reference it should agree with.
+  // run fills route only if routes is true.
+struct RouterMode
+{
+    string name;
+    const ReferenceMap* ref;
+    const ReferenceAnswers* expected;
+    bool routes;
+    function<DeliveryResult(const GeoCoord&, const GeoCoord&, list<StreetSegment>&, double&)> run;
+};
+
+  // "" if route is a chain of open reference segments from from to to whose
+  // lengths add up to distance and whose weights add up to weight, otherwise what's wrong
+string routeProblem(const ReferenceMap& ref, const GeoCoord& from, const GeoCoord& to,
+                    const list<StreetSegment>& route, double distance, double weight)
+{
+    if (route.empty())
+        return from == to ? "" : "empty route between different points";
+    if (route.front().start != from)
+        return "route doesn't start at the start";
+    if (route.back().end != to)
+        return "route doesn't end at the end";
+    const GeoCoord* at = &from;
+    double length = 0, cost = 0;
+    for (const StreetSegment& seg : route){
+        if (seg.start != *at)
+            return "route is broken between two segments";
+        int a = ref.node(seg.start);
+        int b = ref.node(seg.end);
+        if (a < 0 || b < 0)
+            return "segment is off the map";
+        const ReferenceEdge* cheapest = nullptr;  //the copy to go by, if the map repeats the segment
+        for (const ReferenceEdge& e : ref.edges[a])
+            if (e.to == b && e.street == seg.name && (cheapest == nullptr || e.weight < cheapest->weight))
+                cheapest = &e;
+        if (cheapest == nullptr)
+            return "segment isn't on the map";
+        if (cheapest->weight == INF)
+            return "route uses a closed segment";
+        length += cheapest->length;
+        cost += cheapest->weight;
+        at = &seg.end;
+    }
+    if (!sameDistance(length, distance))
+        return "segments don't add up to the distance reported";
+    if (!sameDistance(cost, weight))
+        return "route isn't the cheapest under the weights";
+    return "";
+}
+
+const char* resultName(DeliveryResult result)
+{
+    switch (result)
+    {
+      case DELIVERY_SUCCESS:
+        return "DELIVERY_SUCCESS";
+      case NO_ROUTE:
+        return "NO_ROUTE";
+      case BAD_COORD:
+        return "BAD_COORD";
+      case CANCELLED:
+        return "CANCELLED";
+    }
+    return "?";
+}
+
+  // length of order through crow, the CROW_METRIC objective: depot, then every stop
+double crowLength(const vector<vector<double>>& crow, const vector<int>& order)
+{
+    double total = 0;
+    int at = 0;
+    for (int stop : order){
+        total += crow[at][stop + 1];
+        at = stop + 1;
+    }
+    return total;
+}
+
+  // length of order through road, the ROAD_METRIC objective: depot, every stop, depot
+double tourLength(const vector<vector<double>>& road, const vector<int>& order)
+{
+    return crowLength(road, order) + (order.empty() ? 0 : road[order.back() + 1][0]);
+}
+
+  // best length over every order of n stops; row and column 0 of the matrix are the depot
+double exactBest(const vector<vector<double>>& matrix, int n, bool closed)
+{
+    vector<int> order(n);
+    iota(order.begin(), order.end(), 0);
+    double best = INF;
+    do {
+        best = min(best, closed ? tourLength(matrix, order) : crowLength(matrix, order));
+    } while (next_permutation(order.begin(), order.end()));
+    return best;
+}
+
+vector<string> descriptions(const vector<DeliveryCommand>& commands)
+{
+    vector<string> out;
+    for (const DeliveryCommand& c : commands)
+        out.push_back(c.description());
+    return out;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " mapdata.txt [--seed N] [--pairs N] [--stop-sets N] [--edits N] [--out results.json]" << endl;
+        return 1;
+    }
+    string mapFile = argv[1];
+    unsigned int seed = 42;
+    int pairs = 2000;
+    int stopSets = 20;
+    int edits = 12;
+    string outFile;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        string flag = argv[i];
+        if (flag == "--seed")
+            seed = stoul(argv[i + 1]);
+        else if (flag == "--pairs")
+            pairs = stoi(argv[i + 1]);
+        else if (flag == "--stop-sets")
+            stopSets = stoi(argv[i + 1]);
+        else if (flag == "--edits")
+            edits = stoi(argv[i + 1]);
+        else if (flag == "--out")
+            outFile = argv[i + 1];
+        else
+        {
+            cerr << "Unknown option " << flag << endl;
+            return 1;
+        }
+    }
+
+    vector<GeoCoord> coords;
+    ReferenceMap ref;
+    StreetMap sm;
+    if (!loadMapCoords(mapFile, coords) || !ref.load(mapFile) || !sm.load(mapFile))
+    {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    long failures = 0;
+
+    JsonWriter json;
+    json.beginObject();
+    json.value("map", mapFile);
+    json.value("seed", (long)seed);
+
+    //******************** the pairs and the reference answers ********************
+    vector<QueryPair> queryPairs;
+    {
+        mt19937 rng(seed);
+        uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+        uniform_int_distribution<int> percent(0, 99);
+        for (int q = 0; q < pairs; q++)
+        {
+            QueryPair p{coords[pick(rng)], coords[pick(rng)]};
+            int kind = percent(rng);
+            if (kind < 2)  //same start and end
+                p.to = p.from;
+            else if (kind < 4)  //a start that isn't on the map
+                p.from = GeoCoord(p.from.latitudeText + "5", p.from.longitudeText);
+            else if (kind < 6)  //an end that isn't on the map
+                p.to = GeoCoord(p.to.latitudeText, p.to.longitudeText + "5");
+            queryPairs.push_back(p);
+        }
+    }
+    ReferenceAnswers reference;
+    answerPairs(ref, queryPairs, reference);
+    json.beginObject("reference");
+    json.value("pairs", (long)pairs);
+    json.value("success", reference.counts[DELIVERY_SUCCESS]);
+    json.value("no_route", reference.counts[NO_ROUTE]);
+    json.value("bad_coord", reference.counts[BAD_COORD]);
+    json.value("ms", reference.millis);
+    json.endObject();
+
+    //******************** the overlay edits and the reference under them ********************
+    StreetMap flagged;
+    bool flagsBuilt = flagged.load(mapFile) && flagged.buildArcFlags(32);
+    WeightOverlay overlay(&sm);
+    WeightOverlay flaggedOverlay(&flagged);
+    ReferenceMap overlaid = ref;
+    {
+        mt19937 rng(seed + 2);
+        uniform_int_distribution<int> pickNode(0, ref.nodeCount() - 1);
+        uniform_int_distribution<int> percent(0, 99);
+        const double factors[] = { 1.25, 1.5, 2, 3, 4 };  //exact in float, which the overlay keeps them in
+        vector<OverlayEdit> overlayEdits;
+        for (int i = 0; i < edits; i++)
+        {
+            int a = pickNode(rng);
+            while (ref.edges[a].empty())
+                a = pickNode(rng);
+            const ReferenceEdge& e = ref.edges[a][rng() % ref.edges[a].size()];
+            OverlayEdit edit{OverlayEdit::MULTIPLY, ref.coords[a], ref.coords[e.to], percent(rng) < 70, e.street,
+                             factors[rng() % 5]};
+            int kind = percent(rng);
+            if (kind < 5)
+                edit.kind = OverlayEdit::CLOSE_STREET;
+            else if (kind < 10)
+                edit.kind = OverlayEdit::MULTIPLY_STREET;
+            else if (kind < 40)
+                edit.kind = OverlayEdit::CLOSE;
+            else if (kind < 45 && !overlayEdits.empty())  //reopen something edited earlier, closed or not
+            {
+                edit = overlayEdits[rng() % overlayEdits.size()];
+                if (edit.kind == OverlayEdit::MULTIPLY_STREET || edit.kind == OverlayEdit::CLOSE_STREET)
+                    continue;
+                edit.kind = OverlayEdit::REOPEN;
+            }
+            overlayEdits.push_back(edit);
+        }
+        long editErrors = 0;
+        Clock::time_point started = Clock::now();
+        for (const OverlayEdit& edit : overlayEdits)
+        {
+            applyEdit(overlaid, edit);
+            if (!applyEdit(overlay, edit))
+                editErrors++;
+        }
+        double millis = millisSince(started);
+        started = Clock::now();
+        for (const OverlayEdit& edit : overlayEdits)
+            if (flagsBuilt && !applyEdit(flaggedOverlay, edit))
+                editErrors++;
+        double flaggedMillis = millisSince(started);
+        failures += editErrors;
+        json.beginObject("overlay");
+        json.value("edits", (long)overlayEdits.size());
+        json.value("edit_errors", editErrors);
+        json.value("ms", millis);
+        json.value("arc_flags_ms", flaggedMillis);  //each edit publishes at once; stale regions are redone in the background
+        json.endObject();
+    }
+    ReferenceAnswers overlaidReference;
+    answerPairs(overlaid, queryPairs, overlaidReference);
+    json.beginObject("overlay_reference");
+    json.value("success", overlaidReference.counts[DELIVERY_SUCCESS]);
+    json.value("no_route", overlaidReference.counts[NO_ROUTE]);
+    json.value("bad_coord", overlaidReference.counts[BAD_COORD]);
+    json.value("ms", overlaidReference.millis);
+    json.endObject();
+
+    //******************** every router mode against the reference ********************
+    PointToPointRouter plainRouter(&sm);
+
+    RouteCache cache(&sm, pairs * 4);
+    PointToPointRouter cachedRouter(&sm, &cache);
+    PointToPointRouter cachedOverlayRouter(&sm, &cache, &overlay);
+    for (const QueryPair& p : queryPairs)  //fill the cache for both; the timed passes are all hits
+    {
+        list<StreetSegment> route;
+        double dist = 0;
+        cachedRouter.generatePointToPointRoute(p.from, p.to, route, dist);
+        cachedOverlayRouter.generatePointToPointRoute(p.from, p.to, route, dist);
+    }
+
+    PointToPointRouter flaggedRouter(&flagged);
+    PointToPointRouter overlayRouter(&sm, nullptr, &overlay);
+    PointToPointRouter flaggedOverlayRouter(&flagged, nullptr, &flaggedOverlay);
+
+    const string tileFile = mapFile + ".differential-tiles";
+    StreetMap tiled;
+    bool tilesLoaded = sm.saveTiles(tileFile) && tiled.loadTiles(tileFile, 1048576);  //small budget, so tiles are evicted and paged back in
+    PointToPointRouter tiledRouter(&tiled);
+
+    DistanceOracle oracle(&sm);
+    bool oracleBuilt = oracle.build();
+    PointToPointRouter oracleRouter(&sm, nullptr, nullptr, &oracle);
+    PointToPointRouter oracleOverlayRouter(&sm, nullptr, &overlay, &oracle);  //must search around the oracle
+
+    vector<RouterMode> modes;
+    modes.push_back(RouterMode{"astar", &ref, &reference, true,
+        [&](const GeoCoord& a, const GeoCoord& b, list<StreetSegment>& route, double& dist) {
+            return plainRouter.generatePointToPointRoute(a, b, route, dist); }});
+    modes.push_back(RouterMode{"astar_distance", &ref, &reference, false,
+        [&](const GeoCoord& a, const GeoCoord& b, list<StreetSegment>&, double& dist) {
+            return plainRouter.generatePointToPointDistance(a, b, dist); }});
+    modes.push_back(RouterMode{"route_cache", &ref, &reference, true,
+        [&](const GeoCoord& a, const GeoCoord& b, list<StreetSegment>& route, double& dist) {
+            return cachedRouter.generatePointToPointRoute(a, b, route, dist); }});
+    if (flagsBuilt)
+        modes.push_back(RouterMode{"arc_flags", &ref, &reference, true,
+            [&](const GeoCoord& a, const GeoCoord& b, list<StreetSegment>& route, double& dist) {
+                return flaggedRouter.generatePointToPointRoute(a, b, route, dist); }});
+    if (tilesLoaded)
+        modes.push_back(RouterMode{"tiled", &ref, &reference, true,
+            [&](const GeoCoord& a, const GeoCoord& b, list<StreetSegment>& route, double& dist) {
+                return tiledRouter.generatePointToPointRoute(a, b, route, dist); }});
+    if (oracleBuilt)
+        modes.push_back(RouterMode{"distance_oracle", &ref, &reference, false,
+            [&](const GeoCoord& a, const GeoCoord& b, list<StreetSegment>&, double& dist) {
+                return oracleRouter.generatePointToPointDistance(a, b, dist); }});
+    modes.push_back(RouterMode{"overlay_astar", &overlaid, &overlaidReference, true,
+        [&](const GeoCoord& a, const GeoCoord& b, list<StreetSegment>& route, double& dist) {
+            return overlayRouter.generatePointToPointRoute(a, b, route, dist); }});
+    modes.push_back(RouterMode{"overlay_astar_distance", &overlaid, &overlaidReference, false,
+        [&](const GeoCoord& a, const GeoCoord& b, list<StreetSegment>&, double& dist) {
+            return overlayRouter.generatePointToPointDistance(a, b, dist); }});
+    modes.push_back(RouterMode{"overlay_route_cache", &overlaid, &overlaidReference, true,
+        [&](const GeoCoord& a, const GeoCoord& b, list<StreetSegment>& route, double& dist) {
+            return cachedOverlayRouter.generatePointToPointRoute(a, b, route, dist); }});
+    if (flagsBuilt)
+        modes.push_back(RouterMode{"overlay_arc_flags", &overlaid, &overlaidReference, true,
+            [&](const GeoCoord& a, const GeoCoord& b, list<StreetSegment>& route, double& dist) {
+                return flaggedOverlayRouter.generatePointToPointRoute(a, b, route, dist); }});
+    if (flagsBuilt)  //the same once every region's flags are redone; the first query waits for that
+        modes.push_back(RouterMode{"overlay_arc_flags_redone", &overlaid, &overlaidReference, true,
+            [&](const GeoCoord& a, const GeoCoord& b, list<StreetSegment>& route, double& dist) {
+                flaggedOverlay.waitForArcFlags();
+                return flaggedOverlayRouter.generatePointToPointRoute(a, b, route, dist); }});
+    if (oracleBuilt)
+        modes.push_back(RouterMode{"overlay_distance_oracle", &overlaid, &overlaidReference, false,
+            [&](const GeoCoord& a, const GeoCoord& b, list<StreetSegment>&, double& dist) {
+                return oracleOverlayRouter.generatePointToPointDistance(a, b, dist); }});
+
+    json.beginArray("routers");
+    for (const RouterMode& mode : modes)
+    {
+        vector<Answer> answers(pairs);
+        vector<list<StreetSegment>> routes(mode.routes ? pairs : 0);
+        list<StreetSegment> scratch;
+        Clock::time_point started = Clock::now();
+        for (int q = 0; q < pairs; q++)
+        {
+            double dist = 0;
+            answers[q].result = mode.run(queryPairs[q].from, queryPairs[q].to, mode.routes ? routes[q] : scratch, dist);
+            answers[q].distance = dist;
+        }
+        double millis = millisSince(started);
+
+        long resultErrors = 0, distanceErrors = 0, routeErrors = 0;
+        double maxError = 0;
+        for (int q = 0; q < pairs; q++)
+        {
+            const Answer& want = mode.expected->answers[q];
+            const Answer& got = answers[q];
+            string problem;
+            if (got.result != want.result)
+            {
+                resultErrors++;
+                problem = string("got ") + resultName(got.result) + ", expected " + resultName(want.result);
+            }
+            else if (got.result == DELIVERY_SUCCESS)
+            {
+                maxError = max(maxError, fabs(got.distance - want.distance));
+                if (!sameDistance(got.distance, want.distance))
+                {
+                    distanceErrors++;
+                    problem = "distance " + to_string(got.distance) + ", expected " + to_string(want.distance);
+                }
+                else if (mode.routes && !(problem = routeProblem(*mode.ref, queryPairs[q].from, queryPairs[q].to, routes[q], got.distance, want.weight)).empty())
+                    routeErrors++;
+            }
+            if (!problem.empty() && resultErrors + distanceErrors + routeErrors <= 5)  //the first few are enough to go on
+                cerr << mode.name << ": " << queryPairs[q].from.latitudeText << "," << queryPairs[q].from.longitudeText
+                     << " -> " << queryPairs[q].to.latitudeText << "," << queryPairs[q].to.longitudeText << ": " << problem << endl;
+        }
+        failures += resultErrors + distanceErrors + routeErrors;
+        json.beginObject();
+        json.value("mode", mode.name);
+        json.value("result_errors", resultErrors);
+        json.value("distance_errors", distanceErrors);
+        json.value("route_errors", routeErrors);
+        json.value("max_distance_error", maxError);
+        json.value("ms", millis);
+        json.value("speedup", millis > 0 ? mode.expected->millis / millis : 0.0);
+        json.endObject();
+    }
+    json.endArray();
+    remove(tileFile.c_str());
+
+    //******************** reachable sets against full reference sweeps ********************
+    {
+        const int starts = 10;
+        const double budgets[] = { -1, 0, 0.5, 2, INF };
+        vector<GeoCoord> startCoords;
+        mt19937 rng(seed + 3);
+        uniform_int_distribution<size_t> pick(0, coords.size() - 1);
+        for (int i = 0; i < starts; i++)
+            startCoords.push_back(coords[pick(rng)]);
+        startCoords.push_back(GeoCoord(startCoords[0].latitudeText + "5", startCoords[0].longitudeText));  //not on the map
+        const StreetGraph& g = sm.graph();  //only to turn the ids handed back into coordinates
+        json.beginArray("reachable");
+        for (int weighting = 0; weighting < 2; weighting++)
+        {
+            const PointToPointRouter& router = weighting == 0 ? plainRouter : overlayRouter;
+            const ReferenceMap& r = weighting == 0 ? ref : overlaid;
+            for (double budget : budgets)
+            {
+                vector<ReachableSet> batch;
+                vector<DeliveryResult> batchResults;
+                Clock::time_point started = Clock::now();
+                router.generateReachable(startCoords, budget, batch, batchResults, 2);
+                double millis = millisSince(started);
+                double referenceMillis = 0;
+                long resultErrors = 0, nodeErrors = 0, distanceErrors = 0, edgeErrors = 0, batchErrors = 0, nodesFound = 0;
+                  //what lands within a hair of the budget may go either way
+                double slack = budget == INF ? 0 : RELATIVE_TOLERANCE * max(1.0, fabs(budget));
+                for (size_t i = 0; i < startCoords.size(); i++)
+                {
+                    ReachableSet reachable;
+                    DeliveryResult result = router.generateReachable(startCoords[i], budget, reachable);
+                    if (result != batchResults[i] || reachable.nodes != batch[i].nodes ||
+                        reachable.distances != batch[i].distances || reachable.edges != batch[i].edges)
+                        batchErrors++;
+                    int from = r.node(startCoords[i]);
+                    if (from < 0)
+                    {
+                        if (result != BAD_COORD || !reachable.nodes.empty() || !reachable.edges.empty())
+                            resultErrors++;
+                        continue;
+                    }
+                    if (result != DELIVERY_SUCCESS)
+                    {
+                        resultErrors++;
+                        continue;
+                    }
+                    vector<double> dist;
+                    started = Clock::now();
+                    referenceDijkstra(r, from, -1, dist);
+                    referenceMillis += millisSince(started);
+                    nodesFound += reachable.nodes.size();
+
+                    //every node reported is within the budget at its reference distance, and none is missing
+                    vector<bool> reported(r.nodeCount(), false);
+                    for (size_t k = 0; k < reachable.nodes.size(); k++)
+                    {
+                        int v = r.node(g.coord(reachable.nodes[k]));
+                        if (v < 0 || reported[v] || !(dist[v] <= budget + slack))
+                            nodeErrors++;
+                        else if (!sameDistance(dist[v], reachable.distances[k]))
+                            distanceErrors++;
+                        if (v >= 0)
+                            reported[v] = true;
+                    }
+                    for (int v = 0; v < r.nodeCount(); v++)
+                        if (!reported[v] && dist[v] < budget - slack)
+                            nodeErrors++;
+
+                    //every edge reported can be driven end to end within the budget, and none is missing
+                    vector<int> edges = reachable.edges;
+                    sort(edges.begin(), edges.end());
+                    if (adjacent_find(edges.begin(), edges.end()) != edges.end())
+                        edgeErrors++;
+                    long within = 0, nearly = 0;  //reference edges clearly within the budget, and within it give or take the slack
+                    for (int v = 0; v < r.nodeCount(); v++)
+                        for (const ReferenceEdge& e : r.edges[v])
+                        {
+                            double end = dist[v] + e.weight;
+                            within += end < budget - slack;
+                            nearly += end <= budget + slack;
+                        }
+                    for (int e : reachable.edges)
+                    {
+                        StreetSegment seg = g.segment(e);
+                        int a = r.node(seg.start);
+                        int b = r.node(seg.end);
+                        bool fits = false;
+                        for (size_t k = 0; a >= 0 && k < r.edges[a].size(); k++)
+                        {
+                            const ReferenceEdge& re = r.edges[a][k];
+                            if (re.to == b && re.street == seg.name && dist[a] + re.weight <= budget + slack)
+                                fits = true;
+                        }
+                        if (!fits)
+                            edgeErrors++;
+                    }
+                    if ((long)reachable.edges.size() < within || (long)reachable.edges.size() > nearly)
+                        edgeErrors++;
+                }
+                failures += resultErrors + nodeErrors + distanceErrors + edgeErrors + batchErrors;
+                json.beginObject();
+                json.value("weights", string(weighting == 0 ? "map" : "overlay"));
+                json.value("budget", budget == INF ? -2.0 : budget);  //-2 stands for no limit, which JSON can't write
+                json.value("nodes_found", nodesFound);
+                json.value("result_errors", resultErrors);
+                json.value("node_errors", nodeErrors);
+                json.value("distance_errors", distanceErrors);
+                json.value("edge_errors", edgeErrors);
+                json.value("batch_errors", batchErrors);
+                json.value("batch_ms", millis);
+                json.value("reference_ms", referenceMillis);
+                json.endObject();
+            }
+        }
+        json.endArray();
+    }
+
+    //******************** incremental plan edits against reference tours ********************
+    {
+        mt19937 rng(seed + 4);
+        uniform_int_distribution<int> pickNode(0, ref.nodeCount() - 1);
+        uniform_int_distribution<int> percent(0, 99);
+        //a depot with plenty of the map reachable from it; stops are picked from there
+        int depotNode = pickNode(rng);
+        vector<int> candidates;
+        for (int attempt = 0; attempt < 50 && candidates.size() < 100; attempt++)
+        {
+            depotNode = pickNode(rng);
+            vector<double> dist;
+            referenceDijkstra(ref, depotNode, -1, dist);
+            candidates.clear();
+            for (int v = 0; v < ref.nodeCount(); v++)
+                if (dist[v] != INF && v != depotNode)
+                    candidates.push_back(v);
+        }
+        map<int, vector<double>> roadFrom;  //reference distances from each stop's node, swept once
+        auto road = [&](int a, int b) {
+            if (roadFrom.find(a) == roadFrom.end())
+                referenceDijkstra(ref, a, -1, roadFrom[a]);
+            return roadFrom[a][b];
+        };
+        GeoCoord depot = ref.coords[depotNode];
+        vector<string> expected;  //item names of the stops that should be in the plan
+        int nextItem = 0;
+        auto newStop = [&]() {
+            string item = "stop " + to_string(nextItem++);
+            return DeliveryRequest(item, ref.coords[candidates[rng() % candidates.size()]]);
+        };
+
+        IncrementalPlan plan(&sm);
+        DeliveryPlanner inOrder(&sm);
+        long planErrors = 0, stopErrors = 0, distanceErrors = 0, commandErrors = 0, failedEditErrors = 0;
+        long fullReplanLegs = 0;
+        double editMillis = 0, inOrderMillis = 0;
+        auto check = [&]() {
+            vector<string> items;
+            for (const DeliveryRequest& d : plan.deliveries())
+                items.push_back(d.item);
+            sort(items.begin(), items.end());
+            vector<string> want = expected;
+            sort(want.begin(), want.end());
+            if (items != want)
+                stopErrors++;
+            double length = 0;
+            int at = depotNode;
+            for (const DeliveryRequest& d : plan.deliveries())
+            {
+                int next = ref.node(d.location);
+                length += road(at, next);
+                at = next;
+            }
+            length += road(at, depotNode);
+            if (!sameDistance(length, plan.totalDistanceTravelled()))
+                distanceErrors++;
+            vector<DeliveryCommand> commands;
+            double total = 0;
+            Clock::time_point started = Clock::now();
+            DeliveryResult result = inOrder.generateDeliveryPlanInOrder(depot, plan.deliveries(), commands, total);
+            inOrderMillis += millisSince(started);
+            if (result != DELIVERY_SUCCESS || descriptions(commands) != descriptions(plan.commands()))
+                commandErrors++;
+        };
+
+        vector<DeliveryRequest> initial;
+        for (int i = 0; i < 6; i++)
+        {
+            initial.push_back(newStop());
+            expected.push_back(initial.back().item);
+        }
+        Clock::time_point started = Clock::now();
+        if (plan.plan(depot, initial) != DELIVERY_SUCCESS)
+            planErrors++;
+        editMillis += millisSince(started);
+        check();
+        for (int edit = 0; edit < edits; edit++)
+        {
+            int stops = (int)plan.deliveries().size();
+            fullReplanLegs += stops + 1;
+            if (stops == 0 || percent(rng) < 60)
+            {
+                DeliveryRequest stop = newStop();
+                int position = -1;
+                started = Clock::now();
+                DeliveryResult result = plan.insertStop(stop, position);
+                editMillis += millisSince(started);
+                if (result != DELIVERY_SUCCESS || position < 0 || position >= (int)plan.deliveries().size() ||
+                    plan.deliveries()[position].item != stop.item)
+                    planErrors++;
+                expected.push_back(stop.item);
+            }
+            else
+            {
+                int position = rng() % stops;
+                string item = plan.deliveries()[position].item;
+                started = Clock::now();
+                DeliveryResult result = plan.removeStop(position);
+                editMillis += millisSince(started);
+                if (result != DELIVERY_SUCCESS)
+                    planErrors++;
+                expected.erase(find(expected.begin(), expected.end(), item));
+            }
+            check();
+        }
+
+        //edits that can't succeed leave the plan exactly as it was
+        vector<string> before = descriptions(plan.commands());
+        double beforeDistance = plan.totalDistanceTravelled();
+        int position = -1;
+        if (plan.removeStop((int)plan.deliveries().size()) == DELIVERY_SUCCESS)
+            failedEditErrors++;
+        if (plan.removeStop(-1) == DELIVERY_SUCCESS)
+            failedEditErrors++;
+        if (plan.insertStop(DeliveryRequest("nowhere", GeoCoord(depot.latitudeText + "5", depot.longitudeText)), position) != BAD_COORD)
+            failedEditErrors++;
+        if (descriptions(plan.commands()) != before || plan.totalDistanceTravelled() != beforeDistance)
+            failedEditErrors++;
+        check();
+
+        failures += planErrors + stopErrors + distanceErrors + commandErrors + failedEditErrors;
+        json.beginObject("incremental");
+        json.value("edits", (long)edits);
+        json.value("plan_errors", planErrors);
+        json.value("stop_errors", stopErrors);
+        json.value("distance_errors", distanceErrors);
+        json.value("command_errors", commandErrors);
+        json.value("failed_edit_errors", failedEditErrors);
+        json.value("legs_routed", (long)plan.legsRouted());
+        json.value("full_replan_legs", fullReplanLegs);  //what routing every tour again from scratch would take
+        json.value("ms", editMillis);
+        json.value("in_order_ms", inOrderMillis);
+        json.endObject();
+    }
+
+    //******************** optimizer orders against every permutation ********************
+    {
+        const int minStops = 2;
+        const int maxStops = 7;
+        mt19937 rng(seed + 1);
+        uniform_int_distribution<int> pickNode(0, ref.nodeCount() - 1);
+        DeliveryOptimizer crowOptimizer(&sm);
+        DeliveryOptimizer roadOptimizer(&sm, ROAD_METRIC);
+        DeliveryOptimizer oracleOptimizer(&sm, ROAD_METRIC, nullptr, &oracle);  //road distances looked up, not searched
+        const char* metricNames[] = { "crow", "road", "road_oracle" };
+        json.beginArray("optimizer");
+        for (int n = minStops; n <= maxStops; n++)
+        {
+            for (int metric = 0; metric < 3; metric++)
+            {
+                bool road = metric >= 1;
+                const DeliveryOptimizer& optimizer = metric == 0 ? crowOptimizer : metric == 1 ? roadOptimizer : oracleOptimizer;
+                long optimal = 0, orderErrors = 0, lengthErrors = 0, gapErrors = 0, sets = 0;
+                double allowedGap = n <= EXACT_STOPS ? RELATIVE_TOLERANCE : MAX_GAP;
+                double totalGap = 0, maxGap = 0, optimizerMillis = 0, exactMillis = 0;
+                for (int s = 0; s < stopSets; s++)
+                {
+                    //n stops and a depot all reachable from one another, found by one full sweep from each
+                    vector<int> nodes;
+                    vector<vector<double>> roadMatrix;
+                    for (int attempt = 0; attempt < 50 && (int)nodes.size() != n + 1; attempt++)
+                    {
+                        nodes.assign(1, pickNode(rng));
+                        vector<double> fromDepot;
+                        referenceDijkstra(ref, nodes[0], -1, fromDepot);
+                        vector<int> reachable;
+                        for (int v = 0; v < ref.nodeCount(); v++)
+                            if (fromDepot[v] != INF && v != nodes[0])
+                                reachable.push_back(v);
+                        if ((int)reachable.size() < n)
+                            continue;
+                        shuffle(reachable.begin(), reachable.end(), rng);
+                        nodes.insert(nodes.end(), reachable.begin(), reachable.begin() + n);
+                        roadMatrix.assign(n + 1, vector<double>(n + 1, 0));
+                        bool connected = true;
+                        for (int i = 0; i <= n && connected; i++)
+                        {
+                            vector<double> dist;
+                            referenceDijkstra(ref, nodes[i], -1, dist);
+                            for (int j = 0; j <= n; j++)
+                            {
+                                roadMatrix[i][j] = dist[nodes[j]];
+                                connected = connected && dist[nodes[j]] != INF;
+                            }
+                        }
+                        if (!connected)
+                            nodes.clear();
+                    }
+                    if ((int)nodes.size() != n + 1)
+                        continue;
+                    sets++;
+                    GeoCoord depot = ref.coords[nodes[0]];
+                    vector<DeliveryRequest> deliveries;
+                    for (int i = 1; i <= n; i++)
+                        deliveries.push_back(DeliveryRequest("item " + to_string(i), ref.coords[nodes[i]]));
+                    vector<vector<double>> crowMatrix(n + 1, vector<double>(n + 1, 0));
+                    for (int i = 0; i <= n; i++)
+                        for (int j = 0; j <= n; j++)
+                            crowMatrix[i][j] = distanceEarthMiles(i == 0 ? depot : deliveries[i - 1].location,
+                                                                  j == 0 ? depot : deliveries[j - 1].location);
+                    const vector<vector<double>>& matrix = road ? roadMatrix : crowMatrix;
+
+                    vector<int> order;
+                    double oldLength = 0, newLength = 0;
+                    Clock::time_point started = Clock::now();
+                    optimizer.optimizeDeliveryOrder(depot, deliveries, order, oldLength, newLength);
+                    optimizerMillis += millisSince(started);
+                    started = Clock::now();
+                    double best = exactBest(matrix, n, road);
+                    exactMillis += millisSince(started);
+
+                    vector<int> sorted = order;
+                    sort(sorted.begin(), sorted.end());
+                    vector<int> identity(n);
+                    iota(identity.begin(), identity.end(), 0);
+                    if (sorted != identity)
+                    {
+                        orderErrors++;
+                        continue;
+                    }
+                    double length = road ? tourLength(matrix, order) : crowLength(matrix, order);
+                    if (!sameDistance(length, newLength))
+                        lengthErrors++;
+                    double gap = best > 0 ? length / best - 1 : 0;
+                    if (gap <= RELATIVE_TOLERANCE)
+                        optimal++;
+                    if (gap > allowedGap)
+                        gapErrors++;
+                    totalGap += max(gap, 0.0);
+                    maxGap = max(maxGap, gap);
+                }
+                failures += orderErrors + lengthErrors + gapErrors;
+                json.beginObject();
+                json.value("metric", string(metricNames[metric]));
+                json.value("stops", (long)n);
+                json.value("sets", sets);
+                json.value("order_errors", orderErrors);
+                json.value("length_errors", lengthErrors);
+                json.value("gap_errors", gapErrors);
+                json.value("allowed_gap", allowedGap);
+                json.value("optimal", optimal);
+                json.value("mean_gap", sets > 0 ? totalGap / sets : 0.0);
+                json.value("max_gap", maxGap);
+                json.value("optimizer_ms", optimizerMillis);
+                json.value("exact_ms", exactMillis);
+                json.endObject();
+            }
+        }
+        json.endArray();
+    }
+
+    json.value("failures", failures);
+    json.endObject();
+
+    if (outFile.empty())
+        cout << json.str() << endl;
+    else
+    {
+        ofstream out(outFile);
+        out << json.str() << endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -1,30 +1,50 @@
 #include "provided.h"
+#include "RouteCache.h"
+#include "DeliveryCommandWriters.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <exception>
+#include <cstdlib>
 using namespace std;
 
-bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v);
-bool parseDelivery(string line, string& lat, string& lon, string& item);
+bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v, ostream& diag = cout);
+bool parseDelivery(string line, string& lat, string& lon, string& item, ostream& diag = cout);
+bool isCoordinate(const string& text);
+int runBatch(const StreetMap& sm, string batchSource, unsigned int threadCount);
+bool parseThreadCount(string text, unsigned int& count);
 
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
+    bool batch = (argc == 4 || argc == 5) && string(argv[2]) == "--batch";
+    unsigned int threadCount = thread::hardware_concurrency();
+    if ((argc != 3 && !batch) || (batch && argc == 5 && !parseThreadCount(argv[4], threadCount)))
     {
         cout << "Usage: " << argv[0] << " mapdata.txt deliveries.txt" << endl;
+        cout << "       " << argv[0] << " mapdata.txt --batch deliveriesDirOrManifest [threads]" << endl;
         return 1;
     }
 
     StreetMap sm;
-        
+
     if (!sm.load(argv[1]))
     {
         cout << "Unable to load map data file " << argv[1] << endl;
         return 1;
     }
 
+    if (batch)
+        return runBatch(sm, argv[3], threadCount);
+
     GeoCoord depot;
     vector<DeliveryRequest> deliveries;
     if (!loadDeliveryRequests(argv[2], depot, deliveries))
@@ -36,9 +56,13 @@ int main(int argc, char *argv[])
     cout << "Generating route...\n\n";
 
     DeliveryPlanner dp(&sm);
-    vector<DeliveryCommand> dcs;
+    ostringstream commandText; //held back until we know the plan succeeded
     double totalMiles;
-    DeliveryResult result = dp.generateDeliveryPlan(depot, deliveries, dcs, totalMiles);
+    DeliveryResult result;
+    {
+        TextCommandWriter writer(commandText);
+        result = dp.generateDeliveryPlan(depot, deliveries, writer, totalMiles);
+    }
     if (result == BAD_COORD)
     {
         cout << "One or more depot or delivery coordinates are invalid." << endl;
@@ -50,15 +74,14 @@ int main(int argc, char *argv[])
         return 1;
     }
     cout << "Starting at the depot...\n";
-    for (const auto& dc : dcs)
-        cout << dc.description() << endl;
+    cout << commandText.str();
     cout << "You are back at the depot and your deliveries are done!\n";
     cout.setf(ios::fixed);
     cout.precision(2);
     cout << totalMiles << " miles travelled for all deliveries." << endl;
 }
 
-bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v)
+bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v, ostream& diag)
 {
     ifstream inf(deliveriesFile);
     if (!inf)
@@ -67,36 +90,240 @@ bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<Deliver
     string lon;
     inf >> lat >> lon;
     inf.ignore(10000, '\n');
+    if (!isCoordinate(lat) || !isCoordinate(lon)) //an empty file lands here too
+    {
+        diag << "Bad depot line in deliveries file " << deliveriesFile << "\n";
+        return false;
+    }
     depot = GeoCoord(lat, lon);
     string line;
     while (getline(inf, line))
     {
         string item;
-        if (parseDelivery(line, lat, lon, item))
+        if (parseDelivery(line, lat, lon, item, diag))
             v.push_back(DeliveryRequest(item, GeoCoord(lat, lon)));
     }
     return true;
 }
 
-bool parseDelivery(string line, string& lat, string& lon, string& item)
+bool parseDelivery(string line, string& lat, string& lon, string& item, ostream& diag)
 {
     const size_t colon = line.find(':');
     if (colon == string::npos)
     {
-        cout << "Missing colon in deliveries file line: " << line << endl;
+        diag << "Missing colon in deliveries file line: " << line << "\n";
         return false;
     }
     istringstream iss(line.substr(0, colon));
-    if (!(iss >> lat >> lon))
+    if (!(iss >> lat >> lon) || !isCoordinate(lat) || !isCoordinate(lon))
     {
-        cout << "Bad format in deliveries file line: " << line << endl;
+        diag << "Bad format in deliveries file line: " << line << "\n";
         return false;
     }
     item = line.substr(colon + 1);
     if (item.empty())
     {
-        cout << "Missing item in deliveries file line: " << line << endl;
+        diag << "Missing item in deliveries file line: " << line << "\n";
+        return false;
+    }
+    return true;
+}
+
+  // true if text is a number as a whole, so GeoCoord can convert it without throwing
+bool isCoordinate(const string& text)
+{
+    const char* begin = text.c_str();
+    char* end = nullptr;
+    strtod(begin, &end);
+    return end != begin && *end == '\0';
+}
+
+//******************** batch mode *********************************************
+
+// Batch mode plans every deliveries file from a directory (all regular files,
+// in name order) or a manifest (one path per line) against the one StreetMap
+// loaded above. Workers pull files off a shared counter and render each plan
+// into its own buffer; the main thread writes the buffers out in input order
+// as soon as each one is ready, then prints a per-file summary.
+
+struct BatchJob
+{
+    string file;
+    string output;           // rendered plan text, written in order once done
+    DeliveryResult result = DELIVERY_SUCCESS;
+    bool loaded = false;
+    bool crashed = false;    // planning threw; the other files still run
+    double miles = 0;
+    double millis = 0;       // parse + plan latency for this file
+    bool done = false;
+};
+
+static bool listBatchFiles(string batchSource, vector<string>& files)
+{
+    namespace fs = std::filesystem;
+    error_code ec;
+    if (fs::is_directory(batchSource, ec))
+    {
+        for (const auto& entry : fs::directory_iterator(batchSource, ec))
+            if (entry.is_regular_file())
+                files.push_back(entry.path().string());
+        sort(files.begin(), files.end());
+        return !ec;
+    }
+    ifstream manifest(batchSource);
+    if (!manifest)
         return false;
+    string line;
+    while (getline(manifest, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty() && line[0] != '#') //blank lines and comments are skipped
+            files.push_back(line);
+    }
+    return true;
+}
+
+static void planBatchFile(const DeliveryPlanner& dp, BatchJob& job, ostream& out)
+{
+    GeoCoord depot;
+    vector<DeliveryRequest> deliveries;
+    job.loaded = loadDeliveryRequests(job.file, depot, deliveries, out);
+    if (!job.loaded)
+        out << "Unable to load delivery request file " << job.file << "\n";
+    else if (deliveries.empty())
+        out << "No deliveries to plan.\n";
+    else
+    {
+        ostringstream commandText;
+        double totalMiles = 0;
+        {
+            TextCommandWriter writer(commandText);
+            job.result = dp.generateDeliveryPlan(depot, deliveries, writer, totalMiles);
+        }
+        if (job.result == BAD_COORD)
+            out << "One or more depot or delivery coordinates are invalid.\n";
+        else if (job.result == NO_ROUTE)
+            out << "No route can be found to deliver all items.\n";
+        else
+        {
+            out << "Starting at the depot...\n";
+            out << commandText.str();
+            out << "You are back at the depot and your deliveries are done!\n";
+            out.setf(ios::fixed);
+            out.precision(2);
+            out << totalMiles << " miles travelled for all deliveries.\n";
+            job.miles = totalMiles;
+        }
+    }
+}
+
+static void planBatchJob(const DeliveryPlanner& dp, BatchJob& job)
+{
+    auto started = chrono::steady_clock::now();
+    ostringstream out;
+    out << "=== " << job.file << " ===\n";
+    try
+    {
+        planBatchFile(dp, job, out);
     }
+    catch (const exception& e) //one bad file mustn't take the whole batch down with it
+    {
+        job.crashed = true;
+        job.miles = 0;
+        out << "Planning failed: " << e.what() << "\n";
+    }
+    job.output = out.str();
+    job.millis = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+}
+
+  // count gets text as a whole number of threads; false, leaving count alone, if text is anything else
+bool parseThreadCount(string text, unsigned int& count)
+{
+    if (text.empty() || text.size() > 6)
+        return false;
+    for (char c : text)
+        if (c < '0' || c > '9')
+            return false;
+    count = stoul(text);
     return true;
 }
+
+int runBatch(const StreetMap& sm, string batchSource, unsigned int threadCount)
+{
+    vector<string> files;
+    if (!listBatchFiles(batchSource, files))
+    {
+        cout << "Unable to read batch directory or manifest " << batchSource << endl;
+        return 1;
+    }
+    if (threadCount == 0)
+        threadCount = 1;
+    threadCount = min<size_t>(threadCount, max<size_t>(files.size(), 1));
+
+    ios::sync_with_stdio(false);
+    auto batchStarted = chrono::steady_clock::now();
+
+    vector<BatchJob> jobs(files.size());
+    for (size_t i = 0; i < files.size(); i++)
+        jobs[i].file = files[i];
+
+    RouteCache cache(&sm);    //depot legs repeat across files, so every worker shares one route cache
+    DeliveryPlanner dp(&sm, &cache);  //planning is read-only on the map, so one planner serves every worker
+    atomic<size_t> nextJob(0);
+    mutex doneMutex;
+    condition_variable doneChanged;
+    vector<thread> workers;
+    for (unsigned int t = 0; t < threadCount; t++)
+        workers.emplace_back([&]() {
+            for (size_t i = nextJob++; i < jobs.size(); i = nextJob++)
+            {
+                planBatchJob(dp, jobs[i]);
+                lock_guard<mutex> lk(doneMutex);
+                jobs[i].done = true;
+                doneChanged.notify_one();
+            }
+        });
+
+    //write finished plans strictly in input order while later ones are still being planned
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        {
+            unique_lock<mutex> lk(doneMutex);
+            doneChanged.wait(lk, [&]() { return jobs[i].done; });
+        }
+        cout << jobs[i].output << '\n';
+        jobs[i].output.clear();
+        jobs[i].output.shrink_to_fit();
+    }
+    for (auto& w : workers)
+        w.join();
+
+    double wallMillis = chrono::duration<double, milli>(chrono::steady_clock::now() - batchStarted).count();
+    size_t failed = 0;
+    double totalMiles = 0;
+    cout.setf(ios::fixed);
+    cout.precision(2);
+    cout << "=== summary ===\n";
+    cout << "file\tresult\tmiles\tms\n";
+    for (const auto& job : jobs)
+    {
+        const char* status = "ok";
+        if (job.crashed)
+            status = "error";
+        else if (!job.loaded)
+            status = "unreadable";
+        else if (job.result == BAD_COORD)
+            status = "bad_coord";
+        else if (job.result == NO_ROUTE)
+            status = "no_route";
+        if (job.result != DELIVERY_SUCCESS || !job.loaded || job.crashed)
+            failed++;
+        totalMiles += job.miles;
+        cout << job.file << '\t' << status << '\t' << job.miles << '\t' << job.millis << '\n';
+    }
+    cout << files.size() << " files, " << failed << " failed, " << totalMiles << " miles, "
+         << wallMillis << " ms on " << threadCount << " threads" << "\n";
+    cout << "route cache: " << cache.hits() << " hits, " << cache.misses() << " misses" << endl;
+    return failed == 0 ? 0 : 1;
+}